@@ -0,0 +1,184 @@
+/*
+ * Model of how the EC reads the descriptor at boot, and a block order that
+ * lets it start power sequencing earlier.
+ *
+ * The EC reads the header, then walks the chain reading each block header
+ * and block body as separate I2C reads. Every read is split into
+ * transactions at EEPROM page boundaries and at the maximum transfer size.
+ * A transaction is a random read: START, device address, two address bytes,
+ * repeated START, device address, data, STOP, each byte followed by ACK.
+ *
+ * Power sequencing can start once the GPIO (and GPIO action), PD and vendor
+ * blocks have been read, so the optimizer moves those first and, where it
+ * helps, inserts a padding block so a critical block does not straddle a
+ * page.
+ */
+
+struct boot_params {
+	uint32_t bus_khz;
+	uint32_t page_size;
+	uint32_t max_xfer;
+};
+
+struct boot_cost {
+	uint32_t bytes;
+	uint32_t transactions;
+	uint32_t page_crossings;
+	/* Time until the whole descriptor has been read */
+	double total_us;
+	/* Time until all power-on-critical blocks present have been read */
+	double critical_us;
+};
+
+static const uint8_t boot_critical_types[] = {
+	GPUCFG_TYPE_GPIO,
+	GPUCFG_TYPE_GPIO_ACTIONS,
+	GPUCFG_TYPE_PD,
+	GPUCFG_TYPE_VENDOR,
+};
+
+#define BOOT_CRITICAL_COUNT (sizeof(boot_critical_types) / sizeof(boot_critical_types[0]))
+
+static int boot_priority(uint8_t block_type)
+{
+	for (size_t i = 0; i < BOOT_CRITICAL_COUNT; i++) {
+		if (boot_critical_types[i] == block_type)
+			return i;
+	}
+	return BOOT_CRITICAL_COUNT;
+}
+
+static void boot_read(const struct boot_params *p, struct boot_cost *cost, uint32_t offset, uint32_t len)
+{
+	uint32_t end = offset + len;
+
+	if (offset / p->page_size != (end - 1) / p->page_size)
+		cost->page_crossings++;
+	while (offset < end) {
+		uint32_t n = p->page_size - offset % p->page_size;
+		if (n > end - offset)
+			n = end - offset;
+		if (n > p->max_xfer)
+			n = p->max_xfer;
+		/* 3 start/stop bits, 4 address bytes, data, 9 bits per byte */
+		cost->total_us += (3 + 9 * (4 + n)) * 1000.0 / p->bus_khz;
+		cost->transactions++;
+		cost->bytes += n;
+		offset += n;
+	}
+}
+
+/**
+ * Estimate the cost of the EC reading an image at boot.
+ */
+static void boot_estimate(const struct boot_params *p, const uint8_t *image, size_t len, struct boot_cost *cost)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	/* Offset of the last block of each critical type, 0 if absent */
+	size_t last[BOOT_CRITICAL_COUNT] = {0};
+	int pending = 0;
+
+	memset(cost, 0, sizeof(*cost));
+	if (end > len)
+		end = len;
+	for (size_t i = offset; i + sizeof(struct gpu_block_header) <= end;) {
+		int prio = boot_priority(view_block_block_type(image + i));
+		if (prio < (int)BOOT_CRITICAL_COUNT) {
+			pending += !last[prio];
+			last[prio] = i;
+		}
+		i += sizeof(struct gpu_block_header) + view_block_block_length(image + i);
+	}
+
+	boot_read(p, cost, 0, sizeof(struct gpu_cfg_descriptor));
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		uint8_t blen = view_block_block_length(image + offset);
+		int prio = boot_priority(view_block_block_type(image + offset));
+
+		boot_read(p, cost, offset, sizeof(struct gpu_block_header));
+		if (blen)
+			boot_read(p, cost, offset + sizeof(struct gpu_block_header), blen);
+		if (prio < (int)BOOT_CRITICAL_COUNT && last[prio] == offset && --pending == 0)
+			cost->critical_us = cost->total_us;
+		offset += sizeof(struct gpu_block_header) + blen;
+	}
+}
+
+/**
+ * Reorder the blocks of image into out: critical blocks first in
+ * boot_critical_types order, the rest in their original order. With align
+ * set, a padding block is inserted before a critical block that would
+ * otherwise straddle a page it fits in.
+ *
+ * The header is copied as is except for descriptor_length; CRCs are left
+ * for the caller to recompute.
+ *
+ * \return length of the reordered image, 0 if it does not fit in cap
+ */
+static size_t boot_reorder(const struct boot_params *p, const uint8_t *image, uint8_t *out, size_t cap, bool align)
+{
+	size_t start = sizeof(struct gpu_cfg_descriptor);
+	size_t end = start + view_desc_descriptor_length(image);
+	size_t pos = start;
+
+	if (end > cap)
+		return 0;
+	memcpy(out, image, start);
+	for (int prio = 0; prio <= (int)BOOT_CRITICAL_COUNT; prio++) {
+		for (size_t i = start; i + sizeof(struct gpu_block_header) <= end;) {
+			size_t blen = sizeof(struct gpu_block_header) + view_block_block_length(image + i);
+			size_t in_page = pos % p->page_size;
+
+			if (boot_priority(view_block_block_type(image + i)) != prio) {
+				i += blen;
+				continue;
+			}
+			if (align && prio < (int)BOOT_CRITICAL_COUNT && blen <= p->page_size &&
+					in_page + blen > p->page_size &&
+					p->page_size - in_page >= sizeof(struct gpu_block_header)) {
+				size_t pad = p->page_size - in_page;
+
+				if (pos + pad > cap)
+					return 0;
+				view_block_set_block_type(out + pos, GPUCFG_TYPE_PADDING);
+				view_block_set_block_length(out + pos, pad - sizeof(struct gpu_block_header));
+				memset(out + pos + sizeof(struct gpu_block_header), 0xFF, pad - sizeof(struct gpu_block_header));
+				pos += pad;
+			}
+			if (pos + blen > cap)
+				return 0;
+			memcpy(out + pos, image + i, blen);
+			pos += blen;
+			i += blen;
+		}
+	}
+	view_desc_set_descriptor_length(out, pos - start);
+	return pos;
+}
+
+/**
+ * Pick the reordering with the earliest critical-ready time, with or
+ * without page alignment.
+ *
+ * \return length of the chosen image in out, 0 if it does not fit in cap
+ */
+static size_t boot_optimize(const struct boot_params *p, const uint8_t *image, uint8_t *out, size_t cap)
+{
+	uint8_t aligned[IMAGE_MAX_LEN];
+	struct boot_cost plain_cost, aligned_cost;
+	size_t plain_len, aligned_len;
+
+	plain_len = boot_reorder(p, image, out, cap, false);
+	aligned_len = boot_reorder(p, image, aligned, cap < sizeof(aligned) ? cap : sizeof(aligned), true);
+	if (!plain_len || !aligned_len)
+		return plain_len;
+
+	boot_estimate(p, out, plain_len, &plain_cost);
+	boot_estimate(p, aligned, aligned_len, &aligned_cost);
+	if (aligned_cost.critical_us < plain_cost.critical_us) {
+		memcpy(out, aligned, aligned_len);
+		return aligned_len;
+	}
+	return plain_len;
+}
@@ -0,0 +1,313 @@
+/*
+ * Columnar export of decoded images for fleet analytics.
+ *
+ * One row per image and one column per schema field and element, e.g.
+ * "fan[1].max_rpm". Everything sits at a fixed offset, so readers can mmap
+ * the file and aggregate over a column without parsing anything. Layout,
+ * all little endian:
+ *
+ *   0               struct column_file_header
+ *   aligned         per column: nrows values of width bytes, followed by a
+ *                   validity bitmap (bit r set if row r has the field)
+ *   aligned         per dictionary encoded column: dict_count entries of
+ *                   dict_width bytes
+ *   directory       ncolumns struct column_desc
+ *
+ * Column data and dictionaries start on COLUMN_ALIGN boundaries. Numeric
+ * fields are stored as they are. Enum and serial fields are stored as codes
+ * into the column's dictionary, which lists the distinct raw values in
+ * order of first appearance.
+ *
+ * Values are staged per column and written COLUMN_BUF_LEN bytes at a time.
+ */
+
+#define COLUMN_MAGIC "GPUCOLS1"
+#define COLUMN_VERSION 1
+#define COLUMN_ALIGN 4096
+#define COLUMN_NAME_LEN 48
+#define COLUMN_BUF_LEN (64 * 1024)
+
+enum column_encoding {
+	COLUMN_PLAIN = 0,
+	COLUMN_DICT = 1,
+};
+
+struct column_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t ncolumns;
+	uint64_t nrows;
+	uint64_t directory_offset;
+} __packed;
+
+struct column_desc {
+	char name[COLUMN_NAME_LEN];
+	uint8_t encoding;
+	/* Bytes per value, or per dictionary code */
+	uint8_t width;
+	/* Bytes per dictionary entry */
+	uint8_t dict_width;
+	uint8_t reserved;
+	uint32_t dict_count;
+	uint64_t data_offset;
+	uint64_t valid_offset;
+	uint64_t dict_offset;
+} __packed;
+
+struct column {
+	struct column_desc desc;
+	const struct cfg_field *field;
+	int index;
+	uint8_t *buf;
+	size_t fill;
+	/* Bytes of values already written */
+	uint64_t flushed;
+	uint8_t *valid;
+	/* Dictionary entries and an open addressing table of entry + 1 */
+	uint8_t *dict;
+	uint32_t dict_cap;
+	uint32_t *slots;
+	uint32_t nslots;
+};
+
+struct column_writer {
+	int fd;
+	struct column *cols;
+	int ncols;
+	int cap;
+	uint64_t nrows;
+	uint64_t row;
+	uint64_t end;
+	bool error;
+};
+
+static inline uint64_t column_align(uint64_t offset)
+{
+	return (offset + COLUMN_ALIGN - 1) & ~(uint64_t)(COLUMN_ALIGN - 1);
+}
+
+static int column_pwrite(struct column_writer *w, const void *data, size_t len, uint64_t offset)
+{
+	const uint8_t *p = data;
+
+	while (len > 0) {
+		ssize_t n = pwrite(w->fd, p, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			w->error = true;
+			return -1;
+		}
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/**
+ * Add a column for element index of a schema field. Columns are laid out
+ * in the order they are added.
+ *
+ * \return 0 on success, -1 if out of memory
+ */
+static int column_add(struct column_writer *w, const struct cfg_field *field, int index)
+{
+	struct column *c;
+
+	if (w->ncols == w->cap) {
+		int cap = w->cap ? 2 * w->cap : 64;
+		struct column *cols = realloc(w->cols, cap * sizeof(*cols));
+		if (!cols)
+			return -1;
+		w->cols = cols;
+		w->cap = cap;
+	}
+	c = &w->cols[w->ncols++];
+	memset(c, 0, sizeof(*c));
+	c->field = field;
+	c->index = index;
+	if (field->block->header)
+		snprintf(c->desc.name, sizeof(c->desc.name), "%s.%s", field->block->name, field->name);
+	else
+		snprintf(c->desc.name, sizeof(c->desc.name), "%s[%d].%s", field->block->name, index, field->name);
+	if (field->kind == FIELD_UINT) {
+		c->desc.encoding = COLUMN_PLAIN;
+		c->desc.width = field->width;
+	} else {
+		c->desc.encoding = COLUMN_DICT;
+		/* Enums fit in a byte, so their codes do as well */
+		c->desc.width = field->kind == FIELD_ENUM ? field->width : sizeof(uint32_t);
+		c->desc.dict_width = field->width;
+	}
+	return 0;
+}
+
+/**
+ * Create the file and place every column for nrows rows.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int column_writer_start(struct column_writer *w, const char *path, uint64_t nrows)
+{
+	uint64_t offset = COLUMN_ALIGN;
+
+	w->nrows = nrows;
+	w->row = 0;
+	w->error = false;
+	for (int i = 0; i < w->ncols; i++) {
+		struct column *c = &w->cols[i];
+
+		c->desc.data_offset = offset;
+		c->desc.valid_offset = offset + nrows * c->desc.width;
+		offset = column_align(c->desc.valid_offset + (nrows + 7) / 8);
+		c->buf = malloc(COLUMN_BUF_LEN);
+		c->valid = calloc((nrows + 7) / 8 + 1, 1);
+		if (!c->buf || !c->valid) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+	}
+	w->end = offset;
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static inline uint32_t column_hash(const uint8_t *value, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ value[i]) * 16777619u;
+	return h;
+}
+
+/**
+ * Find or add value in the column's dictionary.
+ *
+ * \return dictionary code, or UINT32_MAX if out of memory
+ */
+static uint32_t column_intern(struct column *c, const uint8_t *value)
+{
+	size_t width = c->desc.dict_width;
+	uint32_t mask, i;
+
+	if (2 * (c->desc.dict_count + 1) > c->nslots) {
+		uint32_t nslots = c->nslots ? 2 * c->nslots : 256;
+		uint32_t *slots = calloc(nslots, sizeof(*slots));
+		if (!slots)
+			return UINT32_MAX;
+		for (uint32_t e = 0; e < c->desc.dict_count; e++) {
+			i = column_hash(c->dict + e * width, width) & (nslots - 1);
+			while (slots[i])
+				i = (i + 1) & (nslots - 1);
+			slots[i] = e + 1;
+		}
+		free(c->slots);
+		c->slots = slots;
+		c->nslots = nslots;
+	}
+
+	mask = c->nslots - 1;
+	for (i = column_hash(value, width) & mask; c->slots[i]; i = (i + 1) & mask) {
+		if (memcmp(c->dict + (c->slots[i] - 1) * width, value, width) == 0)
+			return c->slots[i] - 1;
+	}
+	if (c->desc.dict_count == c->dict_cap) {
+		uint32_t cap = c->dict_cap ? 2 * c->dict_cap : 64;
+		uint8_t *dict = realloc(c->dict, (size_t)cap * width);
+		if (!dict)
+			return UINT32_MAX;
+		c->dict = dict;
+		c->dict_cap = cap;
+	}
+	memcpy(c->dict + c->desc.dict_count * width, value, width);
+	c->slots[i] = ++c->desc.dict_count;
+	return c->desc.dict_count - 1;
+}
+
+static void column_flush(struct column_writer *w, struct column *c)
+{
+	column_pwrite(w, c->buf, c->fill, c->desc.data_offset + c->flushed);
+	c->flushed += c->fill;
+	c->fill = 0;
+}
+
+/**
+ * Store the next row of a column. value points at the field in the
+ * decoded image, or is NULL if the image does not have it.
+ */
+static void column_put(struct column_writer *w, struct column *c, const uint8_t *value)
+{
+	uint32_t v = 0;
+
+	if (value) {
+		v = c->desc.encoding == COLUMN_DICT ? column_intern(c, value) : field_load(value, c->desc.width);
+		if (v == UINT32_MAX && c->desc.encoding == COLUMN_DICT)
+			w->error = true;
+		c->valid[w->row / 8] |= 1 << (w->row % 8);
+	}
+	if (c->fill + c->desc.width > COLUMN_BUF_LEN)
+		column_flush(w, c);
+	field_store(c->buf + c->fill, c->desc.width, v);
+	c->fill += c->desc.width;
+}
+
+static inline void column_end_row(struct column_writer *w)
+{
+	w->row++;
+}
+
+static void column_writer_free(struct column_writer *w)
+{
+	for (int i = 0; i < w->ncols; i++) {
+		free(w->cols[i].buf);
+		free(w->cols[i].valid);
+		free(w->cols[i].dict);
+		free(w->cols[i].slots);
+	}
+	free(w->cols);
+	w->cols = NULL;
+	w->ncols = w->cap = 0;
+}
+
+/**
+ * Write the remaining data, the dictionaries, the directory and the header,
+ * and free everything.
+ *
+ * \return 0 on success, -1 on error
+ */
+static int column_writer_finish(struct column_writer *w)
+{
+	struct column_file_header hdr = {
+		.magic = COLUMN_MAGIC,
+		.version = COLUMN_VERSION,
+		.ncolumns = w->ncols,
+		.nrows = w->nrows,
+	};
+	uint64_t offset = w->end;
+
+	for (int i = 0; i < w->ncols; i++) {
+		struct column *c = &w->cols[i];
+
+		column_flush(w, c);
+		column_pwrite(w, c->valid, (w->nrows + 7) / 8, c->desc.valid_offset);
+		if (c->desc.encoding == COLUMN_DICT) {
+			c->desc.dict_offset = offset;
+			column_pwrite(w, c->dict, (size_t)c->desc.dict_count * c->desc.dict_width, offset);
+			offset = column_align(offset + (uint64_t)c->desc.dict_count * c->desc.dict_width);
+		}
+	}
+	hdr.directory_offset = offset;
+	for (int i = 0; i < w->ncols; i++)
+		column_pwrite(w, &w->cols[i].desc, sizeof(struct column_desc), offset + i * sizeof(struct column_desc));
+	column_pwrite(w, &hdr, sizeof(hdr), 0);
+	if (close(w->fd) < 0)
+		w->error = true;
+	column_writer_free(w);
+	return w->error ? -1 : 0;
+}
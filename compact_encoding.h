@@ -0,0 +1,132 @@
+/*
+ * Descriptor version 0.2 ("compact") encoding.
+ *
+ * Identical to 0.1 except for two block bodies, which shrinks what the EC
+ * has to read over I2C:
+ * - GPIO entries are struct gpu_cfg_gpio_compact (4 bytes instead of 7)
+ * - thermal sensors are struct gpu_cfg_thermal_compact (2 bytes instead of 10)
+ *
+ * Both directions copy the header, set descriptor_version_minor and
+ * descriptor_length and leave the CRCs to the caller.
+ */
+
+static inline bool is_compact(const uint8_t *image)
+{
+	return view_desc_descriptor_version_minor(image) == GPU_CFG_VERSION_MINOR_COMPACT;
+}
+
+static size_t compact_gpio(const uint8_t *body, size_t len, uint8_t *out)
+{
+	size_t n = len / sizeof(struct gpu_cfg_gpio);
+
+	for (size_t i = 0; i < n; i++) {
+		const uint8_t *in = body + i * sizeof(struct gpu_cfg_gpio);
+		uint8_t *c = out + i * sizeof(struct gpu_cfg_gpio_compact);
+		uint32_t flags = view_gpio_flags(in);
+
+		if (flags & ~(0xFFU << GPU_GPIO_COMPACT_SHIFT))
+			return 0;
+		view_gpio_compact_set_gpio(c, view_gpio_gpio(in));
+		view_gpio_compact_set_function(c, view_gpio_function(in));
+		view_gpio_compact_set_flags(c, flags >> GPU_GPIO_COMPACT_SHIFT);
+		view_gpio_compact_set_power_domain(c, view_gpio_power_domain(in));
+	}
+	return n * sizeof(struct gpu_cfg_gpio_compact);
+}
+
+static size_t expand_gpio(const uint8_t *body, size_t len, uint8_t *out)
+{
+	size_t n = len / sizeof(struct gpu_cfg_gpio_compact);
+
+	for (size_t i = 0; i < n; i++) {
+		const uint8_t *c = body + i * sizeof(struct gpu_cfg_gpio_compact);
+		uint8_t *g = out + i * sizeof(struct gpu_cfg_gpio);
+
+		view_gpio_set_gpio(g, view_gpio_compact_gpio(c));
+		view_gpio_set_function(g, view_gpio_compact_function(c));
+		view_gpio_set_flags(g, (uint32_t)view_gpio_compact_flags(c) << GPU_GPIO_COMPACT_SHIFT);
+		view_gpio_set_power_domain(g, view_gpio_compact_power_domain(c));
+	}
+	return n * sizeof(struct gpu_cfg_gpio);
+}
+
+static size_t compact_thermal(const uint8_t *body, size_t len, uint8_t *out)
+{
+	if (len < sizeof(struct gpu_cfg_thermal_compact))
+		return 0;
+	memcpy(out, body, sizeof(struct gpu_cfg_thermal_compact));
+	return sizeof(struct gpu_cfg_thermal_compact);
+}
+
+static size_t expand_thermal(const uint8_t *body, size_t len, uint8_t *out)
+{
+	if (len < sizeof(struct gpu_cfg_thermal_compact))
+		return 0;
+	memset(out, 0, sizeof(struct gpu_cfg_thermal));
+	memcpy(out, body, sizeof(struct gpu_cfg_thermal_compact));
+	return sizeof(struct gpu_cfg_thermal);
+}
+
+/**
+ * Convert the block chain of an image between 0.1 and 0.2.
+ *
+ * \return length of the converted image, 0 if it does not fit in cap or
+ *         a GPIO uses flags that 0.2 cannot represent
+ */
+static size_t convert_encoding(const uint8_t *image, size_t len, uint8_t *out, size_t cap, bool compact)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	size_t pos = offset;
+
+	if (end > len || offset > cap)
+		return 0;
+	memcpy(out, image, offset);
+
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		const uint8_t *hdr = image + offset;
+		const uint8_t *body = image + offset + sizeof(struct gpu_block_header);
+		uint8_t type = view_block_block_type(hdr);
+		uint8_t blen = view_block_block_length(hdr);
+		uint8_t *ohdr = out + pos;
+		uint8_t *obody = out + pos + sizeof(struct gpu_block_header);
+		/* Worst case growth: GPIO entries 4 -> 7 bytes, thermal 2 -> 10 */
+		size_t room = sizeof(struct gpu_block_header) + 2 * blen + sizeof(struct gpu_cfg_thermal);
+		size_t olen;
+
+		if (body + blen > image + end || pos + room > cap)
+			return 0;
+		view_block_set_block_type(ohdr, type);
+		if (type == GPUCFG_TYPE_GPIO) {
+			olen = compact ? compact_gpio(body, blen, obody) : expand_gpio(body, blen, obody);
+			if (blen && !olen)
+				return 0;
+		} else if (type == GPUCFG_TYPE_THERMAL_SENSOR) {
+			olen = compact ? compact_thermal(body, blen, obody) : expand_thermal(body, blen, obody);
+			if (!olen)
+				return 0;
+		} else {
+			olen = blen;
+			memcpy(obody, body, olen);
+		}
+		if (olen > GPU_MAX_BLOCK_LEN - 1)
+			return 0;
+		view_block_set_block_length(ohdr, olen);
+		pos += sizeof(struct gpu_block_header) + olen;
+		offset += sizeof(struct gpu_block_header) + blen;
+	}
+
+	view_desc_set_descriptor_version_minor(out, compact ? GPU_CFG_VERSION_MINOR_COMPACT : GPU_CFG_VERSION_MINOR);
+	view_desc_set_descriptor_length(out, pos - sizeof(struct gpu_cfg_descriptor));
+	return pos;
+}
+
+static inline size_t compact_encode(const uint8_t *image, size_t len, uint8_t *out, size_t cap)
+{
+	return convert_encoding(image, len, out, cap, true);
+}
+
+static inline size_t compact_decode(const uint8_t *image, size_t len, uint8_t *out, size_t cap)
+{
+	return convert_encoding(image, len, out, cap, false);
+}
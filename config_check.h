@@ -0,0 +1,170 @@
+/*
+ * Cross-block consistency rules.
+ *
+ * One pass over the block chain records which GPIOs, I2C addresses,
+ * subsystems and fans are used in bitsets; the rules are then plain mask
+ * operations, so checking an image costs a few nanoseconds per block.
+ * Works on both the 0.1 and the 0.2 encoding.
+ */
+
+enum check_rule {
+	CHECK_CHAIN,
+	CHECK_GPIO_INVALID,
+	CHECK_GPIO_DUPLICATE,
+	CHECK_GPIO_UNCONTROLLABLE,
+	CHECK_PD_GPIO_MISSING,
+	CHECK_PD_GPIO_OUTPUT,
+	CHECK_I2C_DUPLICATE,
+	CHECK_SUBSYS_INVALID,
+	CHECK_SUBSYS_DUPLICATE,
+	CHECK_FAN_DUPLICATE,
+	CHECK_RULE_COUNT,
+};
+
+static const char *check_rule_names[CHECK_RULE_COUNT] = {
+	[CHECK_CHAIN] = "block chain runs past the descriptor",
+	[CHECK_GPIO_INVALID] = "GPIO index out of range",
+	[CHECK_GPIO_DUPLICATE] = "GPIO configured more than once",
+	[CHECK_GPIO_UNCONTROLLABLE] = "GPIO that cannot be controlled is an output",
+	[CHECK_PD_GPIO_MISSING] = "PD refers to a GPIO that is not configured",
+	[CHECK_PD_GPIO_OUTPUT] = "PD HPD/interrupt GPIO is an output",
+	[CHECK_I2C_DUPLICATE] = "I2C address used by more than one device",
+	[CHECK_SUBSYS_INVALID] = "invalid subsystem in a subsystem block",
+	[CHECK_SUBSYS_DUPLICATE] = "subsystem listed more than once",
+	[CHECK_FAN_DUPLICATE] = "fan index used more than once",
+};
+
+#define GPIO_BIT(gpio) (1U << (gpio))
+
+/* Pins marked "cannot be controlled directly" in enum gpu_gpio_idx */
+#define GPIO_UNCONTROLLABLE (GPIO_BIT(GPU_2L5_TH_OVERTn) | GPIO_BIT(GPU_1F3_MUX1) | GPIO_BIT(GPU_1G3_MUX2))
+
+/*
+ * Pins with a fixed function that the EC sets up from its own board
+ * configuration; a PD may refer to them without a GPIO block entry.
+ */
+#define GPIO_EC_FIXED (GPIO_BIT(GPU_1F2_I2C_S5_INT) | GPIO_BIT(GPU_1L1_DGPU_PWROK) | \
+	GPIO_BIT(GPU_1C3_ALW_CLK) | GPIO_BIT(GPU_1D3_ALW_DAT))
+
+struct check_result {
+	/* One bit per enum check_rule */
+	uint32_t violations;
+	/* Offending GPIOs, one bit per enum gpu_gpio_idx */
+	uint32_t gpio_duplicate;
+	uint32_t gpio_uncontrollable;
+	uint32_t pd_missing;
+	uint32_t pd_output;
+	/* Offending 7 bit I2C addresses */
+	uint32_t i2c_duplicate[4];
+	uint32_t subsys_duplicate;
+};
+
+static inline bool bitset_mark(uint32_t *set, uint32_t *dup, unsigned int bit)
+{
+	uint32_t mask = 1U << (bit % 32);
+	bool seen = set[bit / 32] & mask;
+
+	set[bit / 32] |= mask;
+	if (seen)
+		dup[bit / 32] |= mask;
+	return seen;
+}
+
+/**
+ * Check an image against the consistency rules.
+ *
+ * \return bitmask of violated rules, also stored in result
+ */
+static uint32_t config_check(const uint8_t *image, size_t len, struct check_result *result)
+{
+	bool compact_gpio = is_compact(image);
+	size_t gpio_size = compact_gpio ? sizeof(struct gpu_cfg_gpio_compact) : sizeof(struct gpu_cfg_gpio);
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	uint32_t gpios = 0, outputs = 0, pd_refs = 0;
+	uint32_t i2c[4] = {0}, subsys = 0, fans = 0, fan_dup = 0;
+
+	memset(result, 0, sizeof(*result));
+	if (end > len) {
+		end = len;
+		result->violations |= 1U << CHECK_CHAIN;
+	}
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		const uint8_t *body = image + offset + sizeof(struct gpu_block_header);
+		uint8_t blen = view_block_block_length(image + offset);
+
+		if (body + blen > image + end) {
+			result->violations |= 1U << CHECK_CHAIN;
+			break;
+		}
+		switch (view_block_block_type(image + offset)) {
+		case GPUCFG_TYPE_GPIO:
+			for (size_t i = 0; i + gpio_size <= blen; i += gpio_size) {
+				uint8_t gpio = view_gpio_gpio(body + i);
+				uint32_t flags = compact_gpio ?
+					(uint32_t)view_gpio_compact_flags(body + i) << GPU_GPIO_COMPACT_SHIFT :
+					view_gpio_flags(body + i);
+
+				if (gpio == GPU_GPIO_INVALID || gpio >= GPU_GPIO_MAX) {
+					result->violations |= 1U << CHECK_GPIO_INVALID;
+					continue;
+				}
+				bitset_mark(&gpios, &result->gpio_duplicate, gpio);
+				if (flags & GPIO_OUTPUT)
+					outputs |= GPIO_BIT(gpio);
+			}
+			break;
+		case GPUCFG_TYPE_PD:
+			if (blen >= sizeof(struct gpu_subsys_pd)) {
+				uint8_t hpd = view_pd_gpio_hpd(body);
+				uint8_t interrupt = view_pd_gpio_interrupt(body);
+
+				if (hpd != GPU_GPIO_INVALID)
+					pd_refs |= GPIO_BIT(hpd % 32);
+				if (interrupt != GPU_GPIO_INVALID)
+					pd_refs |= GPIO_BIT(interrupt % 32);
+				bitset_mark(i2c, result->i2c_duplicate, view_pd_address(body) & 0x7F);
+			}
+			break;
+		case GPUCFG_TYPE_THERMAL_SENSOR:
+			/* address is at the same offset in both encodings */
+			if (blen >= sizeof(struct gpu_cfg_thermal_compact))
+				bitset_mark(i2c, result->i2c_duplicate, view_thermal_compact_address(body) & 0x7F);
+			break;
+		case GPUCFG_TYPE_SUBSYS:
+			if (blen >= sizeof(struct gpu_subsys_serial)) {
+				uint8_t type = view_subsys_gpu_subsys(body);
+
+				if (type == GPU_ASSEMBLY || type >= GPU_SUBSYS_MAX)
+					result->violations |= 1U << CHECK_SUBSYS_INVALID;
+				else
+					bitset_mark(&subsys, &result->subsys_duplicate, type);
+			}
+			break;
+		case GPUCFG_TYPE_FAN:
+			if (blen >= sizeof(struct gpu_cfg_fan))
+				bitset_mark(&fans, &fan_dup, view_fan_idx(body) % 32);
+			break;
+		}
+		offset += sizeof(struct gpu_block_header) + blen;
+	}
+
+	result->gpio_uncontrollable = outputs & GPIO_UNCONTROLLABLE;
+	result->pd_missing = pd_refs & ~gpios & ~GPIO_EC_FIXED;
+	result->pd_output = pd_refs & outputs;
+	if (result->gpio_duplicate)
+		result->violations |= 1U << CHECK_GPIO_DUPLICATE;
+	if (result->gpio_uncontrollable)
+		result->violations |= 1U << CHECK_GPIO_UNCONTROLLABLE;
+	if (result->pd_missing)
+		result->violations |= 1U << CHECK_PD_GPIO_MISSING;
+	if (result->pd_output)
+		result->violations |= 1U << CHECK_PD_GPIO_OUTPUT;
+	if (result->i2c_duplicate[0] | result->i2c_duplicate[1] | result->i2c_duplicate[2] | result->i2c_duplicate[3])
+		result->violations |= 1U << CHECK_I2C_DUPLICATE;
+	if (result->subsys_duplicate)
+		result->violations |= 1U << CHECK_SUBSYS_DUPLICATE;
+	if (fan_dup)
+		result->violations |= 1U << CHECK_FAN_DUPLICATE;
+	return result->violations;
+}
@@ -21,6 +21,11 @@
 #include <stddef.h>
 #define GPU_MAX_BLOCK_LEN (256)
 #define GPU_SERIAL_LEN 20
+/* Newest major version the EC parses, the block layout may change with it */
+#define GPU_CFG_VERSION_MAJOR 0
+/* 0.1 is the original layout, 0.2 packs GPIO and thermal blocks */
+#define GPU_CFG_VERSION_MINOR 1
+#define GPU_CFG_VERSION_MINOR_COMPACT 2
 #define BUILD_ASSERT(dummy)
 
 #define __packed __attribute__((packed))
@@ -84,6 +89,11 @@ enum gpucfg_type {
 	GPUCFG_TYPE_PD = 11,
 	GPUCFG_TYPE_GPUPWR = 12,
 	GPUCFG_TYPE_CUSTOM_TEMP = 13,
+	GPUCFG_TYPE_GPIO_ACTIONS = 14,
+	GPUCFG_TYPE_FAN_CURVE = 15,
+	GPUCFG_TYPE_SIGNATURE = 16,
+	/* Filler the EC skips, lets a block start on an EEPROM page */
+	GPUCFG_TYPE_PADDING = 17,
 	GPUCFG_TYPE_MAX = 255, /**< Force enum to be 8 bits */
 } __packed;
 BUILD_ASSERT(sizeof(enum gpucfg_type) == sizeof(uint8_t));
@@ -146,6 +156,32 @@ struct gpu_cfg_gpio {
 	uint8_t power_domain;
 } __packed;
 
+/*
+ * Precomputed GPIO levels for one steady power state, one entry per state
+ * in enum power_state order (G3, S5, S4, S3, S0, S0ix). Bit n refers to
+ * enum gpu_gpio_idx n. On entering the state the EC drives the asserted
+ * GPIOs high and the deasserted ones low; GPIOs in neither mask are left
+ * alone (inputs, and outputs whose level is decided at runtime).
+ */
+struct gpu_cfg_gpio_actions {
+	uint32_t assert_mask;
+	uint32_t deassert_mask;
+} __packed;
+
+/*
+ * Descriptor version 0.2 GPIO entry. Only GPIO_* flag bits 16-23
+ * (direction, initial level and interrupt enable) are kept.
+ */
+struct gpu_cfg_gpio_compact {
+	uint8_t gpio;
+	uint8_t function;
+	/* GPIO_* flags >> GPU_GPIO_COMPACT_SHIFT */
+	uint8_t flags;
+	uint8_t power_domain;
+} __packed;
+#define GPU_GPIO_COMPACT_SHIFT 16
+BUILD_ASSERT(sizeof(struct gpu_cfg_gpio_compact) == 4);
+
 enum gpu_thermal_sensor {
 	GPU_THERM_INVALID,
 	GPU_THERM_F75303,
@@ -157,6 +193,12 @@ struct gpu_cfg_thermal {
 	uint32_t reserved2;
 } __packed;
 
+/* Descriptor version 0.2 thermal sensor, without the reserved words */
+struct gpu_cfg_thermal_compact {
+	uint8_t thermal_type;
+	uint8_t address;
+} __packed;
+
 struct gpu_cfg_custom_temp {
 	uint8_t idx;
 	uint16_t temp_fan_off;
@@ -173,6 +215,30 @@ struct gpu_cfg_fan {
 	uint16_t max_temp;
 } __packed;
 
+/*
+ * Precomputed fan curve: rpm[i] is the target speed at
+ * temp_start + i * temp_step Kelvin. Below the first point the first entry
+ * applies, above the last point the last one.
+ */
+struct gpu_cfg_fan_curve {
+	uint8_t idx;
+	uint16_t temp_start;
+	uint8_t temp_step;
+	uint8_t count;
+	uint16_t rpm[];
+} __packed;
+
+/*
+ * Ed25519 signature, always the last block. It covers the image from the
+ * start of the header up to and including key_id, with crc32 and
+ * descriptor_crc32 taken as zero; both CRCs are computed after signing.
+ * key_id is the start of the SHA-512 of the public key.
+ */
+struct gpu_cfg_signature {
+	uint8_t key_id[4];
+	uint8_t signature[64];
+} __packed;
+
 struct gpu_cfg_power {
 	uint8_t device_idx;
 	uint8_t battery_power;
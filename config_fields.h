@@ -0,0 +1,299 @@
+/*
+ * Field schema of the descriptor, used to address single fields of an
+ * existing image by name, e.g. "fan[1].max_rpm" or "header.hardware_revision".
+ *
+ * Blocks of one type are treated as a sequence of fixed size elements:
+ * the index selects the n-th element counted across all blocks of that type
+ * in chain order. For fans that is the n-th fan block, for GPIOs the n-th
+ * entry of the GPIO block.
+ */
+
+struct cfg_block_def {
+	const char *name;
+	uint8_t block_type;
+	uint8_t elem_size;
+	/* Fields live in struct gpu_cfg_descriptor rather than a block */
+	bool header;
+};
+
+enum cfg_field_kind {
+	FIELD_UINT,
+	FIELD_STRING,
+	/* Unsigned code from one of the enums in config_definition.h */
+	FIELD_ENUM,
+};
+
+struct cfg_field {
+	const struct cfg_block_def *block;
+	const char *name;
+	uint8_t offset;
+	uint8_t width;
+	enum cfg_field_kind kind;
+	/* Readable with --get, only --migrate may change it */
+	bool read_only;
+};
+
+static const struct cfg_block_def cfg_blocks[] = {
+	{"header", GPUCFG_TYPE_UNINITIALIZED, sizeof(struct gpu_cfg_descriptor), true},
+	{"pcie", GPUCFG_TYPE_PCIE, sizeof(uint8_t), false},
+	{"fan", GPUCFG_TYPE_FAN, sizeof(struct gpu_cfg_fan), false},
+	{"vendor", GPUCFG_TYPE_VENDOR, sizeof(uint8_t), false},
+	{"gpio", GPUCFG_TYPE_GPIO, sizeof(struct gpu_cfg_gpio), false},
+	{"pd", GPUCFG_TYPE_PD, sizeof(struct gpu_subsys_pd), false},
+	{"thermal", GPUCFG_TYPE_THERMAL_SENSOR, sizeof(struct gpu_cfg_thermal), false},
+	{"custom_temp", GPUCFG_TYPE_CUSTOM_TEMP, sizeof(struct gpu_cfg_custom_temp), false},
+	{"subsys", GPUCFG_TYPE_SUBSYS, sizeof(struct gpu_subsys_serial), false},
+	{"power", GPUCFG_TYPE_POWER, sizeof(struct gpu_cfg_power), false},
+	{"battery", GPUCFG_TYPE_BATTERY, sizeof(struct gpu_cfg_battery), false},
+	{"gpio_actions", GPUCFG_TYPE_GPIO_ACTIONS, sizeof(struct gpu_cfg_gpio_actions), false},
+};
+
+enum {
+	BLK_HEADER,
+	BLK_PCIE,
+	BLK_FAN,
+	BLK_VENDOR,
+	BLK_GPIO,
+	BLK_PD,
+	BLK_THERMAL,
+	BLK_CUSTOM_TEMP,
+	BLK_SUBSYS,
+	BLK_POWER,
+	BLK_BATTERY,
+	BLK_GPIO_ACTIONS,
+};
+
+#define FIELD(blk, type, member) \
+	{&cfg_blocks[blk], #member, offsetof(struct type, member), sizeof(((struct type *)0)->member), FIELD_UINT}
+#define FIELD_STR(blk, type, member) \
+	{&cfg_blocks[blk], #member, offsetof(struct type, member), sizeof(((struct type *)0)->member), FIELD_STRING}
+#define FIELD_ENUM(blk, type, member) \
+	{&cfg_blocks[blk], #member, offsetof(struct type, member), sizeof(((struct type *)0)->member), FIELD_ENUM}
+#define FIELD_RO(blk, type, member) \
+	{&cfg_blocks[blk], #member, offsetof(struct type, member), sizeof(((struct type *)0)->member), FIELD_UINT, true}
+
+static const struct cfg_field cfg_fields[] = {
+	/* The block layout depends on the version */
+	FIELD_RO(BLK_HEADER, gpu_cfg_descriptor, descriptor_version_major),
+	FIELD_RO(BLK_HEADER, gpu_cfg_descriptor, descriptor_version_minor),
+	FIELD(BLK_HEADER, gpu_cfg_descriptor, hardware_version),
+	FIELD(BLK_HEADER, gpu_cfg_descriptor, hardware_revision),
+	FIELD_STR(BLK_HEADER, gpu_cfg_descriptor, serial),
+	{&cfg_blocks[BLK_PCIE], "cfg", 0, sizeof(uint8_t), FIELD_ENUM},
+	FIELD(BLK_FAN, gpu_cfg_fan, idx),
+	FIELD(BLK_FAN, gpu_cfg_fan, flags),
+	FIELD(BLK_FAN, gpu_cfg_fan, min_rpm),
+	FIELD(BLK_FAN, gpu_cfg_fan, min_temp),
+	FIELD(BLK_FAN, gpu_cfg_fan, start_rpm),
+	FIELD(BLK_FAN, gpu_cfg_fan, max_rpm),
+	FIELD(BLK_FAN, gpu_cfg_fan, max_temp),
+	{&cfg_blocks[BLK_VENDOR], "vendor", 0, sizeof(uint8_t), FIELD_ENUM},
+	FIELD_ENUM(BLK_GPIO, gpu_cfg_gpio, gpio),
+	FIELD_ENUM(BLK_GPIO, gpu_cfg_gpio, function),
+	FIELD(BLK_GPIO, gpu_cfg_gpio, flags),
+	FIELD_ENUM(BLK_GPIO, gpu_cfg_gpio, power_domain),
+	FIELD_ENUM(BLK_PD, gpu_subsys_pd, gpu_pd_type),
+	FIELD(BLK_PD, gpu_subsys_pd, address),
+	FIELD(BLK_PD, gpu_subsys_pd, flags),
+	FIELD(BLK_PD, gpu_subsys_pd, pdo),
+	FIELD(BLK_PD, gpu_subsys_pd, rdo),
+	FIELD_ENUM(BLK_PD, gpu_subsys_pd, power_domain),
+	FIELD_ENUM(BLK_PD, gpu_subsys_pd, gpio_hpd),
+	FIELD_ENUM(BLK_PD, gpu_subsys_pd, gpio_interrupt),
+	FIELD_ENUM(BLK_THERMAL, gpu_cfg_thermal, thermal_type),
+	FIELD(BLK_THERMAL, gpu_cfg_thermal, address),
+	FIELD(BLK_CUSTOM_TEMP, gpu_cfg_custom_temp, idx),
+	FIELD(BLK_CUSTOM_TEMP, gpu_cfg_custom_temp, temp_fan_off),
+	FIELD(BLK_CUSTOM_TEMP, gpu_cfg_custom_temp, temp_fan_max),
+	FIELD_ENUM(BLK_SUBSYS, gpu_subsys_serial, gpu_subsys),
+	FIELD_STR(BLK_SUBSYS, gpu_subsys_serial, serial),
+	FIELD(BLK_POWER, gpu_cfg_power, device_idx),
+	FIELD(BLK_POWER, gpu_cfg_power, battery_power),
+	FIELD(BLK_POWER, gpu_cfg_power, average_power),
+	FIELD(BLK_POWER, gpu_cfg_power, long_term_power),
+	FIELD(BLK_POWER, gpu_cfg_power, short_term_power),
+	FIELD(BLK_POWER, gpu_cfg_power, peak_power),
+	FIELD(BLK_BATTERY, gpu_cfg_battery, max_current),
+	FIELD(BLK_BATTERY, gpu_cfg_battery, max_mv),
+	FIELD(BLK_BATTERY, gpu_cfg_battery, min_mv),
+	FIELD(BLK_BATTERY, gpu_cfg_battery, max_charge_current),
+	FIELD(BLK_GPIO_ACTIONS, gpu_cfg_gpio_actions, assert_mask),
+	FIELD(BLK_GPIO_ACTIONS, gpu_cfg_gpio_actions, deassert_mask),
+};
+
+#define CFG_FIELD_COUNT (sizeof(cfg_fields) / sizeof(cfg_fields[0]))
+
+struct field_ref {
+	const struct cfg_field *field;
+	int index;
+};
+
+/**
+ * Parse "block[index].field" (index defaults to 0).
+ *
+ * \return 0 on success, -1 if the path is malformed or unknown
+ */
+static int parse_field_ref(const char *path, struct field_ref *ref)
+{
+	const char *dot = strchr(path, '.');
+	const char *bracket;
+	size_t blen;
+
+	if (!dot)
+		return -1;
+	bracket = memchr(path, '[', dot - path);
+	blen = (bracket ? bracket : dot) - path;
+	ref->index = 0;
+	if (bracket) {
+		char *end;
+		ref->index = strtol(bracket + 1, &end, 10);
+		if (end[0] != ']' || end + 1 != dot || ref->index < 0)
+			return -1;
+	}
+
+	for (size_t i = 0; i < CFG_FIELD_COUNT; i++) {
+		const struct cfg_field *f = &cfg_fields[i];
+		if (strlen(f->block->name) == blen && strncmp(f->block->name, path, blen) == 0 &&
+				strcmp(f->name, dot + 1) == 0) {
+			if (f->block->header && ref->index != 0)
+				return -1;
+			ref->field = f;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Offsets of all blocks of an image, grouped by block type. Built in one
+ * pass over the block chain; afterwards any element is found without
+ * walking the chain again.
+ */
+#define BLOCK_INDEX_MAX 64
+
+struct block_index {
+	/* Number of blocks of each type and where they start in offset[] */
+	uint8_t count[256];
+	uint8_t first[256];
+	/* Blocks of this type differ in length */
+	bool mixed[256];
+	/* Body offsets in the image and body lengths, grouped by type */
+	uint16_t offset[BLOCK_INDEX_MAX];
+	uint8_t length[BLOCK_INDEX_MAX];
+	uint8_t nblocks;
+	/* The chain ended early or had more than BLOCK_INDEX_MAX blocks */
+	bool truncated;
+};
+
+/**
+ * Index the block chain of an image. Blocks running past the end of the
+ * descriptor or of the buffer end the chain.
+ */
+static void block_index_build(struct block_index *idx, const uint8_t *image, size_t len)
+{
+	uint8_t types[BLOCK_INDEX_MAX];
+	uint16_t offsets[BLOCK_INDEX_MAX];
+	uint8_t lengths[BLOCK_INDEX_MAX];
+	uint8_t fill[256];
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	int n = 0;
+
+	memset(idx->count, 0, sizeof(idx->count));
+	memset(idx->mixed, 0, sizeof(idx->mixed));
+	idx->truncated = false;
+	if (end > len) {
+		end = len;
+		idx->truncated = true;
+	}
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		uint8_t type = view_block_block_type(image + offset);
+		uint8_t blen = view_block_block_length(image + offset);
+		size_t body = offset + sizeof(struct gpu_block_header);
+
+		if (body + blen > end || n == BLOCK_INDEX_MAX) {
+			idx->truncated = true;
+			break;
+		}
+		types[n] = type;
+		offsets[n] = body;
+		lengths[n] = blen;
+		idx->count[type]++;
+		n++;
+		offset = body + blen;
+	}
+
+	/* Counting sort by type, keeping chain order within a type */
+	for (int t = 0, start = 0; t < 256; t++) {
+		idx->first[t] = start;
+		fill[t] = start;
+		start += idx->count[t];
+	}
+	for (int i = 0; i < n; i++) {
+		int slot = fill[types[i]]++;
+		idx->offset[slot] = offsets[i];
+		idx->length[slot] = lengths[i];
+		if (lengths[i] != idx->length[idx->first[types[i]]])
+			idx->mixed[types[i]] = true;
+	}
+	idx->nblocks = n;
+}
+
+/**
+ * Locate the index-th element of a block type.
+ *
+ * \return offset of the element in the image, or -1 if not present
+ */
+static long block_index_find(const struct block_index *idx, const struct cfg_block_def *block, int index)
+{
+	int first = idx->first[block->block_type];
+	int count = idx->count[block->block_type];
+
+	if (block->header)
+		return 0;
+	if (count == 0)
+		return -1;
+	/* Common case: all blocks of the type hold the same number of elements */
+	if (!idx->mixed[block->block_type]) {
+		int per = idx->length[first] / block->elem_size;
+		if (per == 0 || index / per >= count)
+			return -1;
+		return idx->offset[first + index / per] + (index % per) * block->elem_size;
+	}
+
+	for (int i = first; i < first + count; i++) {
+		int elems = idx->length[i] / block->elem_size;
+		if (index < elems)
+			return idx->offset[i] + index * block->elem_size;
+		index -= elems;
+	}
+	return -1;
+}
+
+/* Field widths are 1, 2 or 4 bytes, see image_view.h for the loads */
+static inline uint32_t field_load(const uint8_t *p, uint8_t width)
+{
+	switch (width) {
+	case 1:
+		return ld_le8(p);
+	case 2:
+		return ld_le16(p);
+	default:
+		return ld_le32(p);
+	}
+}
+
+static inline void field_store(uint8_t *p, uint8_t width, uint32_t v)
+{
+	switch (width) {
+	case 1:
+		st_le8(p, v);
+		break;
+	case 2:
+		st_le16(p, v);
+		break;
+	default:
+		st_le32(p, v);
+		break;
+	}
+}
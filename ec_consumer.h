@@ -0,0 +1,346 @@
+/*
+ * Host build of the EC side of the descriptor, as a reference to test the
+ * generator and the host decoders against.
+ *
+ * The EC reads the header, checks its CRC and refuses a descriptor whose
+ * major version is newer than its own, since the layout of everything after
+ * the header may have changed. It then checks the descriptor CRC over the
+ * blocks, walks the chain once and copies each block body into the packed
+ * struct of its type (the EC is little endian). A block running past the
+ * descriptor rejects the whole card. What it keeps from each block type:
+ * - GPIO entries by GPIO number, invalid numbers are skipped
+ * - fans, custom temperatures and fan curves by fan index
+ * - the last thermal sensor, power, battery, PD, PCIe, vendor and GPIO
+ *   action block of the chain
+ * - subsystem serials by subsystem
+ * Blocks shorter than their struct, and block types it does not know, are
+ * skipped. Minor versions only change the GPIO and thermal encoding.
+ *
+ * Everything the EC would act on ends up in struct ec_config, which is
+ * zeroed before decoding so that two decodes compare with memcmp. The code
+ * deliberately shares nothing with the generator's decoders: it has its own
+ * CRC and reads fields through the structs rather than image_view.h.
+ */
+
+#define EC_MAX_FANS 4
+#define EC_MAX_ACTION_STATES 8
+#define EC_MAX_CURVE_POINTS \
+	((GPU_MAX_BLOCK_LEN - 1 - sizeof(struct gpu_cfg_fan_curve)) / sizeof(uint16_t))
+/* Coverage slots: one per known block type, then one for all unknown ones */
+#define EC_SLOT_UNKNOWN (GPUCFG_TYPE_PADDING + 1)
+#define EC_BLOCK_SLOTS (EC_SLOT_UNKNOWN + 1)
+
+enum ec_status {
+	EC_OK,
+	EC_BAD_MAGIC,
+	EC_BAD_HEADER_CRC,
+	EC_BAD_VERSION,
+	EC_TRUNCATED,
+	EC_BAD_DESCRIPTOR_CRC,
+	EC_BAD_CHAIN,
+	EC_STATUS_COUNT,
+};
+
+static const char *const ec_status_names[EC_STATUS_COUNT] = {
+	"ok", "bad magic", "header CRC", "version", "truncated", "descriptor CRC", "bad chain",
+};
+
+static const char *const ec_block_names[EC_BLOCK_SLOTS] = {
+	"uninitialized", "gpio", "thermal", "fan", "power", "battery", "pcie", "dpmux", "poweren",
+	"subsys", "vendor", "pd", "gpupwr", "custom_temp", "gpio_actions", "fan_curve", "signature",
+	"padding", "unknown",
+};
+
+struct ec_fan_curve {
+	uint16_t temp_start;
+	uint8_t temp_step;
+	uint8_t count;
+	uint16_t rpm[EC_MAX_CURVE_POINTS];
+};
+
+struct ec_config {
+	enum ec_status status;
+	struct gpu_cfg_descriptor header;
+	/* Bit n set if GPIO n is configured; 0.2 flags are shifted back */
+	uint32_t gpio_set;
+	struct gpu_cfg_gpio gpios[GPU_GPIO_MAX];
+	uint8_t fan_set;
+	struct gpu_cfg_fan fans[EC_MAX_FANS];
+	uint8_t custom_temp_set;
+	struct gpu_cfg_custom_temp custom_temps[EC_MAX_FANS];
+	uint8_t curve_set;
+	struct ec_fan_curve curves[EC_MAX_FANS];
+	/* The compact thermal sensor has the reserved words zeroed */
+	bool has_thermal;
+	struct gpu_cfg_thermal thermal;
+	bool has_power;
+	struct gpu_cfg_power power;
+	bool has_battery;
+	struct gpu_cfg_battery battery;
+	bool has_pd;
+	struct gpu_subsys_pd pd;
+	/* -1 if absent */
+	int16_t pcie;
+	int16_t vendor;
+	uint16_t subsys_set;
+	char subsys_serials[GPU_SUBSYS_MAX][GPU_SERIAL_LEN];
+	uint8_t action_states;
+	struct gpu_cfg_gpio_actions actions[EC_MAX_ACTION_STATES];
+	bool has_signature;
+	uint8_t key_id[4];
+	/* Blocks walked, and blocks or entries skipped, per coverage slot */
+	uint16_t blocks[EC_BLOCK_SLOTS];
+	uint16_t skipped[EC_BLOCK_SLOTS];
+};
+
+/* What two accepted decodes are compared on, see ec_config_diff() */
+#define EC_CONFIG_MEMBERS(X) \
+	X(header) X(gpio_set) X(gpios) X(fan_set) X(fans) X(custom_temp_set) X(custom_temps) \
+	X(curve_set) X(curves) X(has_thermal) X(thermal) X(has_power) X(power) X(has_battery) \
+	X(battery) X(has_pd) X(pd) X(pcie) X(vendor) X(subsys_set) X(subsys_serials) \
+	X(action_states) X(actions) X(has_signature) X(key_id) X(blocks) X(skipped)
+
+static inline int ec_slot(uint8_t block_type)
+{
+	return block_type < EC_SLOT_UNKNOWN ? block_type : EC_SLOT_UNKNOWN;
+}
+
+/* Bitwise CRC-32, as small as the EC's */
+static uint32_t ec_crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static void ec_config_init(struct ec_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->pcie = -1;
+	cfg->vendor = -1;
+}
+
+static void ec_gpio_block(struct ec_config *cfg, const uint8_t *body, uint8_t len, bool compact)
+{
+	size_t size = compact ? sizeof(struct gpu_cfg_gpio_compact) : sizeof(struct gpu_cfg_gpio);
+
+	for (size_t i = 0; i < len / size; i++) {
+		struct gpu_cfg_gpio entry;
+
+		if (compact) {
+			struct gpu_cfg_gpio_compact c;
+
+			memcpy(&c, body + i * size, sizeof(c));
+			entry.gpio = c.gpio;
+			entry.function = c.function;
+			entry.flags = (uint32_t)c.flags << GPU_GPIO_COMPACT_SHIFT;
+			entry.power_domain = c.power_domain;
+		} else {
+			memcpy(&entry, body + i * size, sizeof(entry));
+		}
+		if (entry.gpio == GPU_GPIO_INVALID || entry.gpio >= GPU_GPIO_MAX) {
+			cfg->skipped[GPUCFG_TYPE_GPIO]++;
+			continue;
+		}
+		cfg->gpios[entry.gpio] = entry;
+		cfg->gpio_set |= 1U << entry.gpio;
+	}
+	if (len % size)
+		cfg->skipped[GPUCFG_TYPE_GPIO]++;
+}
+
+static void ec_fan_curve_block(struct ec_config *cfg, const uint8_t *body, uint8_t len)
+{
+	struct gpu_cfg_fan_curve head;
+	struct ec_fan_curve *curve;
+
+	memcpy(&head, body, sizeof(head));
+	if (head.idx >= EC_MAX_FANS || head.count > (len - sizeof(head)) / sizeof(uint16_t)) {
+		cfg->skipped[GPUCFG_TYPE_FAN_CURVE]++;
+		return;
+	}
+	curve = &cfg->curves[head.idx];
+	memset(curve, 0, sizeof(*curve));
+	curve->temp_start = head.temp_start;
+	curve->temp_step = head.temp_step;
+	curve->count = head.count;
+	memcpy(curve->rpm, body + sizeof(head), head.count * sizeof(uint16_t));
+	cfg->curve_set |= 1 << head.idx;
+}
+
+static void ec_block(struct ec_config *cfg, uint8_t type, const uint8_t *body, uint8_t len, bool compact)
+{
+	/* Smallest body the EC takes for each type; 0 where any length goes */
+	static const uint8_t min_len[EC_SLOT_UNKNOWN] = {
+		[GPUCFG_TYPE_THERMAL_SENSOR] = sizeof(struct gpu_cfg_thermal),
+		[GPUCFG_TYPE_FAN] = sizeof(struct gpu_cfg_fan),
+		[GPUCFG_TYPE_POWER] = sizeof(struct gpu_cfg_power),
+		[GPUCFG_TYPE_BATTERY] = sizeof(struct gpu_cfg_battery),
+		[GPUCFG_TYPE_PCIE] = sizeof(uint8_t),
+		[GPUCFG_TYPE_SUBSYS] = sizeof(struct gpu_subsys_serial),
+		[GPUCFG_TYPE_VENDOR] = sizeof(uint8_t),
+		[GPUCFG_TYPE_PD] = sizeof(struct gpu_subsys_pd),
+		[GPUCFG_TYPE_CUSTOM_TEMP] = sizeof(struct gpu_cfg_custom_temp),
+		[GPUCFG_TYPE_FAN_CURVE] = sizeof(struct gpu_cfg_fan_curve),
+		[GPUCFG_TYPE_SIGNATURE] = sizeof(struct gpu_cfg_signature),
+	};
+	int slot = ec_slot(type);
+	uint8_t need = slot == EC_SLOT_UNKNOWN ? 0 : min_len[slot];
+
+	cfg->blocks[slot]++;
+	if (type == GPUCFG_TYPE_THERMAL_SENSOR && compact)
+		need = sizeof(struct gpu_cfg_thermal_compact);
+	if (len < need) {
+		cfg->skipped[slot]++;
+		return;
+	}
+
+	switch (type) {
+	case GPUCFG_TYPE_GPIO:
+		ec_gpio_block(cfg, body, len, compact);
+		break;
+	case GPUCFG_TYPE_THERMAL_SENSOR:
+		memset(&cfg->thermal, 0, sizeof(cfg->thermal));
+		memcpy(&cfg->thermal, body, need);
+		cfg->has_thermal = true;
+		break;
+	case GPUCFG_TYPE_FAN: {
+		struct gpu_cfg_fan fan;
+
+		memcpy(&fan, body, sizeof(fan));
+		if (fan.idx >= EC_MAX_FANS) {
+			cfg->skipped[slot]++;
+			break;
+		}
+		cfg->fans[fan.idx] = fan;
+		cfg->fan_set |= 1 << fan.idx;
+		break;
+	}
+	case GPUCFG_TYPE_CUSTOM_TEMP: {
+		struct gpu_cfg_custom_temp temp;
+
+		memcpy(&temp, body, sizeof(temp));
+		if (temp.idx >= EC_MAX_FANS) {
+			cfg->skipped[slot]++;
+			break;
+		}
+		cfg->custom_temps[temp.idx] = temp;
+		cfg->custom_temp_set |= 1 << temp.idx;
+		break;
+	}
+	case GPUCFG_TYPE_FAN_CURVE:
+		ec_fan_curve_block(cfg, body, len);
+		break;
+	case GPUCFG_TYPE_POWER:
+		memcpy(&cfg->power, body, sizeof(cfg->power));
+		cfg->has_power = true;
+		break;
+	case GPUCFG_TYPE_BATTERY:
+		memcpy(&cfg->battery, body, sizeof(cfg->battery));
+		cfg->has_battery = true;
+		break;
+	case GPUCFG_TYPE_PD:
+		memcpy(&cfg->pd, body, sizeof(cfg->pd));
+		cfg->has_pd = true;
+		break;
+	case GPUCFG_TYPE_PCIE:
+		cfg->pcie = body[0];
+		break;
+	case GPUCFG_TYPE_VENDOR:
+		cfg->vendor = body[0];
+		break;
+	case GPUCFG_TYPE_SUBSYS: {
+		struct gpu_subsys_serial subsys;
+
+		memcpy(&subsys, body, sizeof(subsys));
+		if (subsys.gpu_subsys >= GPU_SUBSYS_MAX) {
+			cfg->skipped[slot]++;
+			break;
+		}
+		memcpy(cfg->subsys_serials[subsys.gpu_subsys], subsys.serial, GPU_SERIAL_LEN);
+		cfg->subsys_set |= 1 << subsys.gpu_subsys;
+		break;
+	}
+	case GPUCFG_TYPE_GPIO_ACTIONS: {
+		size_t states = len / sizeof(struct gpu_cfg_gpio_actions);
+
+		if (states > EC_MAX_ACTION_STATES || len % sizeof(struct gpu_cfg_gpio_actions))
+			cfg->skipped[slot]++;
+		if (states > EC_MAX_ACTION_STATES)
+			states = EC_MAX_ACTION_STATES;
+		memset(cfg->actions, 0, sizeof(cfg->actions));
+		memcpy(cfg->actions, body, states * sizeof(struct gpu_cfg_gpio_actions));
+		cfg->action_states = states;
+		break;
+	}
+	case GPUCFG_TYPE_SIGNATURE:
+		memcpy(cfg->key_id, body, sizeof(cfg->key_id));
+		cfg->has_signature = true;
+		break;
+	default:
+		/* Known but unused by the EC, or unknown */
+		break;
+	}
+}
+
+/**
+ * Decode the image in buf, of which len bytes are valid, into cfg.
+ *
+ * \return cfg->status
+ */
+static enum ec_status ec_consume(const uint8_t *buf, size_t len, struct ec_config *cfg)
+{
+	struct gpu_cfg_descriptor *hdr = &cfg->header;
+	size_t offset = sizeof(*hdr);
+	size_t end;
+	bool compact;
+
+	ec_config_init(cfg);
+	if (len < sizeof(*hdr))
+		return cfg->status = EC_TRUNCATED;
+	memcpy(hdr, buf, sizeof(*hdr));
+	if (hdr->magic[0] != 0x32 || hdr->magic[1] != (char)0xAC || hdr->magic[2] || hdr->magic[3])
+		return cfg->status = EC_BAD_MAGIC;
+	if (ec_crc32(buf, offsetof(struct gpu_cfg_descriptor, crc32)) != hdr->crc32)
+		return cfg->status = EC_BAD_HEADER_CRC;
+	if (hdr->descriptor_version_major > GPU_CFG_VERSION_MAJOR)
+		return cfg->status = EC_BAD_VERSION;
+	if (hdr->descriptor_length > len - offset)
+		return cfg->status = EC_TRUNCATED;
+	end = offset + hdr->descriptor_length;
+	if (ec_crc32(buf + offset, hdr->descriptor_length) != hdr->descriptor_crc32)
+		return cfg->status = EC_BAD_DESCRIPTOR_CRC;
+
+	compact = hdr->descriptor_version_minor == GPU_CFG_VERSION_MINOR_COMPACT;
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		struct gpu_block_header block;
+
+		memcpy(&block, buf + offset, sizeof(block));
+		offset += sizeof(block);
+		if (block.block_length > end - offset)
+			return cfg->status = EC_BAD_CHAIN;
+		ec_block(cfg, block.block_type, buf + offset, block.block_length, compact);
+		offset += block.block_length;
+	}
+	return cfg->status = EC_OK;
+}
+
+/**
+ * Compare two accepted decodes.
+ *
+ * \return NULL if they agree, otherwise the first member that differs
+ */
+static const char *ec_config_diff(const struct ec_config *a, const struct ec_config *b)
+{
+#define EC_CONFIG_CMP(m) \
+	if (memcmp(&a->m, &b->m, sizeof(a->m)) != 0) \
+		return #m;
+	EC_CONFIG_MEMBERS(EC_CONFIG_CMP)
+#undef EC_CONFIG_CMP
+	return NULL;
+}
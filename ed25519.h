@@ -0,0 +1,422 @@
+/*
+ * Ed25519 signatures (RFC 8032), following the TweetNaCl implementation:
+ * field elements are 16 limbs of 16 bits in int64_t, points are extended
+ * coordinates, and scalar multiplication is a constant time ladder.
+ *
+ * Keys are expanded once (ed25519_key_from_seed, ed25519_pubkey_load) so
+ * signing and verifying many messages with one key skips the per message
+ * key hashing and point decompression. All functions are reentrant.
+ */
+
+#define ED25519_SEED_LEN 32
+#define ED25519_PUBKEY_LEN 32
+#define ED25519_SIG_LEN 64
+
+typedef int64_t gf[16];
+
+static const gf ed_gf0;
+static const gf ed_gf1 = {1};
+static const gf ed_d = {0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070,
+	0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203};
+static const gf ed_d2 = {0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0,
+	0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406};
+static const gf ed_x = {0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c,
+	0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169};
+static const gf ed_y = {0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666,
+	0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666};
+static const gf ed_i = {0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43,
+	0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83};
+/* Group order */
+static const uint64_t ed_l[32] = {0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+	0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0x10};
+
+struct ed25519_key {
+	/* Clamped secret scalar and nonce prefix, SHA-512 of the seed */
+	uint8_t az[64];
+	uint8_t pk[ED25519_PUBKEY_LEN];
+};
+
+struct ed25519_pubkey {
+	uint8_t pk[ED25519_PUBKEY_LEN];
+	/* The decompressed, negated public key point */
+	gf neg_a[4];
+};
+
+static void ed_set(gf r, const gf a)
+{
+	memcpy(r, a, sizeof(gf));
+}
+
+static void ed_carry(gf o)
+{
+	for (int i = 0; i < 16; i++) {
+		int64_t c;
+
+		o[i] += 1LL << 16;
+		c = o[i] >> 16;
+		o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+		o[i] -= c * 65536;
+	}
+}
+
+static void ed_sel(gf p, gf q, int b)
+{
+	int64_t c = ~(b - 1);
+
+	for (int i = 0; i < 16; i++) {
+		int64_t t = c & (p[i] ^ q[i]);
+		p[i] ^= t;
+		q[i] ^= t;
+	}
+}
+
+static void ed_pack25519(uint8_t *o, const gf n)
+{
+	gf m, t;
+
+	ed_set(t, n);
+	ed_carry(t);
+	ed_carry(t);
+	ed_carry(t);
+	for (int j = 0; j < 2; j++) {
+		int b;
+
+		m[0] = t[0] - 0xffed;
+		for (int i = 1; i < 15; i++) {
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		b = (m[15] >> 16) & 1;
+		m[14] &= 0xffff;
+		ed_sel(t, m, 1 - b);
+	}
+	for (int i = 0; i < 16; i++) {
+		o[2 * i] = t[i] & 0xff;
+		o[2 * i + 1] = t[i] >> 8;
+	}
+}
+
+/* Constant time comparison, 0 if equal */
+static int ed_verify32(const uint8_t *x, const uint8_t *y)
+{
+	unsigned int d = 0;
+
+	for (int i = 0; i < 32; i++)
+		d |= x[i] ^ y[i];
+	return (1 & ((d - 1) >> 8)) - 1;
+}
+
+static int ed_neq25519(const gf a, const gf b)
+{
+	uint8_t c[32], d[32];
+
+	ed_pack25519(c, a);
+	ed_pack25519(d, b);
+	return ed_verify32(c, d);
+}
+
+static uint8_t ed_par25519(const gf a)
+{
+	uint8_t d[32];
+
+	ed_pack25519(d, a);
+	return d[0] & 1;
+}
+
+static void ed_unpack25519(gf o, const uint8_t *n)
+{
+	for (int i = 0; i < 16; i++)
+		o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+	o[15] &= 0x7fff;
+}
+
+static void ed_add25519(gf o, const gf a, const gf b)
+{
+	for (int i = 0; i < 16; i++)
+		o[i] = a[i] + b[i];
+}
+
+static void ed_sub25519(gf o, const gf a, const gf b)
+{
+	for (int i = 0; i < 16; i++)
+		o[i] = a[i] - b[i];
+}
+
+static void ed_mul25519(gf o, const gf a, const gf b)
+{
+	int64_t t[31] = {0};
+
+	for (int i = 0; i < 16; i++) {
+		for (int j = 0; j < 16; j++)
+			t[i + j] += a[i] * b[j];
+	}
+	for (int i = 0; i < 15; i++)
+		t[i] += 38 * t[i + 16];
+	for (int i = 0; i < 16; i++)
+		o[i] = t[i];
+	ed_carry(o);
+	ed_carry(o);
+}
+
+static void ed_sq25519(gf o, const gf a)
+{
+	ed_mul25519(o, a, a);
+}
+
+static void ed_inv25519(gf o, const gf i)
+{
+	gf c;
+
+	ed_set(c, i);
+	for (int a = 253; a >= 0; a--) {
+		ed_sq25519(c, c);
+		if (a != 2 && a != 4)
+			ed_mul25519(c, c, i);
+	}
+	ed_set(o, c);
+}
+
+static void ed_pow2523(gf o, const gf i)
+{
+	gf c;
+
+	ed_set(c, i);
+	for (int a = 250; a >= 0; a--) {
+		ed_sq25519(c, c);
+		if (a != 1)
+			ed_mul25519(c, c, i);
+	}
+	ed_set(o, c);
+}
+
+static void ed_point_add(gf p[4], gf q[4])
+{
+	gf a, b, c, d, t, e, f, g, h;
+
+	ed_sub25519(a, p[1], p[0]);
+	ed_sub25519(t, q[1], q[0]);
+	ed_mul25519(a, a, t);
+	ed_add25519(b, p[0], p[1]);
+	ed_add25519(t, q[0], q[1]);
+	ed_mul25519(b, b, t);
+	ed_mul25519(c, p[3], q[3]);
+	ed_mul25519(c, c, ed_d2);
+	ed_mul25519(d, p[2], q[2]);
+	ed_add25519(d, d, d);
+	ed_sub25519(e, b, a);
+	ed_sub25519(f, d, c);
+	ed_add25519(g, d, c);
+	ed_add25519(h, b, a);
+
+	ed_mul25519(p[0], e, f);
+	ed_mul25519(p[1], h, g);
+	ed_mul25519(p[2], g, f);
+	ed_mul25519(p[3], e, h);
+}
+
+static void ed_cswap(gf p[4], gf q[4], uint8_t b)
+{
+	for (int i = 0; i < 4; i++)
+		ed_sel(p[i], q[i], b);
+}
+
+static void ed_pack(uint8_t *r, gf p[4])
+{
+	gf tx, ty, zi;
+
+	ed_inv25519(zi, p[2]);
+	ed_mul25519(tx, p[0], zi);
+	ed_mul25519(ty, p[1], zi);
+	ed_pack25519(r, ty);
+	r[31] ^= ed_par25519(tx) << 7;
+}
+
+/* p = s * q; q is clobbered */
+static void ed_scalarmult(gf p[4], gf q[4], const uint8_t *s)
+{
+	ed_set(p[0], ed_gf0);
+	ed_set(p[1], ed_gf1);
+	ed_set(p[2], ed_gf1);
+	ed_set(p[3], ed_gf0);
+	for (int i = 255; i >= 0; i--) {
+		uint8_t b = (s[i / 8] >> (i & 7)) & 1;
+		ed_cswap(p, q, b);
+		ed_point_add(q, p);
+		ed_point_add(p, p);
+		ed_cswap(p, q, b);
+	}
+}
+
+static void ed_scalarbase(gf p[4], const uint8_t *s)
+{
+	gf q[4];
+
+	ed_set(q[0], ed_x);
+	ed_set(q[1], ed_y);
+	ed_set(q[2], ed_gf1);
+	ed_mul25519(q[3], ed_x, ed_y);
+	ed_scalarmult(p, q, s);
+}
+
+static void ed_modl(uint8_t *r, int64_t x[64])
+{
+	int64_t carry;
+	int i, j;
+
+	for (i = 63; i >= 32; i--) {
+		carry = 0;
+		for (j = i - 32; j < i - 12; j++) {
+			x[j] += carry - 16 * x[i] * ed_l[j - (i - 32)];
+			carry = (x[j] + 128) >> 8;
+			x[j] -= carry * 256;
+		}
+		x[j] += carry;
+		x[i] = 0;
+	}
+	carry = 0;
+	for (j = 0; j < 32; j++) {
+		x[j] += carry - (x[31] >> 4) * ed_l[j];
+		carry = x[j] >> 8;
+		x[j] &= 255;
+	}
+	for (j = 0; j < 32; j++)
+		x[j] -= carry * ed_l[j];
+	for (i = 0; i < 32; i++) {
+		x[i + 1] += x[i] >> 8;
+		r[i] = x[i] & 255;
+	}
+}
+
+static void ed_reduce(uint8_t *r)
+{
+	int64_t x[64];
+
+	for (int i = 0; i < 64; i++)
+		x[i] = r[i];
+	memset(r, 0, 64);
+	ed_modl(r, x);
+}
+
+static int ed_unpackneg(gf r[4], const uint8_t p[32])
+{
+	gf t, chk, num, den, den2, den4, den6;
+
+	ed_set(r[2], ed_gf1);
+	ed_unpack25519(r[1], p);
+	ed_sq25519(num, r[1]);
+	ed_mul25519(den, num, ed_d);
+	ed_sub25519(num, num, r[2]);
+	ed_add25519(den, r[2], den);
+
+	ed_sq25519(den2, den);
+	ed_sq25519(den4, den2);
+	ed_mul25519(den6, den4, den2);
+	ed_mul25519(t, den6, num);
+	ed_mul25519(t, t, den);
+
+	ed_pow2523(t, t);
+	ed_mul25519(t, t, num);
+	ed_mul25519(t, t, den);
+	ed_mul25519(t, t, den);
+	ed_mul25519(r[0], t, den);
+
+	ed_sq25519(chk, r[0]);
+	ed_mul25519(chk, chk, den);
+	if (ed_neq25519(chk, num))
+		ed_mul25519(r[0], r[0], ed_i);
+
+	ed_sq25519(chk, r[0]);
+	ed_mul25519(chk, chk, den);
+	if (ed_neq25519(chk, num))
+		return -1;
+
+	if (ed_par25519(r[0]) == (p[31] >> 7))
+		ed_sub25519(r[0], ed_gf0, r[0]);
+	ed_mul25519(r[3], r[0], r[1]);
+	return 0;
+}
+
+static void ed25519_key_from_seed(struct ed25519_key *key, const uint8_t seed[ED25519_SEED_LEN])
+{
+	struct sha512_ctx ctx;
+	gf p[4];
+
+	sha512_init(&ctx);
+	sha512_update(&ctx, seed, ED25519_SEED_LEN);
+	sha512_final(&ctx, key->az);
+	key->az[0] &= 248;
+	key->az[31] &= 127;
+	key->az[31] |= 64;
+	ed_scalarbase(p, key->az);
+	ed_pack(key->pk, p);
+}
+
+static void ed25519_sign(uint8_t sig[ED25519_SIG_LEN], const uint8_t *m, size_t n, const struct ed25519_key *key)
+{
+	struct sha512_ctx ctx;
+	uint8_t r[64], h[64];
+	int64_t x[64];
+	gf p[4];
+
+	sha512_init(&ctx);
+	sha512_update(&ctx, key->az + 32, 32);
+	sha512_update(&ctx, m, n);
+	sha512_final(&ctx, r);
+	ed_reduce(r);
+	ed_scalarbase(p, r);
+	ed_pack(sig, p);
+
+	sha512_init(&ctx);
+	sha512_update(&ctx, sig, 32);
+	sha512_update(&ctx, key->pk, ED25519_PUBKEY_LEN);
+	sha512_update(&ctx, m, n);
+	sha512_final(&ctx, h);
+	ed_reduce(h);
+
+	memset(x, 0, sizeof(x));
+	for (int i = 0; i < 32; i++)
+		x[i] = r[i];
+	for (int i = 0; i < 32; i++) {
+		for (int j = 0; j < 32; j++)
+			x[i + j] += h[i] * (uint64_t)key->az[j];
+	}
+	ed_modl(sig + 32, x);
+}
+
+/**
+ * \return 0 on success, -1 if pk is not a valid point
+ */
+static int ed25519_pubkey_load(struct ed25519_pubkey *pub, const uint8_t pk[ED25519_PUBKEY_LEN])
+{
+	memcpy(pub->pk, pk, ED25519_PUBKEY_LEN);
+	return ed_unpackneg(pub->neg_a, pk);
+}
+
+/**
+ * \return 0 if sig is a valid signature of m, -1 otherwise
+ */
+static int ed25519_verify(const uint8_t sig[ED25519_SIG_LEN], const uint8_t *m, size_t n,
+	const struct ed25519_pubkey *pub)
+{
+	struct sha512_ctx ctx;
+	uint8_t h[64], t[32];
+	gf p[4], q[4];
+
+	if (sig[63] & 224)
+		return -1;
+	sha512_init(&ctx);
+	sha512_update(&ctx, sig, 32);
+	sha512_update(&ctx, pub->pk, ED25519_PUBKEY_LEN);
+	sha512_update(&ctx, m, n);
+	sha512_final(&ctx, h);
+	ed_reduce(h);
+
+	memcpy(q, pub->neg_a, sizeof(q));
+	ed_scalarmult(p, q, h);
+	ed_scalarbase(q, sig + 32);
+	ed_point_add(p, q);
+	ed_pack(t, p);
+	return ed_verify32(sig, t);
+}
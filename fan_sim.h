@@ -0,0 +1,277 @@
+/*
+ * Open loop replay of recorded temperature traces against the EC fan
+ * policy implied by a config, for many config variants at once.
+ *
+ * Each fan follows the same curve as fan_curve_rpm(): off below temp_off,
+ * linear from min_rpm to max_rpm up to temp_max, max_rpm above. The fan does
+ * not feed back into the trace and the policy has no state, so every result
+ * only depends on how long each temperature was seen. The samples are reduced
+ * to distinct temperature levels with a sample count once, and each variant
+ * is evaluated per level rather than per sample.
+ *
+ * Variants are stored as structure of arrays and processed FAN_SIM_LANES at
+ * a time with vector extensions; threads take chunks of variants and stream
+ * all levels through them.
+ *
+ * Acoustics use the fan law (sound power ~ rpm^5, i.e. +50 dB per decade of
+ * speed) around a single reference point. It is only good for comparing
+ * variants with each other, not for absolute levels.
+ */
+#include <math.h>
+
+#define FAN_SIM_MAX_FANS 2
+#define FAN_SIM_LANES 4
+/* Variants per work item, a multiple of FAN_SIM_LANES */
+#define FAN_SIM_CHUNK 64
+#define FAN_SIM_BINS 16
+#define FAN_SIM_BIN_RPM 500
+#define FAN_SIM_REF_RPM 3000.0f
+#define FAN_SIM_REF_DBA 40.0
+
+typedef float fan_vec __attribute__((vector_size(FAN_SIM_LANES * sizeof(float))));
+typedef int32_t fan_mask __attribute__((vector_size(FAN_SIM_LANES * sizeof(int32_t))));
+
+struct fan_sim {
+	int nfans;
+	/* Padded to a multiple of FAN_SIM_CHUNK */
+	int nvariants;
+	/* Inputs per fan and variant, temperatures in Kelvin */
+	float *temp_off[FAN_SIM_MAX_FANS];
+	float *temp_max[FAN_SIM_MAX_FANS];
+	float *min_rpm[FAN_SIM_MAX_FANS];
+	float *max_rpm[FAN_SIM_MAX_FANS];
+	/* Outputs per fan and variant, counted in samples */
+	int32_t *saturated[FAN_SIM_MAX_FANS];
+	int32_t *off[FAN_SIM_MAX_FANS];
+	/* FAN_SIM_BINS counts per variant */
+	uint32_t *hist[FAN_SIM_MAX_FANS];
+	/* Outputs per variant: sound energy relative to the reference, summed
+	 * over samples, and the loudest sample */
+	double *energy;
+	float *peak;
+
+	/* Distinct temperatures and how many samples had each */
+	float *levels;
+	int32_t *weights;
+	size_t nlevels;
+	size_t nsamples;
+	int next_chunk;
+};
+
+static void *fan_sim_alloc(size_t size)
+{
+	void *p = aligned_alloc(sizeof(fan_vec), (size + sizeof(fan_vec) - 1) / sizeof(fan_vec) * sizeof(fan_vec));
+
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+/**
+ * Allocate inputs and outputs for nvariants variants of nfans fans.
+ *
+ * \return 0 on success, -1 if out of memory
+ */
+static int fan_sim_init(struct fan_sim *sim, int nfans, int nvariants)
+{
+	size_t n;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->nfans = nfans;
+	sim->nvariants = (nvariants + FAN_SIM_CHUNK - 1) / FAN_SIM_CHUNK * FAN_SIM_CHUNK;
+	n = sim->nvariants;
+	for (int f = 0; f < nfans; f++) {
+		sim->temp_off[f] = fan_sim_alloc(n * sizeof(float));
+		sim->temp_max[f] = fan_sim_alloc(n * sizeof(float));
+		sim->min_rpm[f] = fan_sim_alloc(n * sizeof(float));
+		sim->max_rpm[f] = fan_sim_alloc(n * sizeof(float));
+		sim->saturated[f] = fan_sim_alloc(n * sizeof(int32_t));
+		sim->off[f] = fan_sim_alloc(n * sizeof(int32_t));
+		sim->hist[f] = fan_sim_alloc(n * FAN_SIM_BINS * sizeof(uint32_t));
+		if (!sim->temp_off[f] || !sim->temp_max[f] || !sim->min_rpm[f] || !sim->max_rpm[f] ||
+				!sim->saturated[f] || !sim->off[f] || !sim->hist[f])
+			return -1;
+	}
+	sim->energy = fan_sim_alloc(n * sizeof(double));
+	sim->peak = fan_sim_alloc(n * sizeof(float));
+	return sim->energy && sim->peak ? 0 : -1;
+}
+
+static void fan_sim_free(struct fan_sim *sim)
+{
+	for (int f = 0; f < sim->nfans; f++) {
+		free(sim->temp_off[f]);
+		free(sim->temp_max[f]);
+		free(sim->min_rpm[f]);
+		free(sim->max_rpm[f]);
+		free(sim->saturated[f]);
+		free(sim->off[f]);
+		free(sim->hist[f]);
+	}
+	free(sim->energy);
+	free(sim->peak);
+	free(sim->levels);
+	free(sim->weights);
+}
+
+static inline fan_vec fan_select(fan_mask m, fan_vec a, fan_vec b)
+{
+	return (fan_vec)(((fan_mask)a & m) | ((fan_mask)b & ~m));
+}
+
+/*
+ * Replay all samples against the variants [v0, v0 + FAN_SIM_CHUNK).
+ */
+static void fan_sim_chunk(struct fan_sim *sim, int v0)
+{
+	enum { VECS = FAN_SIM_CHUNK / FAN_SIM_LANES };
+	const fan_vec zero = {0};
+	fan_vec off[FAN_SIM_MAX_FANS][VECS], max[FAN_SIM_MAX_FANS][VECS];
+	fan_vec base[FAN_SIM_MAX_FANS][VECS], slope[FAN_SIM_MAX_FANS][VECS], top[FAN_SIM_MAX_FANS][VECS];
+	fan_mask saturated[FAN_SIM_MAX_FANS][VECS] = {{{0}}}, stopped[FAN_SIM_MAX_FANS][VECS] = {{{0}}};
+	fan_vec energy[VECS], peak[VECS];
+
+	for (int f = 0; f < sim->nfans; f++) {
+		for (int k = 0; k < VECS; k++) {
+			int v = v0 + k * FAN_SIM_LANES;
+			off[f][k] = *(const fan_vec *)&sim->temp_off[f][v];
+			max[f][k] = *(const fan_vec *)&sim->temp_max[f][v];
+			top[f][k] = *(const fan_vec *)&sim->max_rpm[f][v] / FAN_SIM_REF_RPM;
+			base[f][k] = *(const fan_vec *)&sim->min_rpm[f][v] / FAN_SIM_REF_RPM;
+			slope[f][k] = (top[f][k] - base[f][k]) / (max[f][k] - off[f][k]);
+		}
+	}
+	for (int k = 0; k < VECS; k++) {
+		peak[k] = zero;
+		energy[k] = zero;
+	}
+
+	for (size_t s = 0; s < sim->nlevels; s++) {
+		const fan_vec t = zero + sim->levels[s];
+		const int32_t count = sim->weights[s];
+		const fan_mask w = (fan_mask){0} + count;
+
+		for (int k = 0; k < VECS; k++) {
+			fan_vec sample = zero;
+
+			for (int f = 0; f < sim->nfans; f++) {
+				fan_mask on = t >= off[f][k];
+				fan_mask sat = t >= max[f][k];
+				/* Speed relative to the reference speed */
+				fan_vec x = fan_select(sat, top[f][k], base[f][k] + slope[f][k] * (t - off[f][k]));
+				fan_vec x2;
+
+				x = (fan_vec)((fan_mask)x & on);
+				saturated[f][k] += sat & w;
+				stopped[f][k] += ~on & w;
+				for (int l = 0; l < FAN_SIM_LANES; l++) {
+					int bin = x[l] * (FAN_SIM_REF_RPM / FAN_SIM_BIN_RPM);
+					sim->hist[f][(v0 + k * FAN_SIM_LANES + l) * FAN_SIM_BINS +
+						(bin < FAN_SIM_BINS ? bin : FAN_SIM_BINS - 1)] += count;
+				}
+				x2 = x * x;
+				sample += x2 * x2 * x;
+			}
+			energy[k] += sample * (float)count;
+			peak[k] = fan_select(sample > peak[k], sample, peak[k]);
+		}
+	}
+
+	for (int f = 0; f < sim->nfans; f++) {
+		for (int k = 0; k < VECS; k++) {
+			int v = v0 + k * FAN_SIM_LANES;
+			*(fan_mask *)&sim->saturated[f][v] = saturated[f][k];
+			*(fan_mask *)&sim->off[f][v] = stopped[f][k];
+		}
+	}
+	for (int k = 0; k < VECS; k++) {
+		*(fan_vec *)&sim->peak[v0 + k * FAN_SIM_LANES] = peak[k];
+		for (int l = 0; l < FAN_SIM_LANES; l++)
+			sim->energy[v0 + k * FAN_SIM_LANES + l] = energy[k][l];
+	}
+}
+
+static void *fan_sim_thread(void *arg)
+{
+	struct fan_sim *sim = arg;
+	int chunk;
+
+	while ((chunk = __atomic_fetch_add(&sim->next_chunk, 1, __ATOMIC_RELAXED)) * FAN_SIM_CHUNK < sim->nvariants)
+		fan_sim_chunk(sim, chunk * FAN_SIM_CHUNK);
+	return NULL;
+}
+
+static int fan_sim_compare(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Reduce nsamples temperatures (Kelvin) to distinct levels. temps is sorted
+ * in place.
+ *
+ * \return 0 on success, -1 if out of memory
+ */
+static int fan_sim_levels(struct fan_sim *sim, float *temps, size_t nsamples)
+{
+	size_t n = 0;
+
+	qsort(temps, nsamples, sizeof(float), fan_sim_compare);
+	sim->levels = malloc(nsamples * sizeof(float));
+	sim->weights = malloc(nsamples * sizeof(int32_t));
+	if (!sim->levels || !sim->weights)
+		return -1;
+	for (size_t i = 0; i < nsamples; i++) {
+		if (n && sim->levels[n - 1] == temps[i]) {
+			sim->weights[n - 1]++;
+			continue;
+		}
+		sim->levels[n] = temps[i];
+		sim->weights[n++] = 1;
+	}
+	sim->nlevels = n;
+	sim->nsamples = nsamples;
+	return 0;
+}
+
+/**
+ * Evaluate all variants against the levels using up to nthreads threads.
+ */
+static void fan_sim_run(struct fan_sim *sim, int nthreads)
+{
+	pthread_t threads[WRITER_MAX_THREADS];
+	int started = 0;
+
+	sim->next_chunk = 0;
+	if (nthreads > WRITER_MAX_THREADS)
+		nthreads = WRITER_MAX_THREADS;
+	if (nthreads > sim->nvariants / FAN_SIM_CHUNK)
+		nthreads = sim->nvariants / FAN_SIM_CHUNK;
+	for (; started < nthreads - 1; started++) {
+		if (pthread_create(&threads[started], NULL, fan_sim_thread, sim))
+			break;
+	}
+	fan_sim_thread(sim);
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/**
+ * Equivalent continuous sound level of a variant, -INFINITY if all fans
+ * stayed off.
+ */
+static double fan_sim_leq(const struct fan_sim *sim, int v)
+{
+	if (!sim->nsamples || sim->energy[v] <= 0)
+		return -INFINITY;
+	return FAN_SIM_REF_DBA + 10 * log10(sim->energy[v] / sim->nsamples);
+}
+
+static double fan_sim_peak_dba(const struct fan_sim *sim, int v)
+{
+	if (sim->peak[v] <= 0)
+		return -INFINITY;
+	return FAN_SIM_REF_DBA + 10 * log10(sim->peak[v]);
+}
@@ -7,10 +7,35 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <time.h>
 
 #include "crc.h"
 #include "gpio_defines.h"
 #include "config_definition.h"
+#include "image_view.h"
+#include "image_writer.h"
+#include "image_format.h"
+#include "config_fields.h"
+#include "boot_layout.h"
+#include "compact_encoding.h"
+#include "fan_sim.h"
+#include "stream_parser.h"
+#include "lazy_reader.h"
+#include "config_check.h"
+#include "sha512.h"
+#include "sha256.h"
+#include "ed25519.h"
+#include "column_export.h"
+#include "station.h"
+#include "migrate.h"
+#include "sku_registry.h"
+#include "hash_manifest.h"
+#include "watch.h"
+#include "ec_consumer.h"
 #define C_TO_K(temp_c) ((temp_c) + 273)
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
 #define BYTE_TO_BINARY(byte)  \
@@ -25,6 +50,25 @@
 #define CONFIG_AP_PWRSEQ_S0IX 1
 
 static bool verbose = false;
+static struct output_format output = {
+	.format = FORMAT_BIN,
+	.device_size = 0,
+	.page_size = 0,
+};
+static bool boot_layout = false;
+static bool compact = false;
+static bool gpio_actions = false;
+static bool fan_curve = false;
+/* Set by --sign-key and --verify-sig */
+static struct ed25519_key *sign_key = NULL;
+static struct ed25519_pubkey *verify_key = NULL;
+/* Public half of sign_key, a signed image must verify with it to be re-signed */
+static struct ed25519_pubkey *resign_key = NULL;
+static struct boot_params boot = {
+	.bus_khz = 100,
+	.page_size = 32,
+	.max_xfer = 32,
+};
 
 enum power_state {
 	/* Steady states */
@@ -56,6 +100,16 @@ enum power_state {
 #endif
 };
 
+/* Steady states have a GPIO action table entry each */
+#define POWER_STEADY_COUNT (POWER_S0 + 1 + CONFIG_AP_PWRSEQ_S0IX)
+
+static const char *steady_state_names[POWER_STEADY_COUNT] = {
+	"G3", "S5", "S4", "S3", "S0",
+#if CONFIG_AP_PWRSEQ_S0IX
+	"S0ix",
+#endif
+};
+
 
 struct default_gpu_cfg {
 	struct gpu_cfg_descriptor descriptor;
@@ -96,7 +150,7 @@ struct default_gpu_cfg {
 
 } __packed;
 
-static struct default_gpu_cfg gpu_cfg = {
+static const struct default_gpu_cfg gpu_cfg = {
 	.descriptor = {
 		.magic = {0x32, 0xac, 0x00, 0x00},
 		.length = sizeof(struct gpu_cfg_descriptor),
@@ -182,7 +236,7 @@ struct default_ssd_cfg {
 
 } __packed;
 
-static struct default_ssd_cfg ssd_cfg = {
+static const struct default_ssd_cfg ssd_cfg = {
 	.descriptor = {
 		.magic = {0x32, 0xac, 0x00, 0x00},
 		.length = sizeof(struct gpu_cfg_descriptor),
@@ -227,26 +281,237 @@ static struct default_ssd_cfg ssd_cfg = {
 	.gpu_3v_5v_en = {.gpio = GPU_3V_5V_EN, .function = GPIO_FUNC_HIGH, .flags = GPIO_OUTPUT_LOW, .power_domain = POWER_S5},
 };
 
-void print_descriptor(struct gpu_cfg_descriptor *desc)
+/* Picked by the longest matching prefix of the module serial */
+static const struct sku_profile sku_profiles[] = {
+	{"gpu", "FRAKMBCP", &gpu_cfg, sizeof(gpu_cfg), "FRAGMASP"},
+	{"ssd", "FRAGMBSP", &ssd_cfg, sizeof(ssd_cfg), NULL},
+};
+
+static struct sku_registry skus;
+
+void print_descriptor(const uint8_t *desc)
 {
 
 	if (verbose) {
 		printf("Descriptor\n");
-		printf("  Magic         %02X%02X%02X%02X\n", (uint8_t)desc->magic[0], (uint8_t)desc->magic[1], (uint8_t)desc->magic[2], (uint8_t)desc->magic[3]);
-		printf("  Length:       %d\n", desc->length);
-		printf("  Desc Version: %d.%d\n", desc->descriptor_version_major, desc->descriptor_version_minor);
-		printf("  HW Version:   %04X\n", desc->hardware_version);
-		printf("  HW Rev:       %d\n", desc->hardware_revision);
-		printf("  Serialnum:    %s\n", desc->serial);
-		printf("  Desc Length:  %d\n", desc->descriptor_length);
-		printf("  Desc CRC32:   %08X\n", desc->descriptor_crc32);
-		printf("  CRC32:        %08X\n", desc->crc32);
+		const uint8_t *magic = view_desc_magic(desc);
+		printf("  Magic         %02X%02X%02X%02X\n", magic[0], magic[1], magic[2], magic[3]);
+		printf("  Length:       %d\n", view_desc_length(desc));
+		printf("  Desc Version: %d.%d\n", view_desc_descriptor_version_major(desc), view_desc_descriptor_version_minor(desc));
+		printf("  HW Version:   %04X\n", view_desc_hardware_version(desc));
+		printf("  HW Rev:       %d\n", view_desc_hardware_revision(desc));
+		printf("  Serialnum:    %s\n", (const char *)view_desc_serial(desc));
+		printf("  Desc Length:  %d\n", view_desc_descriptor_length(desc));
+		printf("  Desc CRC32:   %08X\n", view_desc_descriptor_crc32(desc));
+		printf("  CRC32:        %08X\n", view_desc_crc32(desc));
 	} else {
-		printf("Serialnum:   %s\n", desc->serial);
+		printf("Serialnum:   %s\n", (const char *)view_desc_serial(desc));
+	}
+}
+
+/*
+ * A block as read_eeprom decodes it: the body is read through the views
+ * into host structs, with 0.2 blocks expanded to 0.1. The printers and the
+ * differential fuzzer both work from this, so the fuzzer checks what -i -v
+ * actually shows.
+ */
+#define DECODED_MAX_GPIOS (GPU_MAX_BLOCK_LEN / sizeof(struct gpu_cfg_gpio_compact))
+#define DECODED_MAX_STATES (GPU_MAX_BLOCK_LEN / sizeof(struct gpu_cfg_gpio_actions))
+#define DECODED_MAX_POINTS ((GPU_MAX_BLOCK_LEN - sizeof(struct gpu_cfg_fan_curve)) / sizeof(uint16_t))
+
+struct decoded_block {
+	uint8_t type;
+	/* The body is too short for its type, nothing else is filled in */
+	bool short_body;
+	/* Trailing bytes that do not make a whole GPIO entry or action state */
+	bool partial;
+	union {
+		struct {
+			size_t count;
+			struct gpu_cfg_gpio entry[DECODED_MAX_GPIOS];
+		} gpio;
+		struct gpu_cfg_thermal thermal;
+		struct gpu_cfg_fan fan;
+		struct gpu_cfg_power power;
+		struct gpu_cfg_battery battery;
+		struct gpu_subsys_serial subsys;
+		struct gpu_subsys_pd pd;
+		struct gpu_cfg_custom_temp custom_temp;
+		struct {
+			size_t count;
+			struct gpu_cfg_gpio_actions state[DECODED_MAX_STATES];
+		} actions;
+		struct {
+			uint8_t idx;
+			uint16_t temp_start;
+			uint8_t temp_step;
+			uint8_t count;
+			uint16_t rpm[DECODED_MAX_POINTS];
+		} curve;
+		struct gpu_cfg_signature signature;
+		/* PCIe lanes or vendor */
+		uint8_t value;
+	};
+};
+
+static bool decode_short(struct decoded_block *d, uint8_t len, size_t size)
+{
+	d->short_body = len < size;
+	return d->short_body;
+}
+
+/**
+ * Decode one block of a descriptor. Types without a body that read_eeprom
+ * understands only get their type filled in.
+ */
+static void decode_block(const uint8_t *descriptor, const uint8_t *block_header,
+	const uint8_t *body, struct decoded_block *d)
+{
+	uint8_t len = view_block_block_length(block_header);
+	uint8_t expanded[GPU_MAX_BLOCK_LEN * 2];
+
+	d->type = view_block_block_type(block_header);
+	d->short_body = false;
+	d->partial = false;
+	switch (d->type) {
+		case GPUCFG_TYPE_GPIO: {
+			size_t size = sizeof(struct gpu_cfg_gpio);
+
+			if (is_compact(descriptor)) {
+				size = sizeof(struct gpu_cfg_gpio_compact);
+				expand_gpio(body, len, expanded);
+				body = expanded;
+			}
+			d->gpio.count = len / size;
+			d->partial = len % size != 0;
+			for (size_t i = 0; i < d->gpio.count; i++) {
+				const uint8_t *entry = body + i * sizeof(struct gpu_cfg_gpio);
+
+				d->gpio.entry[i].gpio = view_gpio_gpio(entry);
+				d->gpio.entry[i].function = view_gpio_function(entry);
+				d->gpio.entry[i].flags = view_gpio_flags(entry);
+				d->gpio.entry[i].power_domain = view_gpio_power_domain(entry);
+			}
+			break;
+		}
+		case GPUCFG_TYPE_THERMAL_SENSOR:
+			if (is_compact(descriptor)) {
+				d->short_body = !expand_thermal(body, len, expanded);
+				body = expanded;
+			} else {
+				decode_short(d, len, sizeof(struct gpu_cfg_thermal));
+			}
+			if (!d->short_body) {
+				d->thermal.thermal_type = view_thermal_thermal_type(body);
+				d->thermal.address = view_thermal_address(body);
+				d->thermal.reserved = view_thermal_reserved(body);
+				d->thermal.reserved2 = view_thermal_reserved2(body);
+			}
+			break;
+		case GPUCFG_TYPE_FAN:
+			if (decode_short(d, len, sizeof(struct gpu_cfg_fan))) {
+				break;
+			}
+			d->fan.idx = view_fan_idx(body);
+			d->fan.flags = view_fan_flags(body);
+			d->fan.min_rpm = view_fan_min_rpm(body);
+			d->fan.min_temp = view_fan_min_temp(body);
+			d->fan.start_rpm = view_fan_start_rpm(body);
+			d->fan.max_rpm = view_fan_max_rpm(body);
+			d->fan.max_temp = view_fan_max_temp(body);
+			break;
+		case GPUCFG_TYPE_POWER:
+			if (decode_short(d, len, sizeof(struct gpu_cfg_power))) {
+				break;
+			}
+			d->power.device_idx = view_power_device_idx(body);
+			d->power.battery_power = view_power_battery_power(body);
+			d->power.average_power = view_power_average_power(body);
+			d->power.long_term_power = view_power_long_term_power(body);
+			d->power.short_term_power = view_power_short_term_power(body);
+			d->power.peak_power = view_power_peak_power(body);
+			break;
+		case GPUCFG_TYPE_BATTERY:
+			if (decode_short(d, len, sizeof(struct gpu_cfg_battery))) {
+				break;
+			}
+			d->battery.max_current = view_battery_max_current(body);
+			d->battery.max_mv = view_battery_max_mv(body);
+			d->battery.min_mv = view_battery_min_mv(body);
+			d->battery.max_charge_current = view_battery_max_charge_current(body);
+			break;
+		case GPUCFG_TYPE_PCIE:
+		case GPUCFG_TYPE_VENDOR:
+			if (!decode_short(d, len, sizeof(uint8_t))) {
+				d->value = ld_le8(body);
+			}
+			break;
+		case GPUCFG_TYPE_SUBSYS:
+			if (decode_short(d, len, sizeof(struct gpu_subsys_serial))) {
+				break;
+			}
+			d->subsys.gpu_subsys = view_subsys_gpu_subsys(body);
+			memcpy(d->subsys.serial, view_subsys_serial(body), GPU_SERIAL_LEN);
+			break;
+		case GPUCFG_TYPE_PD:
+			if (decode_short(d, len, sizeof(struct gpu_subsys_pd))) {
+				break;
+			}
+			d->pd.gpu_pd_type = view_pd_gpu_pd_type(body);
+			d->pd.address = view_pd_address(body);
+			d->pd.flags = view_pd_flags(body);
+			d->pd.pdo = view_pd_pdo(body);
+			d->pd.rdo = view_pd_rdo(body);
+			d->pd.power_domain = view_pd_power_domain(body);
+			d->pd.gpio_hpd = view_pd_gpio_hpd(body);
+			d->pd.gpio_interrupt = view_pd_gpio_interrupt(body);
+			break;
+		case GPUCFG_TYPE_CUSTOM_TEMP:
+			if (decode_short(d, len, sizeof(struct gpu_cfg_custom_temp))) {
+				break;
+			}
+			d->custom_temp.idx = view_custom_temp_idx(body);
+			d->custom_temp.temp_fan_off = view_custom_temp_temp_fan_off(body);
+			d->custom_temp.temp_fan_max = view_custom_temp_temp_fan_max(body);
+			break;
+		case GPUCFG_TYPE_GPIO_ACTIONS:
+			d->actions.count = len / sizeof(struct gpu_cfg_gpio_actions);
+			d->partial = len % sizeof(struct gpu_cfg_gpio_actions) != 0;
+			for (size_t i = 0; i < d->actions.count; i++) {
+				const uint8_t *state = body + i * sizeof(struct gpu_cfg_gpio_actions);
+
+				d->actions.state[i].assert_mask = view_gpio_actions_assert_mask(state);
+				d->actions.state[i].deassert_mask = view_gpio_actions_deassert_mask(state);
+			}
+			break;
+		case GPUCFG_TYPE_FAN_CURVE:
+			/* A curve with more points than its body holds is as good as short */
+			if (decode_short(d, len, sizeof(struct gpu_cfg_fan_curve)) ||
+					view_fan_curve_count(body) > (len - sizeof(struct gpu_cfg_fan_curve)) / sizeof(uint16_t)) {
+				d->short_body = true;
+				break;
+			}
+			d->curve.idx = view_fan_curve_idx(body);
+			d->curve.temp_start = view_fan_curve_temp_start(body);
+			d->curve.temp_step = view_fan_curve_temp_step(body);
+			d->curve.count = view_fan_curve_count(body);
+			for (int i = 0; i < d->curve.count; i++) {
+				d->curve.rpm[i] = view_fan_curve_rpm(body, i);
+			}
+			break;
+		case GPUCFG_TYPE_SIGNATURE:
+			if (decode_short(d, len, sizeof(struct gpu_cfg_signature))) {
+				break;
+			}
+			memcpy(d->signature.key_id, view_signature_key_id(body), sizeof(d->signature.key_id));
+			memcpy(d->signature.signature, view_signature_signature(body), sizeof(d->signature.signature));
+			break;
+		default:
+			break;
 	}
 }
 
-void print_subsys(struct gpu_subsys_serial* subsys)
+void print_subsys(const struct gpu_subsys_serial *subsys)
 {
 	printf("    Type:   ");
 	switch (subsys->gpu_subsys) {
@@ -266,14 +531,13 @@ void print_subsys(struct gpu_subsys_serial* subsys)
 				printf("???\n");
 				break;
 	}
-	printf("    Serial: %s\n", subsys->serial);
+	printf("    Serial: %.*s\n", GPU_SERIAL_LEN, subsys->serial);
 }
 
-void print_gpio(uint8_t block_length, struct gpu_cfg_gpio *block_body) {
-	uint8_t blocks = block_length / sizeof(struct gpu_cfg_gpio);
-	struct gpu_cfg_gpio *block;
-	for (int i = 0; i < blocks; i++) {
-		block = &block_body[i];
+void print_gpio(size_t count, const struct gpu_cfg_gpio *gpios) {
+	for (size_t i = 0; i < count; i++) {
+		const struct gpu_cfg_gpio *block = &gpios[i];
+		uint32_t flags = block->flags;
 		printf("  GPIO %d\n", block->gpio);
 		printf("    Name:        ");
 		switch (block->gpio) {
@@ -381,27 +645,27 @@ void print_gpio(uint8_t block_length, struct gpu_cfg_gpio *block_body) {
 				break;
 		}
 		printf("    Flags:       (");
-		if ((block->flags & GPIO_INPUT) != 0) {
+		if ((flags & GPIO_INPUT) != 0) {
 			printf("Input,");
 		}
-		if ((block->flags & GPIO_OUTPUT) != 0) {
+		if ((flags & GPIO_OUTPUT) != 0) {
 			printf("Output,");
 		}
-		if ((block->flags & GPIO_OUTPUT_INIT_LOW) != 0) {
+		if ((flags & GPIO_OUTPUT_INIT_LOW) != 0) {
 			printf("Low,");
 		}
-		if ((block->flags & GPIO_OUTPUT_INIT_HIGH) != 0) {
+		if ((flags & GPIO_OUTPUT_INIT_HIGH) != 0) {
 			printf("High,");
 		}
-		if ((block->flags & GPIO_OUTPUT_INIT_LOGICAL) != 0) {
+		if ((flags & GPIO_OUTPUT_INIT_LOGICAL) != 0) {
 			printf("Logical,");
 		}
 		printf(")\n");
 		// printf(""BYTE_TO_BINARY_PATTERN BYTE_TO_BINARY_PATTERN BYTE_TO_BINARY_PATTERN BYTE_TO_BINARY_PATTERN"\n",
-		// 	BYTE_TO_BINARY(block->flags),
-		// 	BYTE_TO_BINARY((block->flags >> 8) & 0xFF),
-		// 	BYTE_TO_BINARY((block->flags >> 16) & 0xFF),
-		// 	BYTE_TO_BINARY((block->flags >> 24) & 0xFF)
+		// 	BYTE_TO_BINARY(flags),
+		// 	BYTE_TO_BINARY((flags >> 8) & 0xFF),
+		// 	BYTE_TO_BINARY((flags >> 16) & 0xFF),
+		// 	BYTE_TO_BINARY((flags >> 24) & 0xFF)
 		// 	);
 		
 		printf("    Power Domain:");
@@ -471,7 +735,36 @@ void print_gpio(uint8_t block_length, struct gpu_cfg_gpio *block_body) {
 	}
 }
 
-void print_pd(struct gpu_subsys_pd *pd) {
+void print_gpio_actions(size_t count, const struct gpu_cfg_gpio_actions *states) {
+	for (size_t i = 0; i < count && i < POWER_STEADY_COUNT; i++) {
+		printf("    %-5s assert %08X deassert %08X\n", steady_state_names[i],
+			states[i].assert_mask, states[i].deassert_mask);
+	}
+}
+
+void print_fan_curve(const struct decoded_block *d) {
+	printf("    Fan:         %d\n", d->curve.idx);
+	printf("    Start:       %dK\n", d->curve.temp_start);
+	printf("    Step:        %dK\n", d->curve.temp_step);
+	printf("    RPM:        ");
+	for (int i = 0; i < d->curve.count; i++) {
+		if (i && i % 8 == 0) {
+			printf("\n                ");
+		}
+		printf(" %5d", d->curve.rpm[i]);
+	}
+	printf("\n");
+}
+
+void print_signature(const struct gpu_cfg_signature *sig) {
+	printf("    Key ID:      ");
+	for (size_t i = 0; i < sizeof(sig->key_id); i++) {
+		printf("%02x", sig->key_id[i]);
+	}
+	printf("\n");
+}
+
+void print_pd(const struct gpu_subsys_pd *pd) {
 	printf("    Type:   ");
 	switch (pd->gpu_pd_type) {
 		case PD_TYPE_ETRON_EJ889I:
@@ -514,254 +807,4529 @@ void print_vendor(enum gpu_vendor vendor) {
 }
 
 
-void read_eeprom(const char * infilename)
+static void print_header_event(void *ctx, const uint8_t *descriptor)
 {
-	FILE *fptr;
-	fptr = fopen(infilename,"rb");
-
-	struct gpu_cfg_descriptor descriptor;
-	fread((void *)&descriptor, sizeof(descriptor), 1, fptr);
-
-	print_descriptor(&descriptor);
-
-	void *blocks = malloc(descriptor.descriptor_length);
-	if (!blocks) {
-		fclose(fptr);
-		return;
-	}
-	fread(blocks, descriptor.descriptor_length, 1, fptr);
-	fclose(fptr);
+	print_descriptor(descriptor);
+}
 
-	int offset = 0;
-	int n = 0;
-	struct gpu_block_header *block_header;
-	while (offset < descriptor.descriptor_length) {
-		block_header = (struct gpu_block_header *)(blocks + offset);
-		void *block_body = blocks + offset + sizeof(struct gpu_block_header);
+static void print_block_event(void *ctx, const uint8_t *descriptor,
+	const uint8_t *block_header, const uint8_t *body, uint32_t offset)
+{
+	struct decoded_block d;
 
-		if (verbose) {
-			uint8_t *pcie;
-			struct gpu_cfg_fan *fan;
-			struct gpu_cfg_power *power;
-			struct gpu_cfg_battery *battery;
-			struct gpu_cfg_custom_temp *custom_temp;
-			printf("---\n");
-			// printf("Block %d\n", n);
-			// printf("  Length: %d\n", block_header->block_length);
-			printf("  Type:   ");
-			switch (block_header->block_type) {
-				case GPUCFG_TYPE_UNINITIALIZED:
-					printf("Uninitialized\n");
-					break;
-				case GPUCFG_TYPE_GPIO:
-					printf("GPIO\n");
-					print_gpio(block_header->block_length, (struct gpu_cfg_gpio *)block_body);
-					break;
-				case GPUCFG_TYPE_THERMAL_SENSOR:
-					printf("Thermal Sensor\n");
-					if (*((enum gpu_thermal_sensor *)block_body) == GPU_THERM_F75303) {
-						printf("    F75303\n");
-					} else {
-						printf("    Invalid\n");
-					}
-					break;
-				case GPUCFG_TYPE_FAN:
-					fan = block_body;
-					printf("Fan\n");
-					printf("    ID:        %d\n", fan->idx);
-					printf("    Flags:     %d\n", fan->flags);
-					printf("    Min RPM:   %d\n", fan->min_rpm);
-					printf("    Min Temp:  %d\n", fan->min_temp);
-					printf("    Start RPM: %d\n", fan->start_rpm);
-					printf("    Max RPM:   %d\n", fan->max_rpm);
-					printf("    Max Temp:  %d\n", fan->max_temp);
-					break;
-				case GPUCFG_TYPE_POWER:
-					power = block_body;
-					printf("Power\n");
-					printf("    Device ID:   %d\n", power->device_idx);
-					printf("    Battery:     %d\n", power->battery_power);
-					printf("    Average:     %d\n", power->average_power);
-					printf("    Long Term:   %d\n", power->long_term_power);
-					printf("    Short Term:  %d\n", power->short_term_power);
-					printf("    Peak:        %d\n", power->peak_power);
-					break;
-				case GPUCFG_TYPE_BATTERY:
-					battery = block_body;
-					printf("Battery\n");
-					printf("    Max Current: %d\n", battery->max_current);
-					printf("    Max Voltage: %dmV\n", battery->max_mv);
-					printf("    Min Voltage: %dmV\n", battery->min_mv);
-					printf("    Max Charge I:%d\n", battery->max_charge_current);
+	decode_block(descriptor, block_header, body, &d);
+	if (verbose) {
+		printf("---\n");
+		// printf("Block %d\n", n);
+		// printf("  Length: %d\n", block_length);
+		printf("  Type:   ");
+		switch (d.type) {
+			case GPUCFG_TYPE_UNINITIALIZED:
+				printf("Uninitialized\n");
+				break;
+			case GPUCFG_TYPE_GPIO:
+				printf("GPIO\n");
+				print_gpio(d.gpio.count, d.gpio.entry);
+				break;
+			case GPUCFG_TYPE_THERMAL_SENSOR:
+				printf("Thermal Sensor\n");
+				if (d.short_body) {
 					break;
-				case GPUCFG_TYPE_PCIE:
-					printf("PCI-E\n");
-					pcie = block_body;
-					switch (*pcie) {
-						case PCIE_8X1:
-							printf("    Lanes: 8X1\n");
-							break;
-						case PCIE_4X1:
-							printf("    Lanes: 4X1\n");
-							break;
-						case PCIE_4X2:
-							printf("    Lanes: 4X2\n");
-							break;
-						default:
-							printf("    Invalid (%d)\n", *pcie);
-							break;
-					}
+				}
+				if (d.thermal.thermal_type == GPU_THERM_F75303) {
+					printf("    F75303\n");
+				} else {
+					printf("    Invalid\n");
+				}
+				break;
+			case GPUCFG_TYPE_FAN:
+				printf("Fan\n");
+				if (d.short_body) {
 					break;
-				case GPUCFG_TYPE_DPMUX:
-					printf("DP-MUX\n");
-					// TODO: Decode. Unused so far
+				}
+				printf("    ID:        %d\n", d.fan.idx);
+				printf("    Flags:     %d\n", d.fan.flags);
+				printf("    Min RPM:   %d\n", d.fan.min_rpm);
+				printf("    Min Temp:  %d\n", d.fan.min_temp);
+				printf("    Start RPM: %d\n", d.fan.start_rpm);
+				printf("    Max RPM:   %d\n", d.fan.max_rpm);
+				printf("    Max Temp:  %d\n", d.fan.max_temp);
+				break;
+			case GPUCFG_TYPE_POWER:
+				printf("Power\n");
+				if (d.short_body) {
 					break;
-				case GPUCFG_TYPE_POWEREN:
-					printf("POWER-EN\n");
-					// TODO: Decode. Unused so far
+				}
+				printf("    Device ID:   %d\n", d.power.device_idx);
+				printf("    Battery:     %d\n", d.power.battery_power);
+				printf("    Average:     %d\n", d.power.average_power);
+				printf("    Long Term:   %d\n", d.power.long_term_power);
+				printf("    Short Term:  %d\n", d.power.short_term_power);
+				printf("    Peak:        %d\n", d.power.peak_power);
+				break;
+			case GPUCFG_TYPE_BATTERY:
+				printf("Battery\n");
+				if (d.short_body) {
 					break;
-				case GPUCFG_TYPE_SUBSYS:
-					printf("Subsystem\n");
-					print_subsys((struct gpu_subsys_serial *)block_body);
+				}
+				printf("    Max Current: %d\n", d.battery.max_current);
+				printf("    Max Voltage: %dmV\n", d.battery.max_mv);
+				printf("    Min Voltage: %dmV\n", d.battery.min_mv);
+				printf("    Max Charge I:%d\n", d.battery.max_charge_current);
+				break;
+			case GPUCFG_TYPE_PCIE:
+				printf("PCI-E\n");
+				if (d.short_body) {
 					break;
-				case GPUCFG_TYPE_VENDOR:
-					printf("Vendor\n");
+				}
+				switch (d.value) {
+					case PCIE_8X1:
+						printf("    Lanes: 8X1\n");
+						break;
+					case PCIE_4X1:
+						printf("    Lanes: 4X1\n");
+						break;
+					case PCIE_4X2:
+						printf("    Lanes: 4X2\n");
+						break;
+					default:
+						printf("    Invalid (%d)\n", d.value);
+						break;
+				}
+				break;
+			case GPUCFG_TYPE_DPMUX:
+				printf("DP-MUX\n");
+				// TODO: Decode. Unused so far
+				break;
+			case GPUCFG_TYPE_POWEREN:
+				printf("POWER-EN\n");
+				// TODO: Decode. Unused so far
+				break;
+			case GPUCFG_TYPE_SUBSYS:
+				printf("Subsystem\n");
+				if (!d.short_body) {
+					print_subsys(&d.subsys);
+				}
+				break;
+			case GPUCFG_TYPE_VENDOR:
+				printf("Vendor\n");
+				if (!d.short_body) {
 					printf("  Value:  ");
-					print_vendor(*(enum gpu_vendor *) block_body);
-					break;
-				case GPUCFG_TYPE_PD:
-					printf("PD\n");
-					print_pd((struct gpu_subsys_pd *) block_body);
-					break;
-				case GPUCFG_TYPE_GPUPWR:
-					printf("GPU Power\n");
-					// TODO: Decode. Unused so far
-					break;
-				case GPUCFG_TYPE_CUSTOM_TEMP:
-					custom_temp = block_body;
-					printf("Custom Temp\n");
-					printf("    ID:          %d\n", custom_temp->idx);
-					printf("    Temp Fan Off:%d\n", custom_temp->temp_fan_off);
-					printf("    Temp Fan Max:%d\n", custom_temp->temp_fan_max);
-					break;
-				default:
-					printf("Unknown\n");
+					print_vendor(d.value);
+				}
+				break;
+			case GPUCFG_TYPE_PD:
+				printf("PD\n");
+				if (!d.short_body) {
+					print_pd(&d.pd);
+				}
+				break;
+			case GPUCFG_TYPE_GPUPWR:
+				printf("GPU Power\n");
+				// TODO: Decode. Unused so far
+				break;
+			case GPUCFG_TYPE_CUSTOM_TEMP:
+				printf("Custom Temp\n");
+				if (d.short_body) {
 					break;
-			}
-		} else {
-			if (block_header->block_type == GPUCFG_TYPE_SUBSYS) {
-				struct gpu_subsys_serial *subsys = block_body;
-				if (subsys->gpu_subsys == GPU_PCB) {
-					printf("PCBA Serial: %s\n", subsys->serial);
 				}
-			}
-			if (block_header->block_type == GPUCFG_TYPE_VENDOR) {
-				printf("Type:        ");
-				print_vendor(*(enum gpu_vendor *) block_body);
-			}
+				printf("    ID:          %d\n", d.custom_temp.idx);
+				printf("    Temp Fan Off:%d\n", d.custom_temp.temp_fan_off);
+				printf("    Temp Fan Max:%d\n", d.custom_temp.temp_fan_max);
+				break;
+			case GPUCFG_TYPE_GPIO_ACTIONS:
+				printf("GPIO Actions\n");
+				print_gpio_actions(d.actions.count, d.actions.state);
+				break;
+			case GPUCFG_TYPE_FAN_CURVE:
+				printf("Fan Curve\n");
+				if (!d.short_body) {
+					print_fan_curve(&d);
+				}
+				break;
+			case GPUCFG_TYPE_SIGNATURE:
+				printf("Signature\n");
+				if (!d.short_body) {
+					print_signature(&d.signature);
+				}
+				break;
+			case GPUCFG_TYPE_PADDING:
+				printf("Padding\n");
+				break;
+			default:
+				printf("Unknown\n");
+				break;
+		}
+		if (d.short_body) {
+			printf("    Too short (%d bytes)\n", view_block_block_length(block_header));
+		}
+	} else if (!d.short_body) {
+		if (d.type == GPUCFG_TYPE_SUBSYS && d.subsys.gpu_subsys == GPU_PCB) {
+			printf("PCBA Serial: %.*s\n", GPU_SERIAL_LEN, d.subsys.serial);
+		}
+		if (d.type == GPUCFG_TYPE_VENDOR) {
+			printf("Type:        ");
+			print_vendor(d.value);
 		}
-
-		offset += sizeof(struct gpu_block_header) + block_header->block_length;
-		n++;
 	}
 
-	free(blocks);
 }
 
-void program_eeprom(const char * serial, struct gpu_cfg_descriptor * descriptor, size_t len, const char * outpath)
+/**
+ * Print the header, serials and vendor of a descriptor. Only the descriptor
+ * is read, not the rest of the device. With check_crc the blocks are read
+ * in one go after the header so the descriptor CRC is checked before
+ * anything from them is shown. Without it only the block headers and the
+ * bodies that are printed are read, at the cost of trusting blocks that
+ * were never checked. stats reports what the reader fetched.
+ *
+ * \return 0 on success, -1 if the file is unreadable or the descriptor bad
+ */
+int read_eeprom_summary(const char * infilename, bool check_crc, bool stats)
 {
-	crc_t crc;
-	FILE *fptr;
-	printf("generating EEPROM\n");
-	memset(descriptor->serial, 0x00, GPU_SERIAL_LEN);
-	strncpy(descriptor->serial, serial, GPU_SERIAL_LEN);
+	static struct lazy_reader reader;
+	const uint8_t *descriptor;
+	const char *err = NULL;
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = 0;
 
-	crc = crc_init();
-	crc = crc_update(crc, (uint8_t *)descriptor + sizeof(struct gpu_cfg_descriptor), len - sizeof(struct gpu_cfg_descriptor));
-	descriptor->descriptor_crc32 = crc_finalize(crc);
+	if (lazy_open(&reader, infilename)) {
+		fprintf(stderr, "%s: %s\n", infilename, strerror(errno));
+		return -1;
+	}
 
-	crc = crc_init();
-	crc = crc_update(crc, descriptor, sizeof(struct gpu_cfg_descriptor)-sizeof(uint32_t));
-	descriptor->crc32 = crc_finalize(crc);
+	descriptor = lazy_get(&reader, 0, sizeof(struct gpu_cfg_descriptor));
+	if (!descriptor) {
+		err = "truncated";
+	} else if (memcmp(view_desc_magic(descriptor), descriptor_magic, sizeof(descriptor_magic)) != 0) {
+		err = "bad magic";
+	} else if (view_desc_crc32(descriptor) != descriptor_header_crc(descriptor)) {
+		err = "header CRC mismatch";
+	} else if (view_desc_descriptor_version_major(descriptor) > GPU_CFG_VERSION_MAJOR) {
+		err = "unsupported descriptor version";
+	} else {
+		end = offset + view_desc_descriptor_length(descriptor);
+		/* The cache keeps the descriptor contiguous for the CRC */
+		if (check_crc && !lazy_get(&reader, offset, end - offset)) {
+			err = "truncated";
+		} else if (check_crc && view_desc_descriptor_crc32(descriptor) != descriptor_body_crc(descriptor)) {
+			err = "descriptor CRC mismatch";
+		}
+	}
+	if (!err) {
+		print_header_event(NULL, descriptor);
+	}
 
-	printf("writing EEPROM to %s\n", outpath);
+	/* Cache hits once the descriptor has been read for the CRC */
+	while (!err && offset + sizeof(struct gpu_block_header) <= end) {
+		const uint8_t *block_header = lazy_get(&reader, offset, sizeof(struct gpu_block_header));
+		const uint8_t *body;
+		size_t next;
+		uint8_t type;
 
-	fptr = fopen(outpath,"wb");
-	fwrite(descriptor, len, 1, fptr);
-	fclose(fptr);
+		if (!block_header) {
+			err = "truncated";
+			break;
+		}
+		type = view_block_block_type(block_header);
+		next = offset + sizeof(struct gpu_block_header) + view_block_block_length(block_header);
+		if (next > end) {
+			err = "block runs past the descriptor";
+			break;
+		}
+		/* The only blocks the summary prints, the others are skipped unread */
+		if (type == GPUCFG_TYPE_SUBSYS || type == GPUCFG_TYPE_VENDOR) {
+			body = lazy_get(&reader, offset + sizeof(struct gpu_block_header),
+				view_block_block_length(block_header));
+			if (!body) {
+				err = "truncated";
+				break;
+			}
+			print_block_event(NULL, descriptor, block_header, body, offset);
+		}
+		offset = next;
+	}
+	lazy_close(&reader);
 
+	if (stats) {
+		fprintf(stderr, "%s: read %zu bytes in %zu reads\n", infilename, reader.bytes_read, reader.reads);
+	}
+	if (err) {
+		fprintf(stderr, "%s: %s at offset %zu\n", infilename, err, offset);
+		return -1;
+	}
+	return 0;
 }
 
-int main(int argc, char *argv[]) {
-	int gpuflag = 0;
-	int ssdflag = 0;
-	char *serialvalue = NULL;
-	char *pcbvalue = NULL;
-	char *outfilename = "eeprom.bin";
-	char *infilename = NULL;
-	int c;
+/*
+ * Read in page sized chunks so a slow source (an EEPROM node or a fixture)
+ * is decoded while it is still being read, and a bad card is reported at
+ * the first bad header or block.
+ */
+#define READ_CHUNK_LEN 32
 
-	opterr = 0;
+/**
+ * Decode and print every block of a descriptor while it is being read.
+ *
+ * \return 0 on success, -1 if the file is unreadable or the descriptor bad
+ */
+int read_eeprom(const char * infilename)
+{
+	static const struct parser_callbacks callbacks = {
+		.header = print_header_event,
+		.block = print_block_event,
+	};
+	struct stream_parser parser;
+	uint8_t chunk[READ_CHUNK_LEN];
+	const char *err;
+	size_t n;
+	FILE *fptr;
 
-	while ((c = getopt (argc, argv, "gdvs:p:o:i:")) != -1)
-	switch (c)
-	{
-	case 'g':
-		gpuflag = 1;
-		break;
-	case 'd':
-		ssdflag = 1;
-		break;
-	case 's':
-		serialvalue = optarg;
-		break;
-	case 'p':
-		pcbvalue = optarg;
-		break;
-	case 'o':
-		outfilename = optarg;
-		break;
-	case 'i':
-		infilename = optarg;
-		break;
-	case 'v':
-		verbose = true;
-		break;
-	case '?':
-		if (optopt == 'c')
-			fprintf (stderr, "Option -%c requires an argument.\n", optopt);
-		else if (isprint (optopt))
-			fprintf (stderr, "Unknown option `-%c'.\n", optopt);
-		else
-			fprintf (stderr,
-				"Unknown option character `\\x%x'.\n",
-				optopt);
-		return 1;
-	default:
-		abort ();
+	fptr = fopen(infilename,"rb");
+	if (!fptr) {
+		fprintf(stderr, "%s: %s\n", infilename, strerror(errno));
+		return -1;
 	}
-	printf("Build: %s %s\n", __DATE__, __TIME__);
 
-	if (infilename) {
-		read_eeprom(infilename);
-		return 0;
+	parser_init(&parser, &callbacks, NULL);
+	while ((n = fread(chunk, 1, sizeof(chunk), fptr)) > 0) {
+		if (parser_feed(&parser, chunk, n) >= PARSER_DONE) {
+			break;
+		}
 	}
+	fclose(fptr);
 
-	printf("Descriptor Version: %d %d\n", 0, 1);
+	err = parser_finish(&parser);
+	if (err) {
+		fprintf(stderr, "%s: %s at offset %u\n", infilename, err, parser.offset);
+		return -1;
+	}
+	return 0;
+}
 
-	printf ("gpu = %d, ssd = %d, module SN = %s pcb SN = %s output file = %s\n",
-		gpuflag, ssdflag, serialvalue, pcbvalue, outfilename);
+/* xorshift32, the state must not be 0 */
+static inline uint32_t fuzz_rand(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
 
-	if (gpuflag) {
-		if (pcbvalue) {
-			strncpy(gpu_cfg.pcba_serial.serial, pcbvalue, GPU_SERIAL_LEN);
-		}
-		program_eeprom(serialvalue, (void *)&gpu_cfg, sizeof(gpu_cfg), outfilename);
-	}
+/*
+ * read_eeprom's decoding into struct ec_config, to test it against the
+ * reference consumer: the same stream parser, fed in random chunks, and the
+ * same decode_block() the printers show. Only what the EC keeps of the
+ * decoded blocks, by index and with the extra action states dropped, is
+ * added here.
+ */
+static void decode_header_event(void *ctx, const uint8_t *descriptor)
+{
+	struct ec_config *cfg = ctx;
 
-	if (ssdflag) {
-		program_eeprom(serialvalue, (void *)&ssd_cfg, sizeof(ssd_cfg), outfilename);
+	memcpy(&cfg->header, descriptor, sizeof(cfg->header));
+}
+
+static void decode_block_event(void *ctx, const uint8_t *descriptor,
+	const uint8_t *block_header, const uint8_t *body, uint32_t offset)
+{
+	struct ec_config *cfg = ctx;
+	struct decoded_block d;
+	int slot;
+
+	decode_block(descriptor, block_header, body, &d);
+	slot = ec_slot(d.type);
+	cfg->blocks[slot]++;
+	if (d.short_body) {
+		cfg->skipped[slot]++;
+		return;
 	}
+	switch (d.type) {
+		case GPUCFG_TYPE_GPIO:
+			for (size_t i = 0; i < d.gpio.count; i++) {
+				uint8_t gpio = d.gpio.entry[i].gpio;
 
-	return 0;
+				if (gpio == GPU_GPIO_INVALID || gpio >= GPU_GPIO_MAX) {
+					cfg->skipped[slot]++;
+					continue;
+				}
+				cfg->gpios[gpio] = d.gpio.entry[i];
+				cfg->gpio_set |= 1U << gpio;
+			}
+			if (d.partial) {
+				cfg->skipped[slot]++;
+			}
+			break;
+		case GPUCFG_TYPE_THERMAL_SENSOR:
+			cfg->thermal = d.thermal;
+			cfg->has_thermal = true;
+			break;
+		case GPUCFG_TYPE_FAN:
+			if (d.fan.idx >= EC_MAX_FANS) {
+				cfg->skipped[slot]++;
+				break;
+			}
+			cfg->fans[d.fan.idx] = d.fan;
+			cfg->fan_set |= 1 << d.fan.idx;
+			break;
+		case GPUCFG_TYPE_CUSTOM_TEMP:
+			if (d.custom_temp.idx >= EC_MAX_FANS) {
+				cfg->skipped[slot]++;
+				break;
+			}
+			cfg->custom_temps[d.custom_temp.idx] = d.custom_temp;
+			cfg->custom_temp_set |= 1 << d.custom_temp.idx;
+			break;
+		case GPUCFG_TYPE_FAN_CURVE: {
+			struct ec_fan_curve *curve;
+
+			if (d.curve.idx >= EC_MAX_FANS) {
+				cfg->skipped[slot]++;
+				break;
+			}
+			curve = &cfg->curves[d.curve.idx];
+			memset(curve, 0, sizeof(*curve));
+			curve->temp_start = d.curve.temp_start;
+			curve->temp_step = d.curve.temp_step;
+			curve->count = d.curve.count;
+			memcpy(curve->rpm, d.curve.rpm, d.curve.count * sizeof(uint16_t));
+			cfg->curve_set |= 1 << d.curve.idx;
+			break;
+		}
+		case GPUCFG_TYPE_POWER:
+			cfg->power = d.power;
+			cfg->has_power = true;
+			break;
+		case GPUCFG_TYPE_BATTERY:
+			cfg->battery = d.battery;
+			cfg->has_battery = true;
+			break;
+		case GPUCFG_TYPE_PD:
+			cfg->pd = d.pd;
+			cfg->has_pd = true;
+			break;
+		case GPUCFG_TYPE_PCIE:
+			cfg->pcie = d.value;
+			break;
+		case GPUCFG_TYPE_VENDOR:
+			cfg->vendor = d.value;
+			break;
+		case GPUCFG_TYPE_SUBSYS:
+			if (d.subsys.gpu_subsys >= GPU_SUBSYS_MAX) {
+				cfg->skipped[slot]++;
+				break;
+			}
+			memcpy(cfg->subsys_serials[d.subsys.gpu_subsys], d.subsys.serial, GPU_SERIAL_LEN);
+			cfg->subsys_set |= 1 << d.subsys.gpu_subsys;
+			break;
+		case GPUCFG_TYPE_GPIO_ACTIONS: {
+			size_t states = d.actions.count;
+
+			if (states > EC_MAX_ACTION_STATES || d.partial) {
+				cfg->skipped[slot]++;
+			}
+			if (states > EC_MAX_ACTION_STATES) {
+				states = EC_MAX_ACTION_STATES;
+			}
+			memset(cfg->actions, 0, sizeof(cfg->actions));
+			memcpy(cfg->actions, d.actions.state, states * sizeof(struct gpu_cfg_gpio_actions));
+			cfg->action_states = states;
+			break;
+		}
+		case GPUCFG_TYPE_SIGNATURE:
+			memcpy(cfg->key_id, d.signature.key_id, sizeof(cfg->key_id));
+			cfg->has_signature = true;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Decode an image with read_eeprom's parser, fed in chunks of random size.
+ *
+ * \return NULL if the image was accepted, otherwise the parser's error
+ */
+static const char *decode_image(const uint8_t *image, size_t len, uint32_t *rng, struct ec_config *cfg)
+{
+	static const struct parser_callbacks callbacks = {
+		.header = decode_header_event,
+		.block = decode_block_event,
+	};
+	struct stream_parser parser;
+	size_t offset = 0;
+
+	ec_config_init(cfg);
+	parser_init(&parser, &callbacks, cfg);
+	while (offset < len) {
+		size_t n = 1 + fuzz_rand(rng) % (2 * READ_CHUNK_LEN);
+
+		if (n > len - offset) {
+			n = len - offset;
+		}
+		if (parser_feed(&parser, image + offset, n) >= PARSER_DONE) {
+			break;
+		}
+		offset += n;
+	}
+	return parser_finish(&parser);
+}
+
+/*
+ * Framework serials are 18 characters: "FRA", a 5 letter SKU code, then
+ * 10 uppercase alphanumerics. Validation looks every character up in a
+ * class table and ANDs the results together, so a row is checked without
+ * a data dependent branch per character.
+ */
+#define SERIAL_LEN 18
+#define SERIAL_PREFIX "FRA"
+#define SERIAL_SKU_END 8
+
+#define SERIAL_ALNUM (1 << 0)
+#define SERIAL_ALPHA (1 << 1)
+
+static const uint8_t serial_class[256] = {
+	['0' ... '9'] = SERIAL_ALNUM,
+	['A' ... 'Z'] = SERIAL_ALNUM | SERIAL_ALPHA,
+};
+
+/**
+ * Check a serial against the Framework serial format.
+ *
+ * \return NULL if valid, otherwise a description of the problem
+ */
+const char *validate_serial(const char *serial)
+{
+	uint8_t sku = 0xFF;
+	uint8_t rest = 0xFF;
+	size_t len;
+
+	if (!serial)
+		return "missing";
+	len = strnlen(serial, GPU_SERIAL_LEN + 1);
+	if (len != SERIAL_LEN)
+		return "must be 18 characters";
+	if (memcmp(serial, SERIAL_PREFIX, strlen(SERIAL_PREFIX)) != 0)
+		return "must start with " SERIAL_PREFIX;
+	for (size_t i = strlen(SERIAL_PREFIX); i < SERIAL_SKU_END; i++)
+		sku &= serial_class[(uint8_t)serial[i]];
+	for (size_t i = SERIAL_SKU_END; i < SERIAL_LEN; i++)
+		rest &= serial_class[(uint8_t)serial[i]];
+	if (!(sku & SERIAL_ALPHA))
+		return "SKU code after " SERIAL_PREFIX " must be uppercase letters";
+	if (!(rest & SERIAL_ALNUM))
+		return "may only contain 0-9 and A-Z";
+	return NULL;
+}
+
+/**
+ * Parse the text value of a field. Serial fields are checked and kept as text.
+ *
+ * \return NULL if valid, otherwise a description of the problem
+ */
+static const char *parse_field_value(const struct cfg_field *field, const char *text, uint32_t *value)
+{
+	unsigned long long v;
+	char *end;
+
+	if (field->kind == FIELD_STRING)
+		return validate_serial(text);
+	/* strtoull would skip blanks and accept a sign, negating the value */
+	if (!isdigit((unsigned char)*text))
+		return "is not a number";
+	errno = 0;
+	v = strtoull(text, &end, 0);
+	if (*end != '\0')
+		return "is not a number";
+	if (errno == ERANGE || v >> (8 * field->width))
+		return "does not fit in the field";
+	*value = v;
+	return NULL;
+}
+
+/**
+ * Pick the profile for a module serial by its SKU prefix. forced is the
+ * profile given with -g or -d, if any, and has to agree with it.
+ *
+ * \return NULL if a profile was found, otherwise a description of the problem
+ */
+static const char *select_profile(const char *serial, const struct sku_profile *forced,
+				  const struct sku_profile **profile)
+{
+	static __thread char err[64];
+
+	*profile = sku_lookup(&skus, serial, GPU_SERIAL_LEN);
+	if (!*profile)
+		return "has no registered SKU prefix";
+	if (forced && *profile != forced) {
+		snprintf(err, sizeof(err), "belongs to the %s profile, not %s", (*profile)->name, forced->name);
+		return err;
+	}
+	return NULL;
+}
+
+/**
+ * Check a PCB serial against the format and the PCB prefix of the profile.
+ *
+ * \return NULL if valid, otherwise a description of the problem
+ */
+static const char *validate_pcb_serial(const struct sku_profile *profile, const char *pcb)
+{
+	static __thread char err[64];
+	const char *format = validate_serial(pcb);
+
+	if (format)
+		return format;
+	if (strncmp(pcb, profile->pcb, strlen(profile->pcb)) != 0) {
+		snprintf(err, sizeof(err), "must start with %s for the %s profile", profile->pcb, profile->name);
+		return err;
+	}
+	return NULL;
+}
+
+#define MANIFEST_LINE_LEN 1024
+#define MANIFEST_MAX_OVERRIDES 32
+#define MANIFEST_MAX_COLUMNS (2 + MANIFEST_MAX_OVERRIDES)
+
+/* A manifest column that overrides one template field per row */
+struct manifest_override {
+	const struct cfg_field *field;
+	int index;
+	int column;
+};
+
+/*
+ * Column layout of a manifest. Without a header row a manifest is
+ * "module serial[,pcb serial]"; a header row starting with "serial" names
+ * the columns, where "pcb" is the PCB serial and every other column a
+ * field path like "fan[0].max_rpm".
+ */
+struct manifest_layout {
+	int ncolumns;
+	/* Column of the PCB serial, -1 if there is none */
+	int pcb;
+	struct manifest_override overrides[MANIFEST_MAX_OVERRIDES];
+	int noverrides;
+};
+
+/* Template of one profile, as generated for a batch */
+struct profile_template {
+	const struct sku_profile *profile;
+	uint8_t image[IMAGE_MAX_LEN];
+	/* 0 if the batch does not use the profile */
+	size_t len;
+	long pcb_serial;
+	/* Where each override sits in image, -1 if the template lacks it */
+	long offsets[MANIFEST_MAX_OVERRIDES];
+};
+
+/*
+ * Everything needed to build the image of any manifest row: the manifest
+ * layout and one template per profile, indexed like sku_profiles. Rows are
+ * dispatched by serial prefix, so one manifest may mix SKUs.
+ */
+struct batch_profiles {
+	/* From -g or -d, NULL to go by serial alone */
+	const struct sku_profile *forced;
+	struct manifest_layout layout;
+	struct profile_template templates[SKU_MAX_PROFILES];
+	size_t max_len;
+};
+
+/**
+ * Find the template for a module serial.
+ *
+ * \return NULL if found, otherwise a description of the problem
+ */
+static const char *row_template(const struct batch_profiles *batch, const char *serial,
+				const struct profile_template **tpl)
+{
+	const struct sku_profile *profile;
+	const char *err = select_profile(serial, batch->forced, &profile);
+
+	if (err)
+		return err;
+	*tpl = &batch->templates[profile - skus.profiles];
+	return NULL;
+}
+
+/**
+ * Split a manifest line into its comma separated columns in place. At most
+ * max columns are stored, but all of them are counted.
+ *
+ * \return number of columns, 0 for blank lines and comments
+ */
+static int split_manifest_line(char *line, char **cols, int max)
+{
+	int n = 0;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	if (line[0] == '\0' || line[0] == '#')
+		return 0;
+	for (;;) {
+		if (n < max)
+			cols[n] = line;
+		n++;
+		line = strchr(line, ',');
+		if (!line)
+			return n;
+		*line++ = '\0';
+	}
+}
+
+static inline bool is_manifest_header(char **cols)
+{
+	return strcmp(cols[0], "serial") == 0;
+}
+
+/**
+ * Parse the header row of a manifest.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int manifest_resolve(struct manifest_layout *layout, char **cols, int n, const char *manifest)
+{
+	if (n > MANIFEST_MAX_COLUMNS) {
+		fprintf(stderr, "%s: at most %d override columns are supported\n", manifest, MANIFEST_MAX_OVERRIDES);
+		return -1;
+	}
+	layout->ncolumns = n;
+	layout->pcb = -1;
+	layout->noverrides = 0;
+	for (int i = 1; i < n; i++) {
+		struct manifest_override *o = &layout->overrides[layout->noverrides];
+		struct field_ref ref;
+
+		if (strcmp(cols[i], "pcb") == 0 && layout->pcb < 0) {
+			layout->pcb = i;
+			continue;
+		}
+		if (parse_field_ref(cols[i], &ref)) {
+			fprintf(stderr, "%s: unknown column '%s', expected block[index].field\n", manifest, cols[i]);
+			return -1;
+		}
+		/* The serial and version are set per unit and by the encoding */
+		if (ref.field->block->header && ref.field->offset != offsetof(struct gpu_cfg_descriptor, hardware_version) &&
+				ref.field->offset != offsetof(struct gpu_cfg_descriptor, hardware_revision)) {
+			fprintf(stderr, "%s: column '%s' cannot be overridden\n", manifest, cols[i]);
+			return -1;
+		}
+		o->field = ref.field;
+		o->index = ref.index;
+		o->column = i;
+		layout->noverrides++;
+	}
+	return 0;
+}
+
+/**
+ * Locate the override columns in a template, so that each row only has to
+ * store the values at known offsets.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int manifest_offsets(const struct manifest_layout *layout, struct profile_template *tpl,
+			    const char *manifest)
+{
+	struct block_index idx;
+
+	block_index_build(&idx, tpl->image, tpl->len);
+	for (int i = 0; i < layout->noverrides; i++) {
+		const struct manifest_override *o = &layout->overrides[i];
+		long offset;
+
+		/* Packed in 0.2, the schema only describes the 0.1 layout */
+		if (is_compact(tpl->image) &&
+				(o->field->block->block_type == GPUCFG_TYPE_GPIO ||
+				 o->field->block->block_type == GPUCFG_TYPE_THERMAL_SENSOR)) {
+			fprintf(stderr, "%s: %s fields cannot be overridden in a 0.%d image\n", manifest,
+				o->field->block->name, GPU_CFG_VERSION_MINOR_COMPACT);
+			return -1;
+		}
+		offset = block_index_find(&idx, o->field->block, o->index);
+		tpl->offsets[i] = offset < 0 ? -1 : offset + o->field->offset;
+	}
+	return 0;
+}
+
+/**
+ * Split a manifest row and pick out the module and PCB serial.
+ *
+ * \return number of columns, 0 for blank lines, comments and the header row
+ */
+static int parse_manifest_row(char *line, const struct manifest_layout *layout, char **cols,
+			      char **serial, char **pcb)
+{
+	int n = split_manifest_line(line, cols, MANIFEST_MAX_COLUMNS);
+
+	if (n == 0 || is_manifest_header(cols))
+		return 0;
+	*serial = cols[0];
+	*pcb = layout->pcb >= 0 && layout->pcb < n ? cols[layout->pcb] : NULL;
+	return n;
+}
+
+/**
+ * Store the override values of a row into an image built from the template.
+ * Empty cells keep the template value.
+ */
+static void apply_manifest_row(const struct manifest_layout *layout, const struct profile_template *tpl,
+			       char **cols, int n, uint8_t *image)
+{
+	for (int i = 0; i < layout->noverrides; i++) {
+		const struct manifest_override *o = &layout->overrides[i];
+		const char *text = o->column < n ? cols[o->column] : "";
+		uint8_t *field = image + tpl->offsets[i];
+		uint32_t value;
+
+		if (*text == '\0')
+			continue;
+		if (o->field->kind == FIELD_STRING) {
+			memset(field, 0x00, o->field->width);
+			strncpy((char *)field, text, o->field->width);
+		} else {
+			/* Checked by validate_manifest */
+			parse_field_value(o->field, text, &value);
+			field_store(field, o->field->width, value);
+		}
+	}
+}
+
+/**
+ * Validate every row of a manifest, reporting each bad row.
+ *
+ * \return number of bad rows
+ */
+static int validate_manifest(FILE *fptr, const char *manifest, const struct batch_profiles *batch)
+{
+	const struct manifest_layout *layout = &batch->layout;
+	char line[MANIFEST_LINE_LEN];
+	char *cols[MANIFEST_MAX_COLUMNS];
+	int lineno = 0;
+	int bad = 0;
+
+	while (fgets(line, sizeof(line), fptr)) {
+		const struct profile_template *tpl;
+		char *serial, *pcb;
+		const char *err;
+		int n;
+
+		lineno++;
+		n = parse_manifest_row(line, layout, cols, &serial, &pcb);
+		if (!n)
+			continue;
+		if (n > layout->ncolumns) {
+			fprintf(stderr, "%s:%d: %d columns, expected at most %d\n", manifest, lineno, n, layout->ncolumns);
+			bad++;
+			continue;
+		}
+		err = validate_serial(serial);
+		if (!err)
+			err = row_template(batch, serial, &tpl);
+		if (err) {
+			fprintf(stderr, "%s:%d: module serial '%s' %s\n", manifest, lineno, serial, err);
+			bad++;
+			continue;
+		}
+		if (tpl->profile->pcb && pcb && *pcb) {
+			err = validate_pcb_serial(tpl->profile, pcb);
+			if (err) {
+				fprintf(stderr, "%s:%d: PCB serial '%s' %s\n", manifest, lineno, pcb, err);
+				bad++;
+			}
+		}
+		for (int i = 0; i < layout->noverrides; i++) {
+			const struct manifest_override *o = &layout->overrides[i];
+			uint32_t value;
+
+			if (o->column >= n || cols[o->column][0] == '\0')
+				continue;
+			if (tpl->offsets[i] < 0) {
+				fprintf(stderr, "%s:%d: %s profile has no %s[%d]\n", manifest, lineno,
+					tpl->profile->name, o->field->block->name, o->index);
+				bad++;
+				continue;
+			}
+			err = parse_field_value(o->field, cols[o->column], &value);
+			if (err) {
+				fprintf(stderr, "%s:%d: %s[%d].%s '%s' %s\n", manifest, lineno, o->field->block->name,
+					o->index, o->field->name, cols[o->column], err);
+				bad++;
+			}
+		}
+	}
+	return bad;
+}
+
+/**
+ * Check magic, lengths and both CRCs of a complete image.
+ *
+ * \return NULL if the image is intact, otherwise a description of the problem
+ */
+static const char *check_image(const uint8_t *image, size_t len)
+{
+	if (len < sizeof(struct gpu_cfg_descriptor))
+		return "too short for a descriptor";
+	if (memcmp(view_desc_magic(image), descriptor_magic, sizeof(descriptor_magic)) != 0)
+		return "bad magic";
+	if (view_desc_crc32(image) != descriptor_header_crc(image))
+		return "header CRC mismatch";
+	if (view_desc_descriptor_length(image) > len - sizeof(struct gpu_cfg_descriptor))
+		return "truncated";
+	if (view_desc_descriptor_crc32(image) != descriptor_body_crc(image))
+		return "descriptor CRC mismatch";
+	return NULL;
+}
+
+/**
+ * Append a block to the end of an image and update descriptor_length.
+ *
+ * \return new length of the image, 0 if it does not fit in cap
+ */
+static size_t append_block(uint8_t *image, size_t len, size_t cap, uint8_t type, const void *body, uint8_t body_len)
+{
+	if (len + sizeof(struct gpu_block_header) + body_len > cap) {
+		return 0;
+	}
+	view_block_set_block_type(image + len, type);
+	view_block_set_block_length(image + len, body_len);
+	memcpy(image + len + sizeof(struct gpu_block_header), body, body_len);
+	len += sizeof(struct gpu_block_header) + body_len;
+	view_desc_set_descriptor_length(image, len - sizeof(struct gpu_cfg_descriptor));
+	return len;
+}
+
+#define MAX_GPIO_ENTRIES 32
+
+/**
+ * Collect the GPIO entries of a 0.1 layout image.
+ *
+ * \return number of entries
+ */
+static int image_gpios(const uint8_t *image, size_t len, struct gpu_cfg_gpio *entries)
+{
+	struct block_index idx;
+	int n = 0;
+	long offset;
+
+	block_index_build(&idx, image, len);
+	while (n < MAX_GPIO_ENTRIES && (offset = block_index_find(&idx, &cfg_blocks[BLK_GPIO], n)) >= 0) {
+		memcpy(&entries[n++], image + offset, sizeof(struct gpu_cfg_gpio));
+	}
+	return n;
+}
+
+/*
+ * Outputs whose level only depends on the power state. ACDC and the mux
+ * selects are driven by the EC at runtime and are left out of the tables.
+ */
+static bool gpio_static_output(const struct gpu_cfg_gpio *entry)
+{
+	if (!(entry->flags & GPIO_OUTPUT) || entry->gpio >= 32) {
+		return false;
+	}
+	switch (entry->function) {
+		case GPIO_FUNC_ACDC:
+		case GPIO_FUNC_EDP_MUX_SEL:
+		case GPIO_FUNC_TEMPFAULT:
+		case GPIO_FUNC_HPD:
+		case GPIO_FUNC_PD_INT:
+			return false;
+		default:
+			return true;
+	}
+}
+
+/*
+ * Steady states from the deepest up. S0ix is a sleep state of S0, so it
+ * ranks between S3 and S0 although it comes last in enum power_state.
+ */
+static const uint8_t power_state_depth[POWER_STEADY_COUNT] = {
+	[POWER_G3] = 0,
+	[POWER_S5] = 1,
+	[POWER_S4] = 2,
+	[POWER_S3] = 3,
+#if CONFIG_AP_PWRSEQ_S0IX
+	[POWER_S0ix] = 4,
+	[POWER_S0] = 5,
+#else
+	[POWER_S0] = 4,
+#endif
+};
+
+/*
+ * Per-entry semantics: an output is driven high when the system is at or
+ * above its power domain, and low below it. Unused outputs, and outputs
+ * whose domain is not a steady state, stay low.
+ */
+static bool gpio_level(const struct gpu_cfg_gpio *entry, int state)
+{
+	return entry->function != GPIO_FUNC_UNUSED && entry->power_domain < POWER_STEADY_COUNT &&
+		power_state_depth[state] >= power_state_depth[entry->power_domain];
+}
+
+void build_gpio_actions(const struct gpu_cfg_gpio *entries, int n, struct gpu_cfg_gpio_actions *actions)
+{
+	memset(actions, 0, POWER_STEADY_COUNT * sizeof(*actions));
+	for (int state = 0; state < POWER_STEADY_COUNT; state++) {
+		for (int i = 0; i < n; i++) {
+			if (!gpio_static_output(&entries[i])) {
+				continue;
+			}
+			if (gpio_level(&entries[i], state)) {
+				actions[state].assert_mask |= 1U << entries[i].gpio;
+			} else {
+				actions[state].deassert_mask |= 1U << entries[i].gpio;
+			}
+		}
+	}
+}
+
+/**
+ * Append a GPIO action block computed from the image's GPIO block.
+ *
+ * \return new length of the image, 0 on error
+ */
+static size_t add_gpio_actions(uint8_t *image, size_t len, size_t cap)
+{
+	struct gpu_cfg_gpio entries[MAX_GPIO_ENTRIES];
+	struct gpu_cfg_gpio_actions actions[POWER_STEADY_COUNT];
+	int n = image_gpios(image, len, entries);
+
+	build_gpio_actions(entries, n, actions);
+	return append_block(image, len, cap, GPUCFG_TYPE_GPIO_ACTIONS, actions, sizeof(actions));
+}
+
+/*
+ * The verifiers below read the raw block chain and apply the documented
+ * policy themselves, sharing no code with the builders, so that a mistake
+ * in a builder shows up as a mismatch instead of being repeated.
+ */
+
+/**
+ * Find the n-th element of size bytes among the blocks of a type, counting
+ * across blocks in chain order.
+ *
+ * \return pointer to the element, NULL if there is none
+ */
+static const uint8_t *raw_element(const uint8_t *image, size_t len, uint8_t type, size_t size, int n)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+
+	if (end > len) {
+		end = len;
+	}
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		uint8_t blen = view_block_block_length(image + offset);
+		const uint8_t *body = image + offset + sizeof(struct gpu_block_header);
+
+		if (body + blen > image + end) {
+			return NULL;
+		}
+		if (view_block_block_type(image + offset) == type) {
+			if (n < (int)(blen / size)) {
+				return body + n * size;
+			}
+			n -= blen / size;
+		}
+		offset += sizeof(struct gpu_block_header) + blen;
+	}
+	return NULL;
+}
+
+/*
+ * The simulator's own reading of the GPIO action semantics, in the order
+ * the EC ranks the steady states, and the functions whose level is decided
+ * at runtime rather than by the power state.
+ */
+static const uint8_t sim_state_order[] = {
+	POWER_G3, POWER_S5, POWER_S4, POWER_S3,
+#if CONFIG_AP_PWRSEQ_S0IX
+	POWER_S0ix,
+#endif
+	POWER_S0,
+};
+
+static const uint8_t sim_runtime_functions[] = {
+	GPIO_FUNC_ACDC, GPIO_FUNC_EDP_MUX_SEL, GPIO_FUNC_TEMPFAULT, GPIO_FUNC_HPD, GPIO_FUNC_PD_INT,
+};
+
+static int sim_state_rank(uint8_t state)
+{
+	for (size_t i = 0; i < sizeof(sim_state_order); i++) {
+		if (sim_state_order[i] == state) {
+			return i;
+		}
+	}
+	/* Not a steady state, never reached */
+	return sizeof(sim_state_order);
+}
+
+/* Whether the power state decides the level of a raw GPIO entry */
+static bool sim_static_output(const uint8_t *entry)
+{
+	if (!(view_gpio_flags(entry) & GPIO_OUTPUT) || view_gpio_gpio(entry) >= 32) {
+		return false;
+	}
+	return !memchr(sim_runtime_functions, view_gpio_function(entry), sizeof(sim_runtime_functions));
+}
+
+/* The levels of the static outputs in a steady state, one bit per GPIO */
+static uint32_t sim_levels(const uint8_t *image, size_t len, uint8_t state)
+{
+	const uint8_t *entry;
+	uint32_t levels = 0;
+
+	for (int i = 0; (entry = raw_element(image, len, GPUCFG_TYPE_GPIO, sizeof(struct gpu_cfg_gpio), i)); i++) {
+		if (sim_static_output(entry) && view_gpio_function(entry) != GPIO_FUNC_UNUSED &&
+				sim_state_rank(state) >= sim_state_rank(view_gpio_power_domain(entry))) {
+			levels |= 1U << view_gpio_gpio(entry);
+		}
+	}
+	return levels;
+}
+
+/**
+ * Replay every transition between steady states against an image's GPIO
+ * action table: start from the levels of the source state, apply the
+ * target state's masks and compare with the levels of the target state.
+ * Expected levels come from the raw GPIO entries, see sim_levels().
+ *
+ * \return number of mismatches, -1 if the image has no action table
+ */
+static int simulate_gpio_actions(const char *path, const uint8_t *image, size_t len)
+{
+	const size_t size = sizeof(struct gpu_cfg_gpio_actions);
+	uint32_t assert_mask[POWER_STEADY_COUNT], deassert_mask[POWER_STEADY_COUNT];
+	uint32_t controlled = 0;
+	const uint8_t *entry;
+	int mismatches = 0;
+
+	for (int state = 0; state < POWER_STEADY_COUNT; state++) {
+		entry = raw_element(image, len, GPUCFG_TYPE_GPIO_ACTIONS, size, state);
+		if (!entry) {
+			fprintf(stderr, "%s: no GPIO action entry for %s\n", path, steady_state_names[state]);
+			return -1;
+		}
+		assert_mask[state] = view_gpio_actions_assert_mask(entry);
+		deassert_mask[state] = view_gpio_actions_deassert_mask(entry);
+	}
+	if (raw_element(image, len, GPUCFG_TYPE_GPIO_ACTIONS, size, POWER_STEADY_COUNT)) {
+		printf("%s: more GPIO action entries than steady states\n", path);
+		mismatches++;
+	}
+	for (int i = 0; (entry = raw_element(image, len, GPUCFG_TYPE_GPIO, sizeof(struct gpu_cfg_gpio), i)); i++) {
+		if (sim_static_output(entry)) {
+			controlled |= 1U << view_gpio_gpio(entry);
+		}
+	}
+
+	for (int state = 0; state < POWER_STEADY_COUNT; state++) {
+		uint32_t touched = assert_mask[state] | deassert_mask[state];
+		if (assert_mask[state] & deassert_mask[state]) {
+			printf("%s: %s asserts and deasserts %08X\n", path, steady_state_names[state],
+				assert_mask[state] & deassert_mask[state]);
+			mismatches++;
+		}
+		if (touched & ~controlled) {
+			printf("%s: %s drives GPIOs that are not static outputs: %08X\n", path,
+				steady_state_names[state], touched & ~controlled);
+			mismatches++;
+		}
+	}
+
+	for (int from = 0; from < POWER_STEADY_COUNT; from++) {
+		for (int to = 0; to < POWER_STEADY_COUNT; to++) {
+			uint32_t levels = (sim_levels(image, len, from) | assert_mask[to]) & ~deassert_mask[to];
+			uint32_t wrong = (levels ^ sim_levels(image, len, to)) & controlled;
+
+			if (wrong) {
+				printf("%s: %s -> %s leaves GPIOs %08X wrong\n", path, steady_state_names[from],
+					steady_state_names[to], wrong);
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
+
+#define FAN_CURVE_MAX_POINTS \
+	((GPU_MAX_BLOCK_LEN - 1 - sizeof(struct gpu_cfg_fan_curve)) / sizeof(uint16_t))
+/* Fans an image may have curves generated for, fan indexes are one byte */
+#define FAN_CURVE_MAX_FANS 8
+
+/*
+ * Analytic fan policy: off below temp_off, then linear from min_rpm at
+ * temp_off up to max_rpm at temp_max, and max_rpm above that. Temperatures
+ * are in Kelvin. start_rpm is the spin-up kick and not part of the curve.
+ */
+static uint16_t fan_curve_rpm(const struct gpu_cfg_fan *fan, uint16_t temp_off, uint16_t temp_max, int temp_k)
+{
+	if (temp_k < temp_off) {
+		return 0;
+	}
+	if (temp_k >= temp_max) {
+		return fan->max_rpm;
+	}
+	return fan->min_rpm + (int32_t)(fan->max_rpm - fan->min_rpm) * (temp_k - temp_off) / (temp_max - temp_off);
+}
+
+/**
+ * Thresholds for a fan: its own min/max temperature if set, otherwise
+ * the custom temperature block.
+ *
+ * \return false if the image has neither
+ */
+static bool fan_curve_limits(const uint8_t *image, const struct block_index *idx, const struct gpu_cfg_fan *fan,
+		uint16_t *temp_off, uint16_t *temp_max)
+{
+	struct gpu_cfg_custom_temp custom_temp;
+	long offset;
+
+	if (fan->min_temp && fan->max_temp > fan->min_temp) {
+		*temp_off = fan->min_temp;
+		*temp_max = fan->max_temp;
+		return true;
+	}
+	offset = block_index_find(idx, &cfg_blocks[BLK_CUSTOM_TEMP], 0);
+	if (offset < 0) {
+		return false;
+	}
+	memcpy(&custom_temp, image + offset, sizeof(custom_temp));
+	if (custom_temp.temp_fan_max <= custom_temp.temp_fan_off) {
+		return false;
+	}
+	*temp_off = custom_temp.temp_fan_off;
+	*temp_max = custom_temp.temp_fan_max;
+	return true;
+}
+
+/**
+ * Append a fan curve block for every fan, sampled from one step below the
+ * fan-off temperature to one step above the maximum. The step is 1K unless
+ * the range needs more points than fit in a block.
+ *
+ * \return new length of the image, 0 on error, including images with more
+ *         than FAN_CURVE_MAX_FANS fan blocks
+ */
+static size_t add_fan_curves(uint8_t *image, size_t len, size_t cap)
+{
+	uint8_t curve[GPU_MAX_BLOCK_LEN];
+	struct gpu_cfg_fan fans[FAN_CURVE_MAX_FANS];
+	uint16_t temp_off, temp_max;
+	struct block_index idx;
+	int nfans = 0;
+	long offset;
+
+	block_index_build(&idx, image, len);
+	while ((offset = block_index_find(&idx, &cfg_blocks[BLK_FAN], nfans)) >= 0) {
+		if (nfans == FAN_CURVE_MAX_FANS) {
+			fprintf(stderr, "More than %d fan blocks, cannot add fan curves\n", FAN_CURVE_MAX_FANS);
+			return 0;
+		}
+		memcpy(&fans[nfans++], image + offset, sizeof(struct gpu_cfg_fan));
+	}
+
+	for (int i = 0; i < nfans; i++) {
+		int step = 1;
+		int count;
+
+		if (!fan_curve_limits(image, &idx, &fans[i], &temp_off, &temp_max)) {
+			fprintf(stderr, "No temperature thresholds for fan %d\n", fans[i].idx);
+			return 0;
+		}
+		/* One point below temp_off, the range rounded up, and one point above temp_max */
+		while ((count = (temp_max - temp_off + step - 1) / step + 3) > (int)FAN_CURVE_MAX_POINTS) {
+			step++;
+		}
+		if (step > UINT8_MAX || temp_off < step) {
+			fprintf(stderr, "Fan %d thresholds %d-%dK do not fit in a fan curve block\n", fans[i].idx,
+				temp_off, temp_max);
+			return 0;
+		}
+		view_fan_curve_set_idx(curve, fans[i].idx);
+		view_fan_curve_set_temp_step(curve, step);
+		view_fan_curve_set_temp_start(curve, temp_off - step);
+		view_fan_curve_set_count(curve, count);
+		for (int p = 0; p < count; p++) {
+			view_fan_curve_set_rpm(curve, p, fan_curve_rpm(&fans[i], temp_off, temp_max, temp_off - step + p * step));
+		}
+		/* The index may be stale after appending, but fan offsets are not */
+		len = append_block(image, len, cap, GPUCFG_TYPE_FAN_CURVE, curve,
+			sizeof(struct gpu_cfg_fan_curve) + count * sizeof(uint16_t));
+		if (!len) {
+			return 0;
+		}
+	}
+	return len;
+}
+
+/**
+ * Check every fan curve block of an image against the policy of the fan it
+ * belongs to: off below the fan-off temperature, linear from min_rpm to
+ * max_rpm up to the maximum temperature, max_rpm above. The thresholds are
+ * the fan's own, or those of the first custom temperature entry. Every fan
+ * must have a table that spans one point on either side of its thresholds.
+ *
+ * \return number of mismatches, -1 if the image has no fan curve
+ */
+static int verify_fan_curves(const char *path, const uint8_t *image, size_t len)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	const uint8_t *custom = raw_element(image, len, GPUCFG_TYPE_CUSTOM_TEMP, sizeof(struct gpu_cfg_custom_temp), 0);
+	const uint8_t *fan;
+	uint32_t covered = 0;
+	int mismatches = 0;
+	int ncurves = 0;
+
+	for (; offset + sizeof(struct gpu_block_header) <= end && offset + sizeof(struct gpu_block_header) <= len;
+			offset += sizeof(struct gpu_block_header) + view_block_block_length(image + offset)) {
+		const uint8_t *curve = image + offset + sizeof(struct gpu_block_header);
+		uint8_t blen = view_block_block_length(image + offset);
+		int count, step, first, last, off, max;
+
+		if (view_block_block_type(image + offset) != GPUCFG_TYPE_FAN_CURVE) {
+			continue;
+		}
+		ncurves++;
+		if (blen < sizeof(struct gpu_cfg_fan_curve) ||
+				blen != sizeof(struct gpu_cfg_fan_curve) + view_fan_curve_count(curve) * sizeof(uint16_t)) {
+			printf("%s: fan curve block at %zu is %d bytes, which does not match its point count\n",
+				path, offset, blen);
+			mismatches++;
+			continue;
+		}
+		count = view_fan_curve_count(curve);
+		step = view_fan_curve_temp_step(curve);
+		first = view_fan_curve_temp_start(curve);
+		last = first + (count - 1) * step;
+		for (int i = 0; (fan = raw_element(image, len, GPUCFG_TYPE_FAN, sizeof(struct gpu_cfg_fan), i)); i++) {
+			if (view_fan_idx(fan) == view_fan_curve_idx(curve)) {
+				break;
+			}
+		}
+		if (!fan) {
+			printf("%s: fan curve for fan %d has no matching fan configuration\n", path,
+				view_fan_curve_idx(curve));
+			mismatches++;
+			continue;
+		}
+		if (view_fan_min_temp(fan) && view_fan_max_temp(fan) > view_fan_min_temp(fan)) {
+			off = view_fan_min_temp(fan);
+			max = view_fan_max_temp(fan);
+		} else if (custom && view_custom_temp_temp_fan_max(custom) > view_custom_temp_temp_fan_off(custom)) {
+			off = view_custom_temp_temp_fan_off(custom);
+			max = view_custom_temp_temp_fan_max(custom);
+		} else {
+			printf("%s: fan %d has a fan curve but no temperature thresholds\n", path, view_fan_idx(fan));
+			mismatches++;
+			continue;
+		}
+		covered |= 1U << (view_fan_idx(fan) & 31);
+
+		/* The EC clamps to the table, so it has to reach past both thresholds */
+		if (!step || count < 2 || first >= off || last < max) {
+			printf("%s: fan %d table covers %d-%dK in steps of %dK, thresholds are %d-%dK\n", path,
+				view_fan_idx(fan), first, last, step, off, max);
+			mismatches++;
+			continue;
+		}
+		for (int p = 0; p < count; p++) {
+			int temp = first + p * step;
+			int min_rpm = view_fan_min_rpm(fan);
+			int max_rpm = view_fan_max_rpm(fan);
+			int expected = temp < off ? 0 : temp >= max ? max_rpm :
+				min_rpm + (int64_t)(max_rpm - min_rpm) * (temp - off) / (max - off);
+
+			if (view_fan_curve_rpm(curve, p) != expected) {
+				printf("%s: fan %d at %dK: table %d RPM, expected %d RPM\n", path,
+					view_fan_idx(fan), temp, view_fan_curve_rpm(curve, p), expected);
+				mismatches++;
+			}
+		}
+	}
+	if (!ncurves) {
+		fprintf(stderr, "%s: no fan curve block\n", path);
+		return -1;
+	}
+	for (int i = 0; (fan = raw_element(image, len, GPUCFG_TYPE_FAN, sizeof(struct gpu_cfg_fan), i)); i++) {
+		if (!(covered & 1U << (view_fan_idx(fan) & 31))) {
+			printf("%s: fan %d has no fan curve\n", path, view_fan_idx(fan));
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+static void signature_key_id(const uint8_t *pk, uint8_t *key_id)
+{
+	struct sha512_ctx ctx;
+	uint8_t digest[SHA512_DIGEST_LEN];
+
+	sha512_init(&ctx);
+	sha512_update(&ctx, pk, ED25519_PUBKEY_LEN);
+	sha512_final(&ctx, digest);
+	memcpy(key_id, digest, VIEW_FIELD_SIZE(gpu_cfg_signature, key_id));
+}
+
+/**
+ * Find the signature block, which must be the last block of the chain.
+ *
+ * \return offset of its block header, -1 if the image is not signed
+ */
+static long signature_offset(const uint8_t *image, size_t len)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	long last = -1;
+
+	if (end > len) {
+		return -1;
+	}
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		last = offset;
+		offset += sizeof(struct gpu_block_header) + view_block_block_length(image + offset);
+	}
+	if (last < 0 || offset != end) {
+		return -1;
+	}
+	if (view_block_block_type(image + last) != GPUCFG_TYPE_SIGNATURE ||
+			view_block_block_length(image + last) != sizeof(struct gpu_cfg_signature)) {
+		return -1;
+	}
+	return last;
+}
+
+/**
+ * Length of the signed part of an image whose signature block starts at
+ * offset: everything before the signature itself.
+ */
+static inline size_t signed_len(long offset)
+{
+	return offset + sizeof(struct gpu_block_header) + offsetof(struct gpu_cfg_signature, signature);
+}
+
+/**
+ * Sign an image with a placeholder signature block using key. Clears both
+ * CRCs, which the caller has to fill in afterwards.
+ */
+static void sign_image(uint8_t *image, size_t len, const struct ed25519_key *key)
+{
+	long offset = signature_offset(image, len);
+	uint8_t *sig;
+
+	if (offset < 0) {
+		return;
+	}
+	sig = image + offset + sizeof(struct gpu_block_header);
+	view_desc_set_crc32(image, 0);
+	view_desc_set_descriptor_crc32(image, 0);
+	signature_key_id(key->pk, view_signature_key_id_mut(sig));
+	ed25519_sign(view_signature_signature_mut(sig), image, signed_len(offset), key);
+}
+
+/**
+ * Check the signature of an intact image against key.
+ *
+ * \return NULL if the signature is valid, otherwise a description of the problem
+ */
+static const char *verify_signature(const uint8_t *image, size_t len, const struct ed25519_pubkey *key)
+{
+	const uint8_t *sig;
+	uint8_t message[IMAGE_MAX_LEN];
+	uint8_t key_id[VIEW_FIELD_SIZE(gpu_cfg_signature, key_id)];
+	long offset = signature_offset(image, len);
+
+	if (offset < 0) {
+		return "not signed";
+	}
+	if (signed_len(offset) > sizeof(message)) {
+		return "too large to verify";
+	}
+	sig = image + offset + sizeof(struct gpu_block_header);
+	signature_key_id(key->pk, key_id);
+	if (memcmp(view_signature_key_id(sig), key_id, sizeof(key_id)) != 0) {
+		return "signed with a different key";
+	}
+	memcpy(message, image, signed_len(offset));
+	view_desc_set_crc32(message, 0);
+	view_desc_set_descriptor_crc32(message, 0);
+	if (ed25519_verify(view_signature_signature(sig), message, signed_len(offset), key)) {
+		return "bad signature";
+	}
+	return NULL;
+}
+
+/**
+ * Sign the image if it has a signature block and a key is loaded, then fill
+ * in both CRCs. len covers the header and all blocks following it.
+ */
+static void seal_image(uint8_t *image, size_t len)
+{
+	if (sign_key) {
+		sign_image(image, len, sign_key);
+	}
+	view_desc_set_descriptor_crc32(image, descriptor_body_crc(image));
+	view_desc_set_crc32(image, descriptor_header_crc(image));
+}
+
+/**
+ * Stamp the serial and length into a descriptor without sealing it.
+ */
+static void stamp_eeprom(const char * serial, uint8_t * image, size_t len)
+{
+	memset(view_desc_serial_mut(image), 0x00, GPU_SERIAL_LEN);
+	strncpy((char *)view_desc_serial_mut(image), serial, GPU_SERIAL_LEN);
+
+	view_desc_set_descriptor_length(image, len - sizeof(struct gpu_cfg_descriptor));
+}
+
+/**
+ * Stamp the serial into a descriptor, sign it and fill in both CRCs.
+ * len covers the header and all blocks following it.
+ */
+void build_eeprom(const char * serial, uint8_t * image, size_t len)
+{
+	stamp_eeprom(serial, image, len);
+	seal_image(image, len);
+}
+
+int program_eeprom(const char * serial, uint8_t * image, size_t len, const char * outpath)
+{
+	printf("generating EEPROM\n");
+	build_eeprom(serial, image, len);
+
+	printf("writing EEPROM to %s\n", outpath);
+
+	if (output.format == FORMAT_BIN && padded_len(&output, len) == len) {
+		return write_image(outpath, image, len);
+	}
+
+	uint8_t *encoded = malloc(encoded_max_len(&output, len));
+	size_t n;
+	int ret = -1;
+	if (!encoded) {
+		return -1;
+	}
+	n = encode_image(&output, encoded, image, len);
+	if (n) {
+		ret = write_image(outpath, encoded, n);
+	} else {
+		fprintf(stderr, "Image does not fit in a %d byte device\n", DEVICE_MAX_LEN);
+	}
+	free(encoded);
+	return ret;
+}
+
+/* ctx is the hash manifest, if any; the hash covers the bytes as written */
+static int seal_batch_image(struct image_job *job, void *ctx)
+{
+	uint8_t sealed[sizeof(struct gpu_cfg_descriptor)];
+
+	/* The row could not be built, fail it so it is counted and listed */
+	if (!job->len) {
+		return -1;
+	}
+	seal_image(job->data, job->len);
+	/* Encoding works in place, keep the header for the manifest */
+	memcpy(sealed, job->data, sizeof(sealed));
+	job->len = encode_image(&output, job->data, job->data, job->len);
+	if (!job->len) {
+		fprintf(stderr, "%s: image does not fit in a %d byte device\n", job->path, DEVICE_MAX_LEN);
+		return -1;
+	}
+	if (ctx) {
+		hash_manifest_hash(ctx, job->id, sealed, job->data, job->len);
+	}
+	return 0;
+}
+
+static void record_batch_image(struct image_job *job, int ret, void *ctx)
+{
+	hash_manifest_done(ctx, job->id, job->path, ret);
+}
+
+/**
+ * Find the PCB serial in a template. The layout may have been reordered,
+ * so it is looked up by type.
+ *
+ * \return offset of the serial, -1 if the template has none
+ */
+static long template_pcb_serial(const void *template, size_t len)
+{
+	struct block_index idx;
+
+	block_index_build(&idx, template, len);
+	for (int i = 0;; i++) {
+		long offset = block_index_find(&idx, &cfg_blocks[BLK_SUBSYS], i);
+		if (offset < 0) {
+			fprintf(stderr, "template has no PCB serial block\n");
+			return -1;
+		}
+		if (((const uint8_t *)template)[offset] == GPU_PCB) {
+			return offset + offsetof(struct gpu_subsys_serial, serial);
+		}
+	}
+}
+
+/**
+ * Open a manifest, resolve its header row against the templates and check
+ * every row. The whole batch is rejected before any image is written.
+ *
+ * \return the manifest, rewound, or NULL on error
+ */
+static FILE *open_manifest(const char *manifest, struct batch_profiles *batch)
+{
+	struct manifest_layout *layout = &batch->layout;
+	FILE *fptr = fopen(manifest, "r");
+	char line[MANIFEST_LINE_LEN];
+	char *cols[MANIFEST_MAX_COLUMNS];
+	int errors;
+
+	if (!fptr) {
+		fprintf(stderr, "failed to open manifest %s: %s\n", manifest, strerror(errno));
+		return NULL;
+	}
+	layout->ncolumns = 2;
+	layout->pcb = 1;
+	layout->noverrides = 0;
+	while (fgets(line, sizeof(line), fptr)) {
+		int n = split_manifest_line(line, cols, MANIFEST_MAX_COLUMNS);
+		if (!n) {
+			continue;
+		}
+		if (is_manifest_header(cols) && manifest_resolve(layout, cols, n, manifest)) {
+			fclose(fptr);
+			return NULL;
+		}
+		break;
+	}
+	for (int i = 0; i < skus.nprofiles; i++) {
+		if (batch->templates[i].len && manifest_offsets(layout, &batch->templates[i], manifest)) {
+			fclose(fptr);
+			return NULL;
+		}
+	}
+	rewind(fptr);
+	errors = validate_manifest(fptr, manifest, batch);
+	if (errors) {
+		fprintf(stderr, "%d invalid value(s) in %s, no images written\n", errors, manifest);
+		fclose(fptr);
+		return NULL;
+	}
+	rewind(fptr);
+	return fptr;
+}
+
+/**
+ * Build the image for a manifest row and stamp it, leaving signing and the
+ * CRCs to the caller.
+ *
+ * \return length of the image, 0 if the serial has no template (reported
+ *         on stderr)
+ */
+static size_t build_manifest_row(const struct batch_profiles *batch, char **cols, int n,
+				 const char *serial, const char *pcb, uint8_t *image)
+{
+	const struct profile_template *tpl;
+	/* Checked by validate_manifest, unless the manifest changed since */
+	const char *err = row_template(batch, serial, &tpl);
+
+	if (err) {
+		fprintf(stderr, "%s: %s\n", serial, err);
+		return 0;
+	}
+	memcpy(image, tpl->image, tpl->len);
+	if (tpl->profile->pcb && pcb && *pcb) {
+		memset(image + tpl->pcb_serial, 0x00, GPU_SERIAL_LEN);
+		strncpy((char *)image + tpl->pcb_serial, pcb, GPU_SERIAL_LEN);
+	}
+	apply_manifest_row(&batch->layout, tpl, cols, n, image);
+	stamp_eeprom(serial, image, tpl->len);
+	return tpl->len;
+}
+
+/**
+ * Generate one image per manifest row into outdir.
+ *
+ * Each non-empty line that does not start with '#' is
+ * "module serial[,pcb serial]", or follows the columns of a header row
+ * (see struct manifest_layout). Images are named <module serial>.<ext>
+ * and written through the writer pool with jobs threads.
+ *
+ * With sites > 0 the rows are grouped into gang programmer jobs of that
+ * many sites, and each image is named job<N>_site<M>_<module serial>.<ext>.
+ *
+ * With hash_path set, the images are hashed as they are written and listed
+ * there (see hash_manifest.h).
+ */
+int program_batch(const char * manifest, struct batch_profiles * batch,
+		const char * outdir, int jobs, int sites, const char * hash_path)
+{
+	struct image_writer writer;
+	static struct hash_manifest hashes;
+	char line[MANIFEST_LINE_LEN];
+	char *cols[MANIFEST_MAX_COLUMNS];
+	/* -j 0 writes synchronously, with one image in flight */
+	int window = jobs > 0 ? jobs * 4 : 1;
+	int errors;
+	unsigned long rows = 0;
+	FILE *fptr;
+
+	fptr = open_manifest(manifest, batch);
+	if (!fptr) {
+		return -1;
+	}
+
+	if (hash_path && hash_manifest_start(&hashes, hash_path, window)) {
+		fclose(fptr);
+		return -1;
+	}
+	if (writer_start(&writer, jobs, window, encoded_max_len(&output, batch->max_len), seal_batch_image,
+			hash_path ? record_batch_image : NULL, hash_path ? &hashes : NULL)) {
+		if (hash_path) {
+			hash_manifest_finish(&hashes, hash_path);
+		}
+		fclose(fptr);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fptr)) {
+		char *serial, *pcb;
+		struct image_job *job;
+		int n = parse_manifest_row(line, &batch->layout, cols, &serial, &pcb);
+
+		if (!n)
+			continue;
+
+		/* Signing, encoding and hashing happen on the writer threads */
+		if (hash_path) {
+			hash_manifest_reserve(&hashes, rows);
+		}
+		job = writer_acquire(&writer);
+		job->id = rows;
+		job->len = build_manifest_row(batch, cols, n, serial, pcb, job->data);
+		if (sites > 0) {
+			snprintf(job->path, sizeof(job->path), "%s/job%04lu_site%02lu_%s.%s", outdir,
+				rows / sites, rows % sites, serial, format_extension(output.format));
+		} else {
+			snprintf(job->path, sizeof(job->path), "%s/%s.%s", outdir, serial,
+				format_extension(output.format));
+		}
+		writer_submit(&writer, job);
+		rows++;
+	}
+	fclose(fptr);
+
+	errors = writer_finish(&writer);
+	printf("wrote %lu of %lu images to %s\n", writer.written, rows, outdir);
+	if (hash_path) {
+		if (hash_manifest_finish(&hashes, hash_path)) {
+			errors++;
+		} else {
+			printf("hashed %lu images into %s\n", hashes.entries, hash_path);
+		}
+	}
+	return errors ? -1 : 0;
+}
+
+struct station_units {
+	FILE *fptr;
+	const struct batch_profiles *batch;
+	/* Rows that could not be built, they count as failed units */
+	unsigned long skipped;
+};
+
+/* Build the image for the next manifest row, as program_batch does */
+static int station_next_unit(void *ctx, uint8_t *image, size_t *len, char *label)
+{
+	struct station_units *units = ctx;
+	char line[MANIFEST_LINE_LEN];
+	char *cols[MANIFEST_MAX_COLUMNS];
+	char *serial, *pcb;
+	size_t built;
+	int n;
+
+	for (;;) {
+		if (!fgets(line, sizeof(line), units->fptr)) {
+			return -1;
+		}
+		n = parse_manifest_row(line, &units->batch->layout, cols, &serial, &pcb);
+		if (!n) {
+			continue;
+		}
+		built = build_manifest_row(units->batch, cols, n, serial, pcb, image);
+		if (built) {
+			break;
+		}
+		/* Reported by build_manifest_row, the other sites carry on */
+		units->skipped++;
+	}
+
+	seal_image(image, built);
+	*len = padded_len(&output, built);
+	memset(image + built, 0xFF, *len - built);
+	snprintf(label, STATION_LABEL_LEN, "%s", serial);
+	return 0;
+}
+
+static void print_station_report(const struct station_site *sites, int nsites, unsigned long skipped,
+		uint64_t elapsed_us)
+{
+	unsigned long units = 0, failed = skipped;
+
+	printf("site\tunits\tfailed\tretries\tnacks\tbytes\tunits/s\tbytes/s\n");
+	for (int i = 0; i < nsites; i++) {
+		const struct station_site *site = &sites[i];
+		double secs = site->busy_us / 1e6;
+
+		printf("%s\t%lu\t%lu\t%lu\t%lu\t%llu\t%.1f\t%.0f\n", site->bus.path, site->units, site->failed,
+			site->retries, site->nacks, (unsigned long long)site->bytes,
+			secs > 0 ? site->units / secs : 0.0, secs > 0 ? site->bytes / secs : 0.0);
+		units += site->units;
+		failed += site->failed;
+	}
+	printf("programmed %lu units, %lu failed, in %.2fs (%.1f units/s)\n", units, failed,
+		elapsed_us / 1e6, elapsed_us ? units / (elapsed_us / 1e6) : 0.0);
+	if (skipped) {
+		printf("%lu rows could not be built\n", skipped);
+	}
+}
+
+/**
+ * Program the manifest rows onto fixture sites concurrently. Each free site
+ * takes the next row, so fast sites program more units than slow ones.
+ *
+ * \return 0 if every unit was programmed and verified, -1 otherwise
+ */
+int program_stations(const char *manifest, struct batch_profiles *batch,
+		char **specs, int nspecs, int timeout_ms, int retries)
+{
+	static struct station_site sites[STATION_MAX_SITES];
+	struct station_units units = {
+		.batch = batch,
+	};
+	struct station_params params = {
+		.page_size = boot.page_size,
+		.max_xfer = boot.max_xfer,
+		.addr_len = padded_len(&output, batch->max_len) > 256 ? 2 : 1,
+		.timeout_us = (uint64_t)timeout_ms * 1000,
+		.max_retries = retries,
+		.next_unit = station_next_unit,
+		.ctx = &units,
+	};
+	unsigned long failed;
+	uint64_t start;
+	int opened = 0;
+
+	if (padded_len(&output, batch->max_len) > DEVICE_MAX_LEN) {
+		fprintf(stderr, "Image does not fit in a %d byte device\n", DEVICE_MAX_LEN);
+		return -1;
+	}
+	for (int i = 0; i < nspecs; i++) {
+		memset(&sites[i], 0, sizeof(sites[i]));
+		if (bus_parse(&sites[i].bus, specs[i])) {
+			fprintf(stderr, "Invalid site '%s', expected file:PATH[,cycle=MS][,nack=PCT] or i2c:DEVICE[@ADDR]\n",
+				specs[i]);
+			return -1;
+		}
+	}
+	units.fptr = open_manifest(manifest, batch);
+	if (!units.fptr) {
+		return -1;
+	}
+	for (; opened < nspecs; opened++) {
+		if (bus_open(&sites[opened].bus)) {
+			break;
+		}
+	}
+
+	failed = 1;
+	if (opened == nspecs) {
+		start = station_now_us();
+		failed = station_run(sites, nspecs, &params) + units.skipped;
+		print_station_report(sites, nspecs, units.skipped, station_now_us() - start);
+	}
+	if (opened == nspecs) {
+		/* Left over when every site went offline */
+		unsigned long left = 0;
+		char line[MANIFEST_LINE_LEN], *cols[MANIFEST_MAX_COLUMNS], *serial, *pcb;
+
+		while (fgets(line, sizeof(line), units.fptr)) {
+			left += parse_manifest_row(line, &batch->layout, cols, &serial, &pcb) > 0;
+		}
+		if (left) {
+			fprintf(stderr, "%lu units not programmed, no site left\n", left);
+			failed += left;
+		}
+	}
+	for (int i = 0; i < opened; i++) {
+		bus_close(&sites[i].bus);
+	}
+	fclose(units.fptr);
+	return failed ? -1 : 0;
+}
+
+struct file_list {
+	char **paths;
+	int count;
+	int cap;
+};
+
+static int file_list_add(struct file_list *list, const char *path)
+{
+	if (list->count == list->cap) {
+		int cap = list->cap ? list->cap * 2 : 64;
+		char **paths = realloc(list->paths, cap * sizeof(char *));
+		if (!paths) {
+			return -1;
+		}
+		list->paths = paths;
+		list->cap = cap;
+	}
+	list->paths[list->count] = strdup(path);
+	if (!list->paths[list->count]) {
+		return -1;
+	}
+	list->count++;
+	return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * Expand command line operands into a list of image files. Directories
+ * contribute the regular files directly inside them, in name order.
+ */
+static int collect_files(struct file_list *list, char **args, int nargs)
+{
+	char path[IMAGE_PATH_LEN];
+
+	for (int i = 0; i < nargs; i++) {
+		struct stat st;
+		struct dirent *ent;
+		DIR *dir;
+		int start = list->count;
+
+		if (stat(args[i], &st) < 0) {
+			fprintf(stderr, "%s: %s\n", args[i], strerror(errno));
+			return -1;
+		}
+		if (!S_ISDIR(st.st_mode)) {
+			if (file_list_add(list, args[i])) {
+				return -1;
+			}
+			continue;
+		}
+		dir = opendir(args[i]);
+		if (!dir) {
+			fprintf(stderr, "%s: %s\n", args[i], strerror(errno));
+			return -1;
+		}
+		while ((ent = readdir(dir))) {
+			if (ent->d_name[0] == '.') {
+				continue;
+			}
+			snprintf(path, sizeof(path), "%s/%s", args[i], ent->d_name);
+			if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && file_list_add(list, path)) {
+				closedir(dir);
+				return -1;
+			}
+		}
+		closedir(dir);
+		qsort(&list->paths[start], list->count - start, sizeof(char *), compare_paths);
+	}
+	return 0;
+}
+
+static void file_list_free(struct file_list *list)
+{
+	for (int i = 0; i < list->count; i++) {
+		free(list->paths[i]);
+	}
+	free(list->paths);
+	memset(list, 0, sizeof(*list));
+}
+
+/**
+ * Read a whole image file into buf.
+ *
+ * \return number of bytes read, or -1 on error (reported on stderr)
+ */
+static long load_image(const char *path, uint8_t *buf, size_t cap)
+{
+	FILE *fptr = fopen(path, "rb");
+	size_t len;
+
+	if (!fptr) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	len = fread(buf, 1, cap, fptr);
+	if (ferror(fptr)) {
+		fprintf(stderr, "%s: read error\n", path);
+		fclose(fptr);
+		return -1;
+	}
+	fclose(fptr);
+	return len;
+}
+
+/**
+ * Read a key file holding exactly len raw bytes.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int load_key_file(const char *path, uint8_t *key, size_t len)
+{
+	uint8_t buf[ED25519_SEED_LEN + 1];
+	long n = load_image(path, buf, sizeof(buf));
+
+	if (n < 0) {
+		return -1;
+	}
+	if ((size_t)n != len) {
+		fprintf(stderr, "%s: expected a raw %zu byte key\n", path, len);
+		return -1;
+	}
+	memcpy(key, buf, len);
+	return 0;
+}
+
+#define MAX_FIELD_EDITS 32
+
+struct field_edit {
+	struct field_ref ref;
+	uint32_t value;
+	const char *string;
+};
+
+/**
+ * Parse a --set argument of the form "block[index].field=value".
+ */
+static int parse_field_edit(const char *arg, struct field_edit *edit)
+{
+	char path[64];
+	const char *eq = strchr(arg, '=');
+	const char *err;
+
+	if (!eq || (size_t)(eq - arg) >= sizeof(path)) {
+		return -1;
+	}
+	memcpy(path, arg, eq - arg);
+	path[eq - arg] = '\0';
+	if (parse_field_ref(path, &edit->ref)) {
+		return -1;
+	}
+	if (edit->ref.field->read_only) {
+		fprintf(stderr, "%s cannot be set, use --migrate to change the descriptor version\n", path);
+		return -1;
+	}
+
+	edit->string = eq + 1;
+	err = parse_field_value(edit->ref.field, edit->string, &edit->value);
+	if (err) {
+		fprintf(stderr, "Value '%s' for %s %s\n", edit->string, path, err);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Patch fields of an image file in place and fix up the CRCs.
+ *
+ * All fields are resolved before anything is written, so a failing edit
+ * leaves the file untouched. The descriptor CRC is only recomputed when a
+ * block was changed; the header CRC always is, as it covers descriptor_crc32.
+ * Signed images are only edited when they can be re-signed.
+ */
+static int edit_image(const char *path, const struct field_edit *edits, int count)
+{
+	uint8_t *fields[MAX_FIELD_EDITS];
+	struct block_index idx;
+	bool body = false;
+	bool signed_image;
+	const char *err;
+	struct stat st;
+	uint8_t *image;
+	int ret = -1;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(struct gpu_cfg_descriptor)) {
+		fprintf(stderr, "%s: too short for a descriptor\n", path);
+		close(fd);
+		return -1;
+	}
+	image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	err = check_image(image, st.st_size);
+	if (err) {
+		fprintf(stderr, "%s: %s, not editing\n", path, err);
+		goto out;
+	}
+	signed_image = signature_offset(image, st.st_size) >= 0;
+	if (signed_image && !sign_key) {
+		fprintf(stderr, "%s: signed image, pass --sign-key to re-sign it\n", path);
+		goto out;
+	}
+	/* Fresh CRCs over a changed body must not earn a fresh signature */
+	if (signed_image && (err = verify_signature(image, st.st_size, resign_key))) {
+		fprintf(stderr, "%s: %s, not re-signing\n", path, err);
+		goto out;
+	}
+	block_index_build(&idx, image, st.st_size);
+	for (int i = 0; i < count; i++) {
+		const struct field_ref *ref = &edits[i].ref;
+		long offset;
+
+		/* Packed in 0.2, the schema only describes the 0.1 layout */
+		if (is_compact(image) && (ref->field->block->block_type == GPUCFG_TYPE_GPIO ||
+				ref->field->block->block_type == GPUCFG_TYPE_THERMAL_SENSOR)) {
+			fprintf(stderr, "%s: %s fields cannot be edited in a 0.%d image\n", path,
+				ref->field->block->name, GPU_CFG_VERSION_MINOR_COMPACT);
+			goto out;
+		}
+		offset = block_index_find(&idx, ref->field->block, ref->index);
+		if (offset < 0) {
+			fprintf(stderr, "%s: no %s[%d] block\n", path, ref->field->block->name, ref->index);
+			goto out;
+		}
+		fields[i] = image + offset + ref->field->offset;
+		body |= !ref->field->block->header;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const struct cfg_field *field = edits[i].ref.field;
+		if (field->kind == FIELD_STRING) {
+			memset(fields[i], 0x00, field->width);
+			strncpy((char *)fields[i], edits[i].string, field->width);
+		} else {
+			field_store(fields[i], field->width, edits[i].value);
+		}
+	}
+	if (signed_image) {
+		seal_image(image, sizeof(struct gpu_cfg_descriptor) + view_desc_descriptor_length(image));
+	} else {
+		if (body) {
+			view_desc_set_descriptor_crc32(image, descriptor_body_crc(image));
+		}
+		view_desc_set_crc32(image, descriptor_header_crc(image));
+	}
+	ret = 0;
+
+out:
+	munmap(image, st.st_size);
+	close(fd);
+	return ret;
+}
+
+struct edit_batch {
+	char **files;
+	int nfiles;
+	const struct field_edit *edits;
+	int count;
+	int next;
+	int errors;
+};
+
+static void *edit_thread(void *arg)
+{
+	struct edit_batch *batch = arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->nfiles) {
+		if (edit_image(batch->files[i], batch->edits, batch->count)) {
+			__atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Apply the same edits to many image files using jobs threads.
+ *
+ * \return number of files that could not be edited
+ */
+int edit_images(char **files, int nfiles, const struct field_edit *edits, int count, int jobs)
+{
+	struct edit_batch batch = {
+		.files = files, .nfiles = nfiles, .edits = edits, .count = count,
+	};
+	pthread_t threads[WRITER_MAX_THREADS];
+	int started = 0;
+
+	if (jobs > WRITER_MAX_THREADS) {
+		jobs = WRITER_MAX_THREADS;
+	}
+	for (; started < jobs - 1; started++) {
+		if (pthread_create(&threads[started], NULL, edit_thread, &batch)) {
+			break;
+		}
+	}
+	edit_thread(&batch);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	printf("edited %d of %d images\n", nfiles - batch.errors, nfiles);
+	return batch.errors;
+}
+
+struct verify_batch {
+	char **files;
+	int nfiles;
+	int next;
+	int errors;
+};
+
+static void *verify_thread(void *arg)
+{
+	struct verify_batch *batch = arg;
+	uint8_t image[IMAGE_MAX_LEN];
+	int i;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->nfiles) {
+		long len = load_image(batch->files[i], image, sizeof(image));
+		const char *err = len < 0 ? "unreadable" : check_image(image, len);
+
+		if (!err) {
+			err = verify_signature(image, len, verify_key);
+		}
+		if (err) {
+			fprintf(stderr, "%s: %s\n", batch->files[i], err);
+			__atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Check the signatures of many image files against verify_key using jobs
+ * threads. The public key is decoded once and shared by all threads.
+ *
+ * \return number of files that are unreadable, corrupt or not validly signed
+ */
+int verify_images(char **files, int nfiles, int jobs)
+{
+	struct verify_batch batch = {
+		.files = files, .nfiles = nfiles,
+	};
+	pthread_t threads[WRITER_MAX_THREADS];
+	int started = 0;
+
+	if (jobs > WRITER_MAX_THREADS) {
+		jobs = WRITER_MAX_THREADS;
+	}
+	for (; started < jobs - 1; started++) {
+		if (pthread_create(&threads[started], NULL, verify_thread, &batch)) {
+			break;
+		}
+	}
+	verify_thread(&batch);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	printf("%d of %d images have a valid signature\n", nfiles - batch.errors, nfiles);
+	return batch.errors;
+}
+
+struct migrate_batch {
+	char **files;
+	int nfiles;
+	uint8_t target;
+	const struct sku_profile *forced;
+	int next;
+	int errors;
+};
+
+static void print_migration(const char *path, const struct migration_report *report)
+{
+	char line[512];
+	size_t n;
+
+	n = snprintf(line, sizeof(line), "%s: 0.%d -> 0.%d, %zu -> %zu bytes", path,
+		report->from_minor, report->to_minor, report->old_len, report->new_len);
+	for (int i = 0; i < report->nchanges && n < sizeof(line); i++) {
+		const struct migration_change *c = &report->changes[i];
+		n += snprintf(line + n, sizeof(line) - n, "%s %s %d %s (%+d bytes)", i ? "," : ";",
+			c->action == MIGRATE_ADDED ? "added" : "converted", c->count, c->name, c->delta);
+	}
+	/* One call per line so lines from different threads do not mix */
+	printf("%s\n", line);
+}
+
+/**
+ * Migrate one image file in place. The new image is written next to it and
+ * renamed over it, so an interrupted run never leaves a half written image.
+ * Padding after the image, as in dumps of a whole device, is kept.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int migrate_file(const char *path, const struct migrate_batch *batch)
+{
+	uint8_t image[DEVICE_MAX_LEN];
+	uint8_t out[DEVICE_MAX_LEN];
+	const struct sku_profile *profile;
+	struct migration_report report;
+	char tmp[4096];
+	const char *err;
+	size_t len, total;
+	long n;
+
+	n = load_image(path, image, sizeof(image));
+	err = n < 0 ? "unreadable" : check_image(image, n);
+	if (err) {
+		fprintf(stderr, "%s: %s, not migrating\n", path, err);
+		return -1;
+	}
+	if (signature_offset(image, n) >= 0) {
+		if (!sign_key) {
+			fprintf(stderr, "%s: signed image, pass --sign-key to re-sign it\n", path);
+			return -1;
+		}
+		err = verify_signature(image, n, resign_key);
+		if (err) {
+			fprintf(stderr, "%s: %s, not re-signing\n", path, err);
+			return -1;
+		}
+	}
+	/* Blocks the image lacks come from the profile of its serial, archived units of other SKUs need -g or -d */
+	profile = sku_lookup(&skus, (const char *)view_desc_serial(image), GPU_SERIAL_LEN);
+	if (!profile) {
+		profile = batch->forced;
+	} else if (batch->forced && profile != batch->forced) {
+		profile = NULL;
+	}
+	len = migrate_image(image, n, batch->target, profile ? profile->cfg : NULL, profile ? profile->len : 0,
+		out, IMAGE_MAX_LEN, &report);
+	if (!len) {
+		fprintf(stderr, "%s: %s\n", path, report.error);
+		return -1;
+	}
+	if (len == report.old_len && memcmp(image, out, len) == 0) {
+		printf("%s: already 0.%d, unchanged\n", path, batch->target);
+		return 0;
+	}
+	seal_image(out, len);
+
+	total = len;
+	if ((size_t)n > report.old_len && (size_t)n > len) {
+		total = n;
+		memset(out + len, 0xFF, total - len);
+	}
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.migrate", path) >= sizeof(tmp)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+	if (write_image(tmp, out, total)) {
+		return -1;
+	}
+	if (rename(tmp, path) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	print_migration(path, &report);
+	return 0;
+}
+
+static void *migrate_thread(void *arg)
+{
+	struct migrate_batch *batch = arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->nfiles) {
+		if (migrate_file(batch->files[i], batch)) {
+			__atomic_fetch_add(&batch->errors, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Migrate many image files to descriptor version 0.target using jobs
+ * threads. Each thread works on one image at a time with fixed buffers, so
+ * memory does not grow with the number of images. Required blocks an image
+ * lacks are taken from the profile of its serial, or forced for serials of
+ * unknown SKUs.
+ *
+ * \return number of files that could not be migrated
+ */
+int migrate_images(char **files, int nfiles, uint8_t target, const struct sku_profile *forced, int jobs)
+{
+	struct migrate_batch batch = {
+		.files = files, .nfiles = nfiles, .target = target, .forced = forced,
+	};
+	pthread_t threads[WRITER_MAX_THREADS];
+	int started = 0;
+
+	if (jobs > WRITER_MAX_THREADS) {
+		jobs = WRITER_MAX_THREADS;
+	}
+	for (; started < jobs - 1; started++) {
+		if (pthread_create(&threads[started], NULL, migrate_thread, &batch)) {
+			break;
+		}
+	}
+	migrate_thread(&batch);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	printf("migrated %d of %d images to 0.%d\n", nfiles - batch.errors, nfiles, target);
+	return batch.errors;
+}
+
+#define MAX_FIELD_QUERIES 64
+
+/**
+ * Print the queried fields of each image as one tab separated row, with a
+ * header row naming the columns. Fields an image does not have print "-".
+ *
+ * \return number of images that could not be read or failed their CRCs
+ */
+int query_images(char *query, char **files, int nfiles)
+{
+	struct field_ref refs[MAX_FIELD_QUERIES];
+	const char *names[MAX_FIELD_QUERIES];
+	uint8_t buf[IMAGE_MAX_LEN];
+	uint8_t expanded[IMAGE_MAX_LEN];
+	struct block_index idx;
+	int nrefs = 0;
+	int errors = 0;
+
+	for (char *tok = strtok(query, ","); tok; tok = strtok(NULL, ",")) {
+		if (nrefs == MAX_FIELD_QUERIES || parse_field_ref(tok, &refs[nrefs])) {
+			fprintf(stderr, "Invalid field '%s', expected block[index].field\n", tok);
+			return -1;
+		}
+		names[nrefs++] = tok;
+	}
+
+	printf("file");
+	for (int i = 0; i < nrefs; i++) {
+		printf("\t%s", names[i]);
+	}
+	printf("\n");
+
+	for (int f = 0; f < nfiles; f++) {
+		long len = load_image(files[f], buf, sizeof(buf));
+		const char *err = len < 0 ? "unreadable" : check_image(buf, len);
+		const uint8_t *image = buf;
+
+		if (!err && is_compact(buf)) {
+			/* Query the 0.1 layout the field schema describes */
+			len = compact_decode(buf, len, expanded, sizeof(expanded));
+			image = expanded;
+			err = len ? NULL : "cannot decode";
+		}
+		if (err) {
+			fprintf(stderr, "%s: %s\n", files[f], err);
+			errors++;
+			continue;
+		}
+		block_index_build(&idx, image, len);
+
+		printf("%s", files[f]);
+		for (int i = 0; i < nrefs; i++) {
+			const struct cfg_field *field = refs[i].field;
+			long offset = block_index_find(&idx, field->block, refs[i].index);
+
+			if (offset < 0) {
+				printf("\t-");
+			} else if (field->kind == FIELD_STRING) {
+				printf("\t%.*s", field->width, (const char *)image + offset + field->offset);
+			} else {
+				printf("\t%u", field_load(image + offset + field->offset, field->width));
+			}
+		}
+		printf("\n");
+	}
+	return errors;
+}
+
+/*
+ * Golden comparison. Serials and the CRCs covering them differ from unit to
+ * unit by design and are ignored.
+ */
+struct golden {
+	uint8_t image[IMAGE_MAX_LEN];
+	/* 0x00 over bytes that are ignored by the quick comparison */
+	uint8_t mask[IMAGE_MAX_LEN];
+	size_t len;
+	/* The golden image in the 0.1 layout, for the field comparison */
+	uint8_t expanded[IMAGE_MAX_LEN];
+	size_t expanded_len;
+	struct block_index idx;
+};
+
+static inline size_t image_len(const uint8_t *image)
+{
+	return sizeof(struct gpu_cfg_descriptor) + view_desc_descriptor_length(image);
+}
+
+/**
+ * Build a mask over an intact image that is 0x00 over the fields that differ
+ * from unit to unit, and 0xFF over the configuration.
+ */
+static void unit_field_mask(const uint8_t *image, size_t len, uint8_t *mask)
+{
+	struct block_index idx;
+
+	memset(mask, 0xFF, len);
+	memset(mask + offsetof(struct gpu_cfg_descriptor, serial), 0, GPU_SERIAL_LEN);
+	memset(mask + offsetof(struct gpu_cfg_descriptor, crc32), 0, sizeof(uint32_t));
+	memset(mask + offsetof(struct gpu_cfg_descriptor, descriptor_crc32), 0, sizeof(uint32_t));
+	/* Offsets come from the image's own chain, so either encoding works */
+	block_index_build(&idx, image, len);
+	for (int i = 0; i < idx.count[GPUCFG_TYPE_SUBSYS]; i++) {
+		int slot = idx.first[GPUCFG_TYPE_SUBSYS] + i;
+		if (idx.length[slot] >= sizeof(struct gpu_subsys_serial)) {
+			memset(mask + idx.offset[slot] + offsetof(struct gpu_subsys_serial, serial), 0, GPU_SERIAL_LEN);
+		}
+	}
+	/* The signature covers the serials */
+	if (signature_offset(image, len) >= 0) {
+		memset(mask + signed_len(signature_offset(image, len)), 0, ED25519_SIG_LEN);
+	}
+}
+
+/**
+ * Load the golden image and build its comparison mask.
+ *
+ * \return 0 on success, -1 on error
+ */
+static int golden_load(struct golden *g, const char *path)
+{
+	long len = load_image(path, g->image, sizeof(g->image));
+	const char *err = len < 0 ? "unreadable" : check_image(g->image, len);
+
+	if (err) {
+		fprintf(stderr, "%s: %s\n", path, err);
+		return -1;
+	}
+	g->len = image_len(g->image);
+	unit_field_mask(g->image, g->len, g->mask);
+
+	memcpy(g->expanded, g->image, g->len);
+	g->expanded_len = g->len;
+	if (is_compact(g->image)) {
+		g->expanded_len = compact_decode(g->image, g->len, g->expanded, sizeof(g->expanded));
+		if (!g->expanded_len) {
+			fprintf(stderr, "%s: cannot decode\n", path);
+			return -1;
+		}
+	}
+	block_index_build(&g->idx, g->expanded, g->expanded_len);
+	return 0;
+}
+
+/**
+ * Compare an image with the golden image 8 bytes at a time, ignoring
+ * masked bytes. The mask hides the CRCs, so the image must have passed
+ * check_image() for a match to mean anything.
+ *
+ * \return true if they only differ in masked bytes
+ */
+static bool golden_same(const struct golden *g, const uint8_t *image, size_t len)
+{
+	if (len != g->len)
+		return false;
+	for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+		uint64_t a = 0, b = 0, m = 0;
+		size_t n = len - i < sizeof(uint64_t) ? len - i : sizeof(uint64_t);
+
+		memcpy(&a, g->image + i, n);
+		memcpy(&b, image + i, n);
+		memcpy(&m, g->mask + i, n);
+		if ((a ^ b) & m)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Number of elements of a schema block in an indexed image.
+ */
+static int block_elements(const struct block_index *idx, const struct cfg_block_def *block)
+{
+	int n = 0;
+
+	if (block->header)
+		return 1;
+	for (int i = 0; i < idx->count[block->block_type]; i++)
+		n += idx->length[idx->first[block->block_type] + i] / block->elem_size;
+	return n;
+}
+
+static bool schema_block_type(uint8_t type)
+{
+	for (size_t i = 1; i < sizeof(cfg_blocks) / sizeof(cfg_blocks[0]); i++) {
+		if (cfg_blocks[i].block_type == type)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Report field level differences of an image against the golden image,
+ * matching blocks by type and index. Blocks outside the field schema are
+ * compared as a whole.
+ *
+ * \return number of differences
+ */
+static int golden_diff(const struct golden *g, const char *path, const uint8_t *image, size_t len)
+{
+	struct block_index idx;
+	int diffs = 0;
+
+	block_index_build(&idx, image, len);
+	if (idx.truncated) {
+		printf("%s: block chain is truncated\n", path);
+		diffs++;
+	}
+
+	for (size_t b = 0; b < sizeof(cfg_blocks) / sizeof(cfg_blocks[0]); b++) {
+		const struct cfg_block_def *block = &cfg_blocks[b];
+		int have = block_elements(&idx, block);
+		int want = block_elements(&g->idx, block);
+
+		for (int e = 0; e < (have > want ? have : want); e++) {
+			long offset = e < have ? block_index_find(&idx, block, e) : -1;
+			long goffset = e < want ? block_index_find(&g->idx, block, e) : -1;
+
+			if (offset < 0 || goffset < 0) {
+				printf("%s: %s[%d] %s\n", path, block->name, e, offset < 0 ? "missing" : "extra");
+				diffs++;
+				continue;
+			}
+			for (size_t i = 0; i < CFG_FIELD_COUNT; i++) {
+				const struct cfg_field *field = &cfg_fields[i];
+				const uint8_t *a = g->expanded + goffset + field->offset;
+				const uint8_t *v = image + offset + field->offset;
+
+				/* Serials are expected to differ */
+				if (field->block != block || field->kind == FIELD_STRING)
+					continue;
+				if (field_load(a, field->width) != field_load(v, field->width)) {
+					printf("%s: %s[%d].%s = %u, golden %u\n", path, block->name, e, field->name,
+						field_load(v, field->width), field_load(a, field->width));
+					diffs++;
+				}
+			}
+		}
+	}
+
+	for (int type = 0; type < 256; type++) {
+		int have = idx.count[type];
+		int want = g->idx.count[type];
+
+		if (schema_block_type(type) || type == GPUCFG_TYPE_PADDING)
+			continue;
+		for (int i = 0; i < (have > want ? have : want); i++) {
+			int slot = idx.first[type] + i;
+			int gslot = g->idx.first[type] + i;
+
+			if (i >= have || i >= want) {
+				printf("%s: block type %d #%d %s\n", path, type, i, i >= have ? "missing" : "extra");
+				diffs++;
+			} else if (type == GPUCFG_TYPE_SIGNATURE) {
+				/* Only the key id is expected to match */
+				if (memcmp(image + idx.offset[slot], g->expanded + g->idx.offset[gslot],
+						offsetof(struct gpu_cfg_signature, signature))) {
+					printf("%s: signed with a different key\n", path);
+					diffs++;
+				}
+			} else if (idx.length[slot] != g->idx.length[gslot] ||
+					memcmp(image + idx.offset[slot], g->expanded + g->idx.offset[gslot], idx.length[slot])) {
+				printf("%s: block type %d #%d differs\n", path, type, i);
+				diffs++;
+			}
+		}
+	}
+	return diffs;
+}
+
+/**
+ * Compare image files against a golden image. Images that only differ in
+ * serials and CRCs are skipped by a masked byte comparison; the rest get a
+ * field by field report.
+ *
+ * \return number of images that differ or could not be read
+ */
+int diff_golden(const char *golden_path, char **files, int nfiles)
+{
+	static struct golden g;
+	uint8_t buf[IMAGE_MAX_LEN];
+	uint8_t expanded[IMAGE_MAX_LEN];
+	int same = 0, differ = 0, errors = 0;
+
+	if (golden_load(&g, golden_path)) {
+		return -1;
+	}
+	for (int f = 0; f < nfiles; f++) {
+		long len = load_image(files[f], buf, sizeof(buf));
+		const uint8_t *image = buf;
+		const char *err;
+		int diffs = 0;
+
+		if (len < (long)sizeof(struct gpu_cfg_descriptor) ||
+				memcmp(view_desc_magic(buf), descriptor_magic, sizeof(descriptor_magic)) != 0) {
+			fprintf(stderr, "%s: not a descriptor\n", files[f]);
+			errors++;
+			continue;
+		}
+		if (image_len(buf) <= (size_t)len) {
+			len = image_len(buf);
+		}
+		/* Corrupt CRCs are reported but do not stop the comparison */
+		err = check_image(buf, len);
+		if (!err && golden_same(&g, buf, len)) {
+			same++;
+			continue;
+		}
+		if (err) {
+			printf("%s: %s\n", files[f], err);
+			diffs++;
+		}
+		if (view_desc_descriptor_version_minor(buf) != view_desc_descriptor_version_minor(g.image)) {
+			printf("%s: descriptor version 0.%d, golden 0.%d\n", files[f], view_desc_descriptor_version_minor(buf),
+				view_desc_descriptor_version_minor(g.image));
+			diffs++;
+		}
+		if (is_compact(buf)) {
+			len = compact_decode(buf, len, expanded, sizeof(expanded));
+			image = expanded;
+			if (!len) {
+				printf("%s: cannot decode\n", files[f]);
+				differ++;
+				continue;
+			}
+		}
+		diffs += golden_diff(&g, files[f], image, len);
+		if (diffs) {
+			differ++;
+		} else {
+			/* Same content in a different block order or padding */
+			same++;
+		}
+	}
+	printf("%d identical, %d different, %d unreadable\n", same, differ, errors);
+	return differ + errors;
+}
+
+/**
+ * Load an intact image in the 0.1 layout the field schema describes.
+ *
+ * \return length of the image in *image (buf or expanded), -1 on error
+ */
+static long load_schema_image(const char *path, uint8_t *buf, uint8_t *expanded, const uint8_t **image)
+{
+	long len = load_image(path, buf, IMAGE_MAX_LEN);
+	const char *err = len < 0 ? "unreadable" : check_image(buf, len);
+
+	*image = buf;
+	if (!err && is_compact(buf)) {
+		len = compact_decode(buf, len, expanded, IMAGE_MAX_LEN);
+		*image = expanded;
+		err = len ? NULL : "cannot decode";
+	}
+	if (err) {
+		fprintf(stderr, "%s: %s\n", path, err);
+		return -1;
+	}
+	return len;
+}
+
+/**
+ * Decode image files into one columnar file with a row per image. A first
+ * pass finds how many elements of each block the fleet has, which fixes the
+ * columns; the second fills them. Images that cannot be read in either pass
+ * are left out.
+ *
+ * \return number of images left out, -1 if the export failed
+ */
+int export_columns(const char *outpath, char **files, int nfiles)
+{
+	const size_t nblocks = sizeof(cfg_blocks) / sizeof(cfg_blocks[0]);
+	uint8_t buf[IMAGE_MAX_LEN];
+	uint8_t expanded[IMAGE_MAX_LEN];
+	int elements[sizeof(cfg_blocks) / sizeof(cfg_blocks[0])] = {0};
+	bool *usable = calloc(nfiles, sizeof(bool));
+	struct column_writer writer = {0};
+	struct block_index idx;
+	const uint8_t *image;
+	uint64_t rows = 0;
+	int skipped = 0;
+
+	if (!usable) {
+		return -1;
+	}
+	for (int f = 0; f < nfiles; f++) {
+		long len = load_schema_image(files[f], buf, expanded, &image);
+		if (len < 0) {
+			skipped++;
+			continue;
+		}
+		block_index_build(&idx, image, len);
+		for (size_t b = 0; b < nblocks; b++) {
+			int n = block_elements(&idx, &cfg_blocks[b]);
+			if (n > elements[b]) {
+				elements[b] = n;
+			}
+		}
+		usable[f] = true;
+		rows++;
+	}
+
+	for (size_t b = 0; b < nblocks; b++) {
+		for (int e = 0; e < elements[b]; e++) {
+			for (size_t i = 0; i < CFG_FIELD_COUNT; i++) {
+				if (cfg_fields[i].block == &cfg_blocks[b] && column_add(&writer, &cfg_fields[i], e)) {
+					goto fail;
+				}
+			}
+		}
+	}
+	if (column_writer_start(&writer, outpath, rows)) {
+		goto fail;
+	}
+
+	for (int f = 0; f < nfiles && writer.row < rows; f++) {
+		long len = usable[f] ? load_schema_image(files[f], buf, expanded, &image) : -1;
+		if (len < 0) {
+			continue;
+		}
+		block_index_build(&idx, image, len);
+		for (int i = 0; i < writer.ncols; i++) {
+			struct column *c = &writer.cols[i];
+			long offset = block_index_find(&idx, c->field->block, c->index);
+
+			column_put(&writer, c, offset < 0 ? NULL : image + offset + c->field->offset);
+		}
+		column_end_row(&writer);
+	}
+	/* Files that went bad since the first pass leave empty rows at the end */
+	skipped += rows - writer.row;
+	while (writer.row < rows) {
+		for (int i = 0; i < writer.ncols; i++) {
+			column_put(&writer, &writer.cols[i], NULL);
+		}
+		column_end_row(&writer);
+	}
+	printf("exported %lu images in %d columns to %s\n", (unsigned long)rows, writer.ncols, outpath);
+	free(usable);
+	if (column_writer_finish(&writer)) {
+		fprintf(stderr, "failed to write %s\n", outpath);
+		return -1;
+	}
+	return skipped;
+
+fail:
+	column_writer_free(&writer);
+	free(usable);
+	return -1;
+}
+
+static void print_bitset(const char *label, uint32_t set)
+{
+	printf("    %s:", label);
+	for (int gpio = 0; gpio < 32; gpio++) {
+		if (set & GPIO_BIT(gpio)) {
+			printf(" %d", gpio);
+		}
+	}
+	printf("\n");
+}
+
+/**
+ * Describe every violated consistency rule.
+ */
+static void print_check_result(const char *path, const struct check_result *check)
+{
+	for (int rule = 0; rule < CHECK_RULE_COUNT; rule++) {
+		if (!(check->violations & (1U << rule))) {
+			continue;
+		}
+		printf("%s: %s\n", path, check_rule_names[rule]);
+		switch (rule) {
+			case CHECK_GPIO_DUPLICATE:
+				print_bitset("GPIOs", check->gpio_duplicate);
+				break;
+			case CHECK_GPIO_UNCONTROLLABLE:
+				print_bitset("GPIOs", check->gpio_uncontrollable);
+				break;
+			case CHECK_PD_GPIO_MISSING:
+				print_bitset("GPIOs", check->pd_missing);
+				break;
+			case CHECK_PD_GPIO_OUTPUT:
+				print_bitset("GPIOs", check->pd_output);
+				break;
+			case CHECK_I2C_DUPLICATE:
+				printf("    Addresses:");
+				for (int addr = 0; addr < 128; addr++) {
+					if (check->i2c_duplicate[addr / 32] & (1U << (addr % 32))) {
+						printf(" 0x%02X", addr);
+					}
+				}
+				printf("\n");
+				break;
+			case CHECK_SUBSYS_DUPLICATE:
+				print_bitset("Subsystems", check->subsys_duplicate);
+				break;
+		}
+	}
+}
+
+static int audit_image(const char *path, const uint8_t *image, size_t len)
+{
+	struct check_result check;
+
+	if (config_check(image, len, &check)) {
+		print_check_result(path, &check);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Get the image for a profile, with the boot layout applied if requested.
+ * A signature block, if requested, goes last so the layout cannot move it.
+ *
+ * \return length of the image in buf
+ */
+static size_t profile_image(const void *cfg, size_t len, uint8_t *buf)
+{
+	uint8_t work[IMAGE_MAX_LEN];
+	struct check_result check;
+
+	memcpy(work, cfg, len);
+	if (config_check(work, len, &check)) {
+		print_check_result("profile", &check);
+		return 0;
+	}
+	if (gpio_actions) {
+		len = add_gpio_actions(work, len, sizeof(work));
+		if (!len) {
+			fprintf(stderr, "No room for the GPIO action block\n");
+			return 0;
+		}
+	}
+	if (fan_curve) {
+		len = add_fan_curves(work, len, sizeof(work));
+		if (!len) {
+			fprintf(stderr, "Cannot add fan curve blocks\n");
+			return 0;
+		}
+	}
+	if (compact) {
+		len = compact_encode(work, len, buf, IMAGE_MAX_LEN);
+		if (!len) {
+			fprintf(stderr, "Profile cannot be represented in descriptor version 0.%d\n",
+				GPU_CFG_VERSION_MINOR_COMPACT);
+			return 0;
+		}
+		memcpy(work, buf, len);
+	}
+	if (boot_layout) {
+		len = boot_optimize(&boot, work, buf, IMAGE_MAX_LEN);
+	} else {
+		memcpy(buf, work, len);
+	}
+	if (len && sign_key) {
+		/* Filled in per unit once the serials are stamped */
+		struct gpu_cfg_signature sig = {0};
+		len = append_block(buf, len, IMAGE_MAX_LEN, GPUCFG_TYPE_SIGNATURE, &sig, sizeof(sig));
+		if (!len) {
+			fprintf(stderr, "No room for the signature block\n");
+		}
+	}
+	return len;
+}
+
+/**
+ * Generate the template of every profile a batch may use: the one given
+ * with -g or -d, or all of them when units are told apart by serial.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int prepare_profiles(struct batch_profiles *batch, const struct sku_profile *forced)
+{
+	batch->forced = forced;
+	batch->max_len = 0;
+	for (int i = 0; i < skus.nprofiles; i++) {
+		const struct sku_profile *profile = &skus.profiles[i];
+		struct profile_template *tpl = &batch->templates[i];
+
+		tpl->profile = profile;
+		tpl->len = 0;
+		tpl->pcb_serial = -1;
+		if (forced && forced != profile) {
+			continue;
+		}
+		tpl->len = profile_image(profile->cfg, profile->len, tpl->image);
+		if (!tpl->len) {
+			return -1;
+		}
+		if (output.device_size && output.device_size < tpl->len) {
+			fprintf(stderr, "%s image does not fit in a %u byte device\n", profile->name, output.device_size);
+			return -1;
+		}
+		if (profile->pcb && (tpl->pcb_serial = template_pcb_serial(tpl->image, tpl->len)) < 0) {
+			return -1;
+		}
+		if (tpl->len > batch->max_len) {
+			batch->max_len = tpl->len;
+		}
+	}
+	return 0;
+}
+
+static void print_boot_cost(const char *layout, const struct boot_cost *cost)
+{
+	printf("  %-10s %6u %6u %10u %10.3f %12.3f\n", layout, cost->bytes, cost->transactions,
+		cost->page_crossings, cost->total_us / 1000, cost->critical_us / 1000);
+}
+
+/**
+ * Print the modelled EC boot read cost of a profile in its current
+ * layout and in the proposed one.
+ */
+void report_boot_cost(const char *name, const void *cfg, size_t len)
+{
+	uint8_t proposed[IMAGE_MAX_LEN];
+	uint8_t encoded[IMAGE_MAX_LEN];
+	struct boot_cost current_cost, proposed_cost, compact_cost;
+	size_t proposed_len = boot_optimize(&boot, cfg, proposed, sizeof(proposed));
+	size_t compact_len;
+
+	boot_estimate(&boot, cfg, len, &current_cost);
+	boot_estimate(&boot, proposed, proposed_len, &proposed_cost);
+
+	printf("%s profile (%u kHz, %u byte pages, %u byte transfers)\n",
+		name, boot.bus_khz, boot.page_size, boot.max_xfer);
+	printf("  %-10s %6s %6s %10s %10s %12s\n", "layout", "bytes", "xfers", "crossings", "total ms", "critical ms");
+	print_boot_cost("current", &current_cost);
+	print_boot_cost("proposed", &proposed_cost);
+	compact_len = compact_encode(cfg, len, encoded, sizeof(encoded));
+	if (compact_len) {
+		compact_len = boot_optimize(&boot, encoded, proposed, sizeof(proposed));
+		boot_estimate(&boot, proposed, compact_len, &compact_cost);
+		print_boot_cost("v0.2", &compact_cost);
+	}
+	printf("  critical blocks ready %.3f ms earlier, full read %+.3f ms\n",
+		(current_cost.critical_us - proposed_cost.critical_us) / 1000,
+		(proposed_cost.total_us - current_cost.total_us) / 1000);
+}
+
+/**
+ * Run a checker over image files. 0.2 images are decoded to the 0.1 layout
+ * first. The checker returns the number of problems found, or -1.
+ *
+ * \return number of images that failed
+ */
+int check_images(char **files, int nfiles, int (*checker)(const char *, const uint8_t *, size_t), const char *what)
+{
+	uint8_t buf[IMAGE_MAX_LEN];
+	uint8_t expanded[IMAGE_MAX_LEN];
+	int failed = 0;
+
+	for (int f = 0; f < nfiles; f++) {
+		long len = load_image(files[f], buf, sizeof(buf));
+		const char *err = len < 0 ? "unreadable" : check_image(buf, len);
+		const uint8_t *image = buf;
+
+		/* Signatures cover the stored encoding */
+		if (!err && verify_key) {
+			err = verify_signature(buf, len, verify_key);
+		}
+		if (!err && is_compact(buf)) {
+			len = compact_decode(buf, len, expanded, sizeof(expanded));
+			image = expanded;
+			err = len ? NULL : "cannot decode";
+		}
+		if (err) {
+			fprintf(stderr, "%s: %s\n", files[f], err);
+			failed++;
+			continue;
+		}
+		if (checker(files[f], image, len)) {
+			failed++;
+		} else {
+			printf("%s: %s ok\n", files[f], what);
+		}
+	}
+	return failed;
+}
+
+/*
+ * Watch mode: station read-back dumps are verified, decoded and checked as
+ * they arrive, and the index keeps the latest outcome per unit, one line
+ * each (see struct dump_index):
+ *
+ *   serial,status,config_sha256,path,indexed_at
+ *
+ * The config hash covers the decoded (0.1) image with the per-unit fields
+ * cleared, as in the golden comparison, so every unit built from one
+ * configuration shares it whatever encoding it was written in.
+ */
+#define WATCH_INDEX_HEADER "# serial,status,config_sha256,path,indexed_at\n"
+/* The index file is rewritten at most this often while dumps come in */
+#define WATCH_INDEX_INTERVAL_US 500000
+
+struct watch_ingest {
+	struct watch_queue queue;
+	pthread_mutex_t lock;
+	struct dump_index index;
+	uint64_t index_written_us;
+	dev_t index_dev;
+	ino_t index_ino;
+	unsigned long indexed;
+	unsigned long failed;
+	uint64_t total_latency_us;
+	uint64_t max_latency_us;
+	bool error;
+};
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int sig)
+{
+	(void)sig;
+	watch_stop = 1;
+}
+
+/**
+ * Verify and decode one dump. The serial is filled in once the magic
+ * matches, the config hash once the image is intact.
+ *
+ * \return NULL if the dump is intact and consistent, otherwise the problem
+ */
+static const char *ingest_dump(const char *path, char *serial, uint8_t *hash, bool *hashed)
+{
+	uint8_t buf[IMAGE_MAX_LEN];
+	uint8_t decoded[IMAGE_MAX_LEN];
+	uint8_t work[IMAGE_MAX_LEN];
+	const uint8_t *image = buf;
+	struct sha256_ctx ctx;
+	struct check_result check;
+	long len = load_image(path, buf, sizeof(buf));
+	const char *err = len < 0 ? "unreadable" : check_image(buf, len);
+	size_t n;
+
+	if (len >= (long)sizeof(struct gpu_cfg_descriptor) &&
+			memcmp(view_desc_magic(buf), descriptor_magic, sizeof(descriptor_magic)) == 0) {
+		/* Keep a damaged serial from breaking the line */
+		for (n = 0; n < GPU_SERIAL_LEN && view_desc_serial(buf)[n]; n++) {
+			char c = view_desc_serial(buf)[n];
+			serial[n] = isgraph((unsigned char)c) && c != ',' ? c : '?';
+		}
+		serial[n] = '\0';
+	}
+	if (err) {
+		return err;
+	}
+	n = image_len(buf);
+	if (is_compact(buf)) {
+		n = compact_decode(buf, n, decoded, sizeof(decoded));
+		if (!n) {
+			return "cannot decode";
+		}
+		image = decoded;
+	}
+	unit_field_mask(image, n, work);
+	for (size_t i = 0; i < n; i++) {
+		work[i] &= image[i];
+	}
+	sha256_init(&ctx);
+	sha256_update(&ctx, work, n);
+	sha256_final(&ctx, hash);
+	*hashed = true;
+
+	if (verify_key) {
+		err = verify_signature(buf, len, verify_key);
+		if (err) {
+			return err;
+		}
+	}
+	if (config_check(image, n, &check)) {
+		return "inconsistent";
+	}
+	return NULL;
+}
+
+static void *ingest_thread(void *arg)
+{
+	struct watch_ingest *in = arg;
+	struct watch_item item;
+
+	while (!watch_queue_pop(&in->queue, &item)) {
+		char line[IMAGE_PATH_LEN + GPU_SERIAL_LEN + 2 * SHA256_DIGEST_LEN + 128];
+		char serial[GPU_SERIAL_LEN + 1] = "";
+		uint8_t hash[SHA256_DIGEST_LEN];
+		bool hashed = false;
+		const char *err = ingest_dump(item.path, serial, hash, &hashed);
+		struct timespec now;
+		uint64_t latency;
+		int n;
+
+		n = snprintf(line, sizeof(line), "%s,%s,", serial, err ? err : "ok");
+		for (int i = 0; hashed && i < SHA256_DIGEST_LEN; i++) {
+			n += sprintf(line + n, "%02x", hash[i]);
+		}
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(line + n, sizeof(line) - n, ",%s,%lld.%03ld\n", item.path, (long long)now.tv_sec,
+			 now.tv_nsec / 1000000);
+
+		pthread_mutex_lock(&in->lock);
+		if (dump_index_set(&in->index, serial[0] ? serial : item.path, line)) {
+			in->error = true;
+		}
+		latency = station_now_us() - item.queued_us;
+		in->indexed++;
+		in->failed += err != NULL;
+		in->total_latency_us += latency;
+		if (latency > in->max_latency_us) {
+			in->max_latency_us = latency;
+		}
+		pthread_mutex_unlock(&in->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Rewrite the index file if it is behind, at most every
+ * WATCH_INDEX_INTERVAL_US unless forced. Runs on the watcher thread, which
+ * is also the one that compares new files with the index.
+ */
+static void ingest_write_index(struct watch_ingest *in, bool force)
+{
+	uint64_t now = station_now_us();
+	struct stat st;
+
+	pthread_mutex_lock(&in->lock);
+	if (in->index.dirty && (force || now - in->index_written_us >= WATCH_INDEX_INTERVAL_US)) {
+		if (dump_index_write(&in->index, WATCH_INDEX_HEADER)) {
+			in->error = true;
+		} else if (stat(in->index.path, &st) == 0) {
+			in->index_dev = st.st_dev;
+			in->index_ino = st.st_ino;
+		}
+		in->index_written_us = now;
+	}
+	pthread_mutex_unlock(&in->lock);
+}
+
+static void ingest_found(void *ctx, const char *path)
+{
+	struct watch_ingest *in = ctx;
+	struct stat st;
+
+	/* The index may live in the watched directory */
+	if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) ||
+			(st.st_dev == in->index_dev && st.st_ino == in->index_ino)) {
+		return;
+	}
+	watch_queue_push(&in->queue, path);
+}
+
+/**
+ * Index the dumps dropped into dir until SIGINT or SIGTERM, on jobs worker
+ * threads. Dumps newer than the index are indexed first, so a restart
+ * catches up on what arrived in the meantime.
+ *
+ * \return 0 on success, -1 on error
+ */
+int watch_dumps(const char *dir, const char *index_path, int jobs)
+{
+	static struct watch_ingest in;
+	static struct dir_watch w;
+	struct sigaction sa = {.sa_handler = watch_signal};
+	pthread_t threads[WRITER_MAX_THREADS];
+	struct stat st;
+	time_t since = 0;
+	int started = 0;
+	int ret = 0;
+
+	if (jobs < 1) {
+		jobs = 1;
+	}
+	if (jobs > WRITER_MAX_THREADS) {
+		jobs = WRITER_MAX_THREADS;
+	}
+	if (stat(index_path, &st) == 0) {
+		since = st.st_mtime;
+	}
+	if (dump_index_open(&in.index, index_path)) {
+		return -1;
+	}
+	/* Compact an append-only index, or create an empty one */
+	in.index.dirty = true;
+	ingest_write_index(&in, true);
+	if (in.error) {
+		dump_index_close(&in.index);
+		return -1;
+	}
+	watch_queue_init(&in.queue);
+	pthread_mutex_init(&in.lock, NULL);
+
+	/* No SA_RESTART, so a stop request also ends a wait for events */
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	for (; started < jobs; started++) {
+		if (pthread_create(&threads[started], NULL, ingest_thread, &in)) {
+			break;
+		}
+	}
+	if (!started) {
+		fprintf(stderr, "failed to start the workers\n");
+		ret = -1;
+	} else if (dir_watch_open(&w, dir, since, ingest_found, &in) == 0) {
+		printf("watching %s, index = %s jobs = %d\n", dir, index_path, started);
+		fflush(stdout);
+		while (!watch_stop && dir_watch_next(&w) == 0) {
+			ingest_write_index(&in, false);
+		}
+		/* Interrupted by the stop request, or the directory went away */
+		if (!watch_stop) {
+			ret = -1;
+		}
+		dir_watch_close(&w);
+	} else {
+		ret = -1;
+	}
+
+	watch_queue_close(&in.queue);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	printf("indexed %lu dumps, %lu failed", in.indexed, in.failed);
+	if (in.indexed) {
+		printf(", latency mean %.2f ms, max %.2f ms", in.total_latency_us / 1000.0 / in.indexed,
+		       in.max_latency_us / 1000.0);
+	}
+	printf("\n");
+	ingest_write_index(&in, true);
+	dump_index_close(&in.index);
+	if (in.error) {
+		fprintf(stderr, "failed to write %s\n", index_path);
+		ret = -1;
+	}
+	pthread_mutex_destroy(&in.lock);
+	watch_queue_destroy(&in.queue);
+	return ret;
+}
+
+/*
+ * Differential round trips: random configurations are built the way the
+ * generator builds images, then decoded by the reference EC consumer and by
+ * read_eeprom's parser. Both must accept or reject each image alike and,
+ * when they accept it, agree on everything the EC would act on. Round r is
+ * built from an RNG seeded with the seed and r alone, so any round can be
+ * replayed whatever the thread count.
+ */
+#define FUZZ_CHUNK 256
+#define FUZZ_MAX_SAVED 10
+/* Most images are left intact, the rest damaged after sealing */
+#define FUZZ_DAMAGE_ONE_IN 4
+#define FUZZ_SIGNED_ONE_IN 16
+
+struct fuzz_stats {
+	unsigned long rounds;
+	unsigned long mismatches;
+	unsigned long status[EC_STATUS_COUNT];
+	/* Per coverage slot, over accepted images */
+	unsigned long images[EC_BLOCK_SLOTS];
+	unsigned long blocks[EC_BLOCK_SLOTS];
+	unsigned long skipped[EC_BLOCK_SLOTS];
+};
+
+struct fuzz_run {
+	const struct batch_profiles *batch;
+	/* Each profile's template with a valid signature, see fuzz_round_trips() */
+	struct profile_template signed_templates[SKU_MAX_PROFILES];
+	unsigned long rounds;
+	uint32_t seed;
+	unsigned long next;
+	pthread_mutex_t lock;
+	int saved;
+	struct fuzz_stats total;
+};
+
+static uint32_t fuzz_round_seed(uint32_t seed, unsigned long round)
+{
+	uint32_t s = seed * 0x9e3779b1 ^ (uint32_t)round * 0x85ebca77 ^ (uint32_t)(round >> 32);
+
+	s ^= s >> 15;
+	s *= 0x2c1b3c6d;
+	s ^= s >> 12;
+	return s ? s : 1;
+}
+
+/* A fan curve block, now and then with more points than its body holds */
+static size_t fuzz_fan_curve(uint8_t *image, size_t len, uint32_t *rng)
+{
+	uint8_t curve[GPU_MAX_BLOCK_LEN];
+	size_t count = fuzz_rand(rng) % (FAN_CURVE_MAX_POINTS + 4);
+	size_t points = count < FAN_CURVE_MAX_POINTS ? count : FAN_CURVE_MAX_POINTS;
+	size_t body_len = sizeof(struct gpu_cfg_fan_curve) + points * sizeof(uint16_t);
+
+	view_fan_curve_set_idx(curve, fuzz_rand(rng) % (EC_MAX_FANS + 1));
+	view_fan_curve_set_temp_start(curve, fuzz_rand(rng) % 1000);
+	view_fan_curve_set_temp_step(curve, 1 + fuzz_rand(rng) % 16);
+	view_fan_curve_set_count(curve, count);
+	for (size_t i = 0; i < points; i++) {
+		view_fan_curve_set_rpm(curve, i, fuzz_rand(rng) % 8000);
+	}
+	if (fuzz_rand(rng) % 8 == 0) {
+		body_len = fuzz_rand(rng) % (body_len + 1);
+	}
+	len = append_block(image, len, IMAGE_MAX_LEN, GPUCFG_TYPE_FAN_CURVE, curve, body_len) ?: len;
+	return len;
+}
+
+/* A block of any type with random content and length */
+static size_t fuzz_random_block(uint8_t *image, size_t len, uint32_t *rng)
+{
+	uint8_t body[GPU_MAX_BLOCK_LEN];
+	uint8_t type = fuzz_rand(rng) % (EC_SLOT_UNKNOWN + 4);
+	uint8_t body_len = fuzz_rand(rng) % 48;
+
+	for (int i = 0; i < body_len; i++) {
+		body[i] = fuzz_rand(rng);
+	}
+	return append_block(image, len, IMAGE_MAX_LEN, type, body, body_len) ?: len;
+}
+
+/* Drop one block of the chain, or do nothing if it has none */
+static size_t fuzz_drop_block(uint8_t *image, size_t len, uint32_t *rng)
+{
+	struct block_index idx;
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t size;
+	int victim;
+
+	block_index_build(&idx, image, len);
+	if (!idx.nblocks) {
+		return len;
+	}
+	victim = fuzz_rand(rng) % idx.nblocks;
+	for (int i = 0; i < victim; i++) {
+		offset += sizeof(struct gpu_block_header) + view_block_block_length(image + offset);
+	}
+	size = sizeof(struct gpu_block_header) + view_block_block_length(image + offset);
+	memmove(image + offset, image + offset + size, len - offset - size);
+	view_desc_set_descriptor_length(image, view_desc_descriptor_length(image) - size);
+	return len - size;
+}
+
+/* Damage as a bad EEPROM, a torn write or a newer generator would do it */
+static size_t fuzz_damage(uint8_t *image, size_t len, uint32_t *rng)
+{
+	size_t n;
+
+	if (fuzz_rand(rng) % FUZZ_DAMAGE_ONE_IN == 0) {
+		switch (fuzz_rand(rng) % 5) {
+			case 0:
+				image[fuzz_rand(rng) % len] ^= 1 << fuzz_rand(rng) % 8;
+				break;
+			case 1:
+				len = fuzz_rand(rng) % len;
+				break;
+			case 2:
+				/* Both CRCs intact over a block chain that does not add up */
+				n = fuzz_rand(rng) % 5;
+				if (fuzz_rand(rng) % 2 && len - n > sizeof(struct gpu_cfg_descriptor)) {
+					len -= n;
+				} else {
+					for (size_t i = 0; i < n; i++) {
+						image[len++] = fuzz_rand(rng);
+					}
+				}
+				view_desc_set_descriptor_length(image, len - sizeof(struct gpu_cfg_descriptor));
+				view_desc_set_descriptor_crc32(image, descriptor_body_crc(image));
+				view_desc_set_crc32(image, descriptor_header_crc(image));
+				break;
+			case 3:
+				view_desc_set_descriptor_version_major(image, fuzz_rand(rng) % 3);
+				view_desc_set_crc32(image, descriptor_header_crc(image));
+				break;
+			default:
+				/* Read back from a larger device */
+				n = fuzz_rand(rng) % 64;
+				memset(image + len, 0xff, n);
+				len += n;
+				break;
+		}
+	}
+	return len;
+}
+
+/* A profile template with random field edits and blocks, sealed */
+static size_t fuzz_build(const struct profile_template *tpl, uint32_t *rng, uint8_t *image)
+{
+	uint8_t work[IMAGE_MAX_LEN];
+	struct block_index idx;
+	int edits = fuzz_rand(rng) % 6;
+	size_t len = tpl->len;
+	size_t n;
+
+	memcpy(image, tpl->image, len);
+	for (int i = 0; i < GPU_SERIAL_LEN; i++) {
+		view_desc_serial_mut(image)[i] = 'A' + fuzz_rand(rng) % 26;
+	}
+
+	/* Field edits through the schema, like --set and manifest columns */
+	if (!is_compact(image)) {
+		block_index_build(&idx, image, len);
+		for (int i = 0; i < edits; i++) {
+			const struct cfg_field *field = &cfg_fields[fuzz_rand(rng) % CFG_FIELD_COUNT];
+			long offset = block_index_find(&idx, field->block, fuzz_rand(rng) % 4);
+			uint32_t v = fuzz_rand(rng);
+
+			if (offset < 0 || field->kind == FIELD_STRING) {
+				continue;
+			}
+			/* Small values hit the interesting cases: indexes, GPIO numbers, versions */
+			field_store(image + offset + field->offset, field->width, fuzz_rand(rng) % 4 ? v % 24 : v);
+		}
+	}
+	if (fuzz_rand(rng) % 4 == 0 && (n = add_gpio_actions(image, len, IMAGE_MAX_LEN))) {
+		len = n;
+	}
+	if (fuzz_rand(rng) % 4 == 0) {
+		len = fuzz_fan_curve(image, len, rng);
+	}
+	if (fuzz_rand(rng) % 8 == 0) {
+		len = fuzz_random_block(image, len, rng);
+	}
+	if (fuzz_rand(rng) % 8 == 0) {
+		len = fuzz_drop_block(image, len, rng);
+	}
+	if (!is_compact(image) && fuzz_rand(rng) % 4 == 0 && (n = compact_encode(image, len, work, sizeof(work)))) {
+		memcpy(image, work, n);
+		len = n;
+	}
+	if (fuzz_rand(rng) % 8 == 0) {
+		len = boot_optimize(&boot, image, work, sizeof(work));
+		memcpy(image, work, len);
+	}
+	seal_image(image, len);
+	return len;
+}
+
+/**
+ * Build the image of one round: a profile template with random field
+ * edits and optional blocks, encoded and laid out like the generator does,
+ * or now and then the profile's signed image, and sometimes damaged.
+ *
+ * \return length of the image
+ */
+static size_t fuzz_image(const struct fuzz_run *run, uint32_t *rng, uint8_t *image)
+{
+	int profile = fuzz_rand(rng) % skus.nprofiles;
+	const struct profile_template *signed_tpl = &run->signed_templates[profile];
+	size_t len;
+
+	if (signed_tpl->len && fuzz_rand(rng) % FUZZ_SIGNED_ONE_IN == 0) {
+		len = signed_tpl->len;
+		memcpy(image, signed_tpl->image, len);
+	} else {
+		len = fuzz_build(&run->batch->templates[profile], rng, image);
+	}
+	return fuzz_damage(image, len, rng);
+}
+
+static void fuzz_save(struct fuzz_run *run, unsigned long round, const char *what,
+		      const struct ec_config *ref, const char *err, const uint8_t *image, size_t len)
+{
+	char path[64];
+
+	pthread_mutex_lock(&run->lock);
+	snprintf(path, sizeof(path), "fuzz-%lu.bin", round);
+	fprintf(stderr, "round %lu: %s differs (reference %s, parser %s)", round, what,
+		ec_status_names[ref->status], err ? err : "ok");
+	if (run->saved < FUZZ_MAX_SAVED && write_image(path, image, len) == 0) {
+		run->saved++;
+		fprintf(stderr, ", image saved to %s", path);
+	}
+	fprintf(stderr, "\n");
+	pthread_mutex_unlock(&run->lock);
+}
+
+static void *fuzz_thread(void *arg)
+{
+	struct fuzz_run *run = arg;
+	struct fuzz_stats stats = {0};
+	struct ec_config ref, dec;
+	uint8_t image[IMAGE_MAX_LEN];
+	unsigned long start;
+
+	while ((start = __atomic_fetch_add(&run->next, FUZZ_CHUNK, __ATOMIC_RELAXED)) < run->rounds) {
+		unsigned long end = start + FUZZ_CHUNK < run->rounds ? start + FUZZ_CHUNK : run->rounds;
+
+		for (unsigned long round = start; round < end; round++) {
+			uint32_t rng = fuzz_round_seed(run->seed, round);
+			size_t len = fuzz_image(run, &rng, image);
+			bool accepted = ec_consume(image, len, &ref) == EC_OK;
+			const char *err = decode_image(image, len, &rng, &dec);
+			const char *what = NULL;
+
+			stats.rounds++;
+			stats.status[ref.status]++;
+			if (accepted != !err) {
+				what = "verdict";
+			} else if (accepted) {
+				what = ec_config_diff(&ref, &dec);
+				for (int slot = 0; slot < EC_BLOCK_SLOTS; slot++) {
+					stats.images[slot] += ref.blocks[slot] != 0;
+					stats.blocks[slot] += ref.blocks[slot];
+					stats.skipped[slot] += ref.skipped[slot];
+				}
+			}
+			if (what) {
+				stats.mismatches++;
+				fuzz_save(run, round, what, &ref, err, image, len);
+			}
+		}
+	}
+
+	pthread_mutex_lock(&run->lock);
+	run->total.rounds += stats.rounds;
+	run->total.mismatches += stats.mismatches;
+	for (int i = 0; i < EC_STATUS_COUNT; i++) {
+		run->total.status[i] += stats.status[i];
+	}
+	for (int slot = 0; slot < EC_BLOCK_SLOTS; slot++) {
+		run->total.images[slot] += stats.images[slot];
+		run->total.blocks[slot] += stats.blocks[slot];
+		run->total.skipped[slot] += stats.skipped[slot];
+	}
+	pthread_mutex_unlock(&run->lock);
+	return NULL;
+}
+
+/**
+ * Run rounds differential round trips between the generator, the reference
+ * EC consumer and read_eeprom's parser on jobs threads, then print how many
+ * images each side rejected and how often each block type was exercised.
+ *
+ * \return 0 if both sides agreed on every image, -1 otherwise
+ */
+int fuzz_round_trips(unsigned long rounds, uint32_t seed, int jobs)
+{
+	static struct batch_profiles batch;
+	static struct fuzz_run run;
+	pthread_t threads[WRITER_MAX_THREADS];
+	const struct fuzz_stats *t = &run.total;
+	static struct ed25519_key key;
+	uint8_t key_seed[ED25519_SEED_LEN];
+	uint32_t key_rng;
+	uint64_t start_us;
+	double seconds;
+	int started = 0;
+
+	if (jobs < 1) {
+		jobs = 1;
+	}
+	if (jobs > WRITER_MAX_THREADS) {
+		jobs = WRITER_MAX_THREADS;
+	}
+	if (prepare_profiles(&batch, NULL)) {
+		return -1;
+	}
+	run.batch = &batch;
+	run.rounds = rounds;
+	run.seed = seed;
+	/*
+	 * Signing is far slower than a round, so signed images are signed once
+	 * per profile here, with a key derived from the seed, and used as is.
+	 */
+	key_rng = fuzz_round_seed(seed, 0);
+	for (size_t i = 0; i < sizeof(key_seed); i++) {
+		key_seed[i] = fuzz_rand(&key_rng);
+	}
+	ed25519_key_from_seed(&key, key_seed);
+	for (int i = 0; i < skus.nprofiles; i++) {
+		struct profile_template *tpl = &run.signed_templates[i];
+		struct gpu_cfg_signature sig = {0};
+
+		*tpl = batch.templates[i];
+		if (tpl->len) {
+			tpl->len = append_block(tpl->image, tpl->len, IMAGE_MAX_LEN, GPUCFG_TYPE_SIGNATURE, &sig, sizeof(sig));
+		}
+		if (tpl->len) {
+			sign_image(tpl->image, tpl->len, &key);
+			seal_image(tpl->image, tpl->len);
+		}
+	}
+	pthread_mutex_init(&run.lock, NULL);
+
+	start_us = station_now_us();
+	for (; started < jobs - 1; started++) {
+		if (pthread_create(&threads[started], NULL, fuzz_thread, &run)) {
+			break;
+		}
+	}
+	fuzz_thread(&run);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	seconds = (station_now_us() - start_us) / 1e6;
+	pthread_mutex_destroy(&run.lock);
+
+	printf("%lu round trips in %.2f s (%.2f M/min) on %d threads, seed %u\n", t->rounds, seconds,
+	       seconds > 0 ? t->rounds / seconds * 60 / 1e6 : 0, started + 1, seed);
+	printf("  accepted %lu, rejected", t->status[EC_OK]);
+	for (int i = EC_OK + 1; i < EC_STATUS_COUNT; i++) {
+		printf("%s %s %lu", i == EC_OK + 1 ? "" : ",", ec_status_names[i], t->status[i]);
+	}
+	printf("\n  %-14s %10s %12s %12s\n", "block", "images", "blocks", "skipped");
+	for (int slot = 0; slot < EC_BLOCK_SLOTS; slot++) {
+		printf("  %-14s %10lu %12lu %12lu\n", ec_block_names[slot], t->images[slot], t->blocks[slot],
+		       t->skipped[slot]);
+	}
+	printf("%lu mismatches\n", t->mismatches);
+	return t->mismatches ? -1 : 0;
+}
+
+#define MAX_FAN_SWEEPS 8
+#define MAX_FAN_VARIANTS (1 << 20)
+#define TRACE_LINE_LEN 256
+
+struct fan_sweep {
+	struct field_ref ref;
+	uint32_t start;
+	uint32_t step;
+	uint32_t count;
+};
+
+/**
+ * Parse a --sweep argument of the form "block[index].field=start:end[:step]".
+ */
+static int parse_fan_sweep(const char *arg, struct fan_sweep *sweep)
+{
+	char path[64];
+	const char *eq = strchr(arg, '=');
+	unsigned long start, end, step = 1;
+	char *p;
+
+	if (!eq || (size_t)(eq - arg) >= sizeof(path)) {
+		return -1;
+	}
+	memcpy(path, arg, eq - arg);
+	path[eq - arg] = '\0';
+	if (parse_field_ref(path, &sweep->ref) || sweep->ref.field->kind != FIELD_UINT || sweep->ref.field->read_only) {
+		return -1;
+	}
+	start = strtoul(eq + 1, &p, 0);
+	if (p == eq + 1 || *p != ':') {
+		return -1;
+	}
+	end = strtoul(p + 1, &p, 0);
+	if (*p == ':') {
+		step = strtoul(p + 1, &p, 0);
+	}
+	if (*p != '\0' || end < start || step == 0) {
+		return -1;
+	}
+	sweep->start = start;
+	sweep->step = step;
+	sweep->count = (end - start) / step + 1;
+	return 0;
+}
+
+/**
+ * Load every trace file in dir into one array of Kelvin temperatures. Each
+ * line holds one sample in degrees Celsius; with several comma separated
+ * columns the last one is used. Empty lines and lines starting with '#' are
+ * skipped.
+ *
+ * \return number of samples, -1 on error
+ */
+static long load_traces(char *dir, float **temps, int *ntraces)
+{
+	struct file_list files = {0};
+	char line[TRACE_LINE_LEN];
+	size_t n = 0, cap = 0;
+
+	*temps = NULL;
+	if (collect_files(&files, &dir, 1)) {
+		return -1;
+	}
+	for (int i = 0; i < files.count; i++) {
+		FILE *fptr = fopen(files.paths[i], "r");
+		int lineno = 0;
+
+		if (!fptr) {
+			fprintf(stderr, "%s: %s\n", files.paths[i], strerror(errno));
+			goto err;
+		}
+		while (fgets(line, sizeof(line), fptr)) {
+			char *field = strrchr(line, ',');
+			char *end;
+			double temp;
+
+			lineno++;
+			field = field ? field + 1 : line;
+			while (isspace((unsigned char)*field)) {
+				field++;
+			}
+			if (*field == '\0' || line[0] == '#') {
+				continue;
+			}
+			temp = strtod(field, &end);
+			if (end == field || (*end && !isspace((unsigned char)*end))) {
+				fprintf(stderr, "%s:%d: invalid temperature\n", files.paths[i], lineno);
+				fclose(fptr);
+				goto err;
+			}
+			if (n == cap) {
+				float *grown;
+				cap = cap ? cap * 2 : 65536;
+				grown = realloc(*temps, cap * sizeof(float));
+				if (!grown) {
+					fclose(fptr);
+					goto err;
+				}
+				*temps = grown;
+			}
+			(*temps)[n++] = C_TO_K(temp);
+		}
+		fclose(fptr);
+	}
+	*ntraces = files.count;
+	file_list_free(&files);
+	return n;
+
+err:
+	free(*temps);
+	*temps = NULL;
+	file_list_free(&files);
+	return -1;
+}
+
+/**
+ * Fill in variant v of the simulator from an image, after applying the
+ * sweep values selected by v.
+ *
+ * \return 0 on success, -1 if a fan has no temperature thresholds
+ */
+static int fan_sim_variant(struct fan_sim *sim, int v, const uint8_t *image, size_t len,
+		const struct block_index *idx, const struct fan_sweep *sweeps, const long *offsets, int nsweeps)
+{
+	uint8_t work[IMAGE_MAX_LEN];
+	struct gpu_cfg_fan fan;
+	int rest = v;
+
+	memcpy(work, image, len);
+	for (int i = nsweeps - 1; i >= 0; i--) {
+		field_store(work + offsets[i], sweeps[i].ref.field->width,
+			sweeps[i].start + rest % sweeps[i].count * sweeps[i].step);
+		rest /= sweeps[i].count;
+	}
+	for (int f = 0; f < sim->nfans; f++) {
+		uint16_t temp_off, temp_max;
+
+		memcpy(&fan, work + block_index_find(idx, &cfg_blocks[BLK_FAN], f), sizeof(fan));
+		if (!fan_curve_limits(work, idx, &fan, &temp_off, &temp_max)) {
+			return -1;
+		}
+		sim->temp_off[f][v] = temp_off;
+		sim->temp_max[f][v] = temp_max;
+		sim->min_rpm[f][v] = fan.min_rpm;
+		sim->max_rpm[f][v] = fan.max_rpm;
+	}
+	return 0;
+}
+
+static void print_fan_report(const struct fan_sim *sim, double period)
+{
+	for (int f = 0; f < sim->nfans; f++) {
+		printf("Fan %d: %.0f-%.0fK, %.0f-%.0f RPM\n", f, sim->temp_off[f][0], sim->temp_max[f][0],
+			sim->min_rpm[f][0], sim->max_rpm[f][0]);
+		printf("  At max RPM:  %8.1fs %5.1f%%\n", sim->saturated[f][0] * period,
+			100.0 * sim->saturated[f][0] / sim->nsamples);
+		printf("  Off:         %8.1fs %5.1f%%\n", sim->off[f][0] * period,
+			100.0 * sim->off[f][0] / sim->nsamples);
+		for (int b = 0; b < FAN_SIM_BINS; b++) {
+			uint32_t count = sim->hist[f][b];
+			if (!count) {
+				continue;
+			}
+			if (b == FAN_SIM_BINS - 1) {
+				printf("  %5d+      RPM %5.1f%%\n", b * FAN_SIM_BIN_RPM, 100.0 * count / sim->nsamples);
+			} else {
+				printf("  %5d-%5d RPM %5.1f%%\n", b * FAN_SIM_BIN_RPM, (b + 1) * FAN_SIM_BIN_RPM - 1,
+					100.0 * count / sim->nsamples);
+			}
+		}
+	}
+	printf("Acoustics: %.1f dBA average, %.1f dBA peak\n", fan_sim_leq(sim, 0), fan_sim_peak_dba(sim, 0));
+}
+
+/**
+ * Replay the traces in tracedir against the fan policy of an image, or
+ * against every combination of sweep values applied to it.
+ *
+ * \return 0 on success, -1 on error
+ */
+int simulate_fans(char *tracedir, const uint8_t *image, size_t len, const struct fan_sweep *sweeps,
+		int nsweeps, double period, int jobs)
+{
+	long offsets[MAX_FAN_SWEEPS];
+	struct block_index idx;
+	struct fan_sim sim;
+	struct timespec t0, t1;
+	float *temps;
+	long nsamples;
+	long nvariants = 1;
+	long nvalid = 0;
+	bool *valid = NULL;
+	int ntraces;
+	int nfans = 0;
+	int ret = 0;
+
+	block_index_build(&idx, image, len);
+	while (nfans < FAN_SIM_MAX_FANS && block_index_find(&idx, &cfg_blocks[BLK_FAN], nfans) >= 0) {
+		nfans++;
+	}
+	if (!nfans) {
+		fprintf(stderr, "Image has no fan configuration\n");
+		return -1;
+	}
+	for (int i = 0; i < nsweeps; i++) {
+		offsets[i] = block_index_find(&idx, sweeps[i].ref.field->block, sweeps[i].ref.index);
+		if (offsets[i] < 0) {
+			fprintf(stderr, "Image has no %s[%d]\n", sweeps[i].ref.field->block->name, sweeps[i].ref.index);
+			return -1;
+		}
+		offsets[i] += sweeps[i].ref.field->offset;
+		nvariants *= sweeps[i].count;
+		if (nvariants > MAX_FAN_VARIANTS) {
+			fprintf(stderr, "At most %d variants are supported\n", MAX_FAN_VARIANTS);
+			return -1;
+		}
+	}
+
+	nsamples = load_traces(tracedir, &temps, &ntraces);
+	if (nsamples <= 0) {
+		fprintf(stderr, "No samples in %s\n", tracedir);
+		return -1;
+	}
+	if (fan_sim_init(&sim, nfans, nvariants)) {
+		fprintf(stderr, "Out of memory\n");
+		fan_sim_free(&sim);
+		free(temps);
+		return -1;
+	}
+	/* Sweeps may produce variants with temp_fan_max <= temp_fan_off, leave them out */
+	valid = calloc(nvariants, sizeof(bool));
+	for (int v = 0; valid && v < nvariants; v++) {
+		valid[v] = fan_sim_variant(&sim, v, image, len, &idx, sweeps, offsets, nsweeps) == 0;
+		nvalid += valid[v];
+	}
+	if (!nvalid) {
+		fprintf(stderr, valid ? "Image has a fan without temperature thresholds\n" : "Out of memory\n");
+		ret = -1;
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (fan_sim_levels(&sim, temps, nsamples)) {
+		fprintf(stderr, "Out of memory\n");
+		ret = -1;
+		goto out;
+	}
+	fan_sim_run(&sim, jobs);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "%ld variant(s) x %ld samples (%zu levels) from %d trace(s) in %.3fs\n", nvalid, nsamples,
+		sim.nlevels, ntraces, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+
+	if (!nsweeps) {
+		printf("Traces:      %d, %ld samples, %.1fs\n", ntraces, nsamples, nsamples * period);
+		print_fan_report(&sim, period);
+		goto out;
+	}
+
+	/* One row per variant, percentages of the total trace time */
+	for (int i = 0; i < nsweeps; i++) {
+		printf("%s[%d].%s\t", sweeps[i].ref.field->block->name, sweeps[i].ref.index, sweeps[i].ref.field->name);
+	}
+	for (int f = 0; f < nfans; f++) {
+		printf("fan%d_max%%\tfan%d_off%%\t", f, f);
+	}
+	printf("avg_dba\tpeak_dba\n");
+	for (int v = 0; v < nvariants; v++) {
+		int rest = v;
+		uint32_t values[MAX_FAN_SWEEPS];
+
+		if (!valid[v]) {
+			continue;
+		}
+		for (int i = nsweeps - 1; i >= 0; i--) {
+			values[i] = sweeps[i].start + rest % sweeps[i].count * sweeps[i].step;
+			rest /= sweeps[i].count;
+		}
+		for (int i = 0; i < nsweeps; i++) {
+			printf("%u\t", values[i]);
+		}
+		for (int f = 0; f < nfans; f++) {
+			printf("%.2f\t%.2f\t", 100.0 * sim.saturated[f][v] / nsamples, 100.0 * sim.off[f][v] / nsamples);
+		}
+		printf("%.1f\t%.1f\n", fan_sim_leq(&sim, v), fan_sim_peak_dba(&sim, v));
+	}
+
+out:
+	fan_sim_free(&sim);
+	free(valid);
+	free(temps);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	int gpuflag = 0;
+	int ssdflag = 0;
+	char *serialvalue = NULL;
+	char *pcbvalue = NULL;
+	char *outfilename = "eeprom.bin";
+	char *infilename = NULL;
+	char *manifestname = NULL;
+	char *outdir = ".";
+	int jobs = 1;
+	bool jobs_set = false;
+	int sites = 0;
+	struct field_edit edits[MAX_FIELD_EDITS];
+	int nedits = 0;
+	char *query = NULL;
+	bool boot_cost = false;
+	bool simulate_gpio = false;
+	bool verify_fan_curve = false;
+	bool audit = false;
+	char *golden = NULL;
+	char *trace_dir = NULL;
+	struct fan_sweep sweeps[MAX_FAN_SWEEPS];
+	int nsweeps = 0;
+	double trace_period = 1.0;
+	char *sign_key_file = NULL;
+	char *verify_key_file = NULL;
+	char *export_pubkey = NULL;
+	char *export_path = NULL;
+	char *site_specs[STATION_MAX_SITES];
+	int nsite_specs = 0;
+	int site_timeout = 100;
+	int site_retries = 2;
+	int migrate_to = -1;
+	char *hash_path = NULL;
+	char *watch_dir = NULL;
+	char *index_path = "index.csv";
+	unsigned long fuzz_rounds = 0;
+	uint32_t fuzz_seed = 1;
+	bool skip_desc_crc = false;
+	bool read_stats = false;
+	static struct ed25519_key key;
+	static struct ed25519_pubkey pubkey;
+	static struct ed25519_pubkey sign_pubkey;
+	static struct batch_profiles batch;
+	const struct sku_profile *forced = NULL;
+	const struct sku_profile *profile;
+	const struct profile_template *tpl;
+	const char *err;
+	uint8_t image[IMAGE_MAX_LEN];
+	size_t len;
+	struct file_list files = {0};
+	int ret = 0;
+	int c;
+
+	opterr = 0;
+
+	enum {
+		OPT_SET = 0x100,
+		OPT_GET,
+		OPT_BOOT_COST,
+		OPT_BOOT_LAYOUT,
+		OPT_I2C_KHZ,
+		OPT_I2C_XFER,
+		OPT_I2C_PAGE,
+		OPT_COMPACT,
+		OPT_GPIO_ACTIONS,
+		OPT_SIMULATE_GPIO,
+		OPT_FAN_CURVE,
+		OPT_VERIFY_FAN_CURVE,
+		OPT_SIMULATE_FAN,
+		OPT_SWEEP,
+		OPT_TRACE_PERIOD,
+		OPT_DIFF_GOLDEN,
+		OPT_CHECK,
+		OPT_SIGN_KEY,
+		OPT_VERIFY_SIG,
+		OPT_EXPORT_PUBKEY,
+		OPT_EXPORT_COLUMNS,
+		OPT_SITE,
+		OPT_SITE_TIMEOUT,
+		OPT_SITE_RETRIES,
+		OPT_MIGRATE,
+		OPT_HASH_MANIFEST,
+		OPT_WATCH,
+		OPT_INDEX,
+		OPT_FUZZ,
+		OPT_FUZZ_SEED,
+		OPT_SKIP_DESC_CRC,
+		OPT_READ_STATS,
+	};
+	static const struct option long_options[] = {
+		{"set", required_argument, NULL, OPT_SET},
+		{"get", required_argument, NULL, OPT_GET},
+		{"boot-cost", no_argument, NULL, OPT_BOOT_COST},
+		{"boot-layout", no_argument, NULL, OPT_BOOT_LAYOUT},
+		{"i2c-khz", required_argument, NULL, OPT_I2C_KHZ},
+		{"i2c-xfer", required_argument, NULL, OPT_I2C_XFER},
+		{"i2c-page", required_argument, NULL, OPT_I2C_PAGE},
+		{"compact", no_argument, NULL, OPT_COMPACT},
+		{"gpio-actions", no_argument, NULL, OPT_GPIO_ACTIONS},
+		{"simulate-gpio", no_argument, NULL, OPT_SIMULATE_GPIO},
+		{"fan-curve", no_argument, NULL, OPT_FAN_CURVE},
+		{"verify-fan-curve", no_argument, NULL, OPT_VERIFY_FAN_CURVE},
+		{"simulate-fan", required_argument, NULL, OPT_SIMULATE_FAN},
+		{"sweep", required_argument, NULL, OPT_SWEEP},
+		{"trace-period", required_argument, NULL, OPT_TRACE_PERIOD},
+		{"diff-golden", required_argument, NULL, OPT_DIFF_GOLDEN},
+		{"check", no_argument, NULL, OPT_CHECK},
+		{"sign-key", required_argument, NULL, OPT_SIGN_KEY},
+		{"verify-sig", required_argument, NULL, OPT_VERIFY_SIG},
+		{"export-pubkey", required_argument, NULL, OPT_EXPORT_PUBKEY},
+		{"export-columns", required_argument, NULL, OPT_EXPORT_COLUMNS},
+		{"site", required_argument, NULL, OPT_SITE},
+		{"site-timeout", required_argument, NULL, OPT_SITE_TIMEOUT},
+		{"site-retries", required_argument, NULL, OPT_SITE_RETRIES},
+		{"migrate", required_argument, NULL, OPT_MIGRATE},
+		{"hash-manifest", required_argument, NULL, OPT_HASH_MANIFEST},
+		{"watch", required_argument, NULL, OPT_WATCH},
+		{"index", required_argument, NULL, OPT_INDEX},
+		{"fuzz", required_argument, NULL, OPT_FUZZ},
+		{"fuzz-seed", required_argument, NULL, OPT_FUZZ_SEED},
+		{"skip-desc-crc", no_argument, NULL, OPT_SKIP_DESC_CRC},
+		{"read-stats", no_argument, NULL, OPT_READ_STATS},
+		{NULL, 0, NULL, 0},
+	};
+
+	while ((c = getopt_long (argc, argv, "gdvs:p:o:i:b:j:f:S:P:n:", long_options, NULL)) != -1)
+	switch (c)
+	{
+	case OPT_SET:
+		if (nedits == MAX_FIELD_EDITS) {
+			fprintf(stderr, "At most %d --set options are supported\n", MAX_FIELD_EDITS);
+			return 1;
+		}
+		if (parse_field_edit(optarg, &edits[nedits])) {
+			fprintf(stderr, "Invalid --set '%s', expected block[index].field=value\n", optarg);
+			return 1;
+		}
+		nedits++;
+		break;
+	case OPT_GET:
+		query = optarg;
+		break;
+	case OPT_BOOT_COST:
+		boot_cost = true;
+		break;
+	case OPT_BOOT_LAYOUT:
+		boot_layout = true;
+		break;
+	case OPT_I2C_KHZ:
+		boot.bus_khz = strtoul(optarg, NULL, 0);
+		break;
+	case OPT_I2C_XFER:
+		boot.max_xfer = strtoul(optarg, NULL, 0);
+		break;
+	case OPT_I2C_PAGE:
+		boot.page_size = strtoul(optarg, NULL, 0);
+		break;
+	case OPT_COMPACT:
+		compact = true;
+		break;
+	case OPT_GPIO_ACTIONS:
+		gpio_actions = true;
+		break;
+	case OPT_SIMULATE_GPIO:
+		simulate_gpio = true;
+		break;
+	case OPT_FAN_CURVE:
+		fan_curve = true;
+		break;
+	case OPT_VERIFY_FAN_CURVE:
+		verify_fan_curve = true;
+		break;
+	case OPT_SIMULATE_FAN:
+		trace_dir = optarg;
+		break;
+	case OPT_SWEEP:
+		if (nsweeps == MAX_FAN_SWEEPS) {
+			fprintf(stderr, "At most %d --sweep options are supported\n", MAX_FAN_SWEEPS);
+			return 1;
+		}
+		if (parse_fan_sweep(optarg, &sweeps[nsweeps])) {
+			fprintf(stderr, "Invalid --sweep '%s', expected block[index].field=start:end[:step]\n", optarg);
+			return 1;
+		}
+		nsweeps++;
+		break;
+	case OPT_CHECK:
+		audit = true;
+		break;
+	case OPT_DIFF_GOLDEN:
+		golden = optarg;
+		break;
+	case OPT_SIGN_KEY:
+		sign_key_file = optarg;
+		break;
+	case OPT_VERIFY_SIG:
+		verify_key_file = optarg;
+		break;
+	case OPT_EXPORT_PUBKEY:
+		export_pubkey = optarg;
+		break;
+	case OPT_EXPORT_COLUMNS:
+		export_path = optarg;
+		break;
+	case OPT_SITE:
+		if (nsite_specs == STATION_MAX_SITES) {
+			fprintf(stderr, "At most %d --site options are supported\n", STATION_MAX_SITES);
+			return 1;
+		}
+		site_specs[nsite_specs++] = optarg;
+		break;
+	case OPT_SITE_TIMEOUT:
+		site_timeout = atoi(optarg);
+		break;
+	case OPT_SITE_RETRIES:
+		site_retries = atoi(optarg);
+		break;
+	case OPT_MIGRATE: {
+		char *end;
+		long major = strtol(optarg, &end, 10);
+		long minor = *end == '.' ? strtol(end + 1, &end, 10) : -1;
+		if (*end || major != 0 || minor < 0 || !descriptor_version_find(minor)) {
+			fprintf(stderr, "Unsupported --migrate version '%s' (0.%d or 0.%d)\n", optarg,
+				GPU_CFG_VERSION_MINOR, GPU_CFG_VERSION_MINOR_COMPACT);
+			return 1;
+		}
+		migrate_to = minor;
+		break;
+	}
+	case OPT_HASH_MANIFEST:
+		hash_path = optarg;
+		break;
+	case OPT_WATCH:
+		watch_dir = optarg;
+		break;
+	case OPT_INDEX:
+		index_path = optarg;
+		break;
+	case OPT_FUZZ:
+		fuzz_rounds = strtoul(optarg, NULL, 0);
+		break;
+	case OPT_FUZZ_SEED:
+		fuzz_seed = strtoul(optarg, NULL, 0);
+		break;
+	case OPT_SKIP_DESC_CRC:
+		skip_desc_crc = true;
+		break;
+	case OPT_READ_STATS:
+		read_stats = true;
+		break;
+	case OPT_TRACE_PERIOD:
+		trace_period = strtoul(optarg, NULL, 0) / 1000.0;
+		break;
+	case 'g':
+		gpuflag = 1;
+		break;
+	case 'd':
+		ssdflag = 1;
+		break;
+	case 's':
+		serialvalue = optarg;
+		break;
+	case 'p':
+		pcbvalue = optarg;
+		break;
+	case 'o':
+		outfilename = optarg;
+		outdir = optarg;
+		break;
+	case 'i':
+		infilename = optarg;
+		break;
+	case 'v':
+		verbose = true;
+		break;
+	case 'b':
+		manifestname = optarg;
+		break;
+	case 'j':
+		jobs = atoi(optarg);
+		jobs_set = true;
+		break;
+	case 'f':
+		if (strcmp(optarg, "bin") == 0) {
+			output.format = FORMAT_BIN;
+		} else if (strcmp(optarg, "hex") == 0) {
+			output.format = FORMAT_IHEX;
+		} else if (strcmp(optarg, "srec") == 0) {
+			output.format = FORMAT_SREC;
+		} else {
+			fprintf(stderr, "Unknown output format '%s' (bin, hex, srec)\n", optarg);
+			return 1;
+		}
+		break;
+	case 'S':
+		output.device_size = strtoul(optarg, NULL, 0);
+		break;
+	case 'P':
+		output.page_size = strtoul(optarg, NULL, 0);
+		break;
+	case 'n':
+		sites = atoi(optarg);
+		break;
+	case '?':
+		if (optopt == 'c')
+			fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+		else if (isprint (optopt))
+			fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+		else
+			fprintf (stderr,
+				"Unknown option character `\\x%x'.\n",
+				optopt);
+		return 1;
+	default:
+		abort ();
+	}
+	/* --get output is meant for other tools, keep it to the table */
+	if (!query) {
+		printf("Build: %s %s\n", __DATE__, __TIME__);
+	}
+
+	/* Keys are expanded once and shared by every image and thread */
+	if (sign_key_file) {
+		uint8_t seed[ED25519_SEED_LEN];
+		if (load_key_file(sign_key_file, seed, sizeof(seed))) {
+			return 1;
+		}
+		ed25519_key_from_seed(&key, seed);
+		memset(seed, 0, sizeof(seed));
+		sign_key = &key;
+		/* Derived from a secret, so always a valid point */
+		ed25519_pubkey_load(&sign_pubkey, key.pk);
+		resign_key = &sign_pubkey;
+	}
+	if (export_pubkey) {
+		if (!sign_key) {
+			fprintf(stderr, "--export-pubkey needs --sign-key\n");
+			return 1;
+		}
+		if (write_image(export_pubkey, key.pk, sizeof(key.pk))) {
+			return 1;
+		}
+		printf("wrote public key to %s\n", export_pubkey);
+	}
+	if (verify_key_file) {
+		uint8_t pk[ED25519_PUBKEY_LEN];
+		if (load_key_file(verify_key_file, pk, sizeof(pk))) {
+			return 1;
+		}
+		if (ed25519_pubkey_load(&pubkey, pk)) {
+			fprintf(stderr, "%s: not a valid Ed25519 public key\n", verify_key_file);
+			return 1;
+		}
+		verify_key = &pubkey;
+	}
+
+	if (sku_registry_init(&skus, sku_profiles, sizeof(sku_profiles) / sizeof(sku_profiles[0]))) {
+		fprintf(stderr, "Too many SKU profiles or a prefix claimed twice\n");
+		return 1;
+	}
+	if (gpuflag) {
+		forced = sku_find(&skus, "gpu");
+	} else if (ssdflag) {
+		forced = sku_find(&skus, "ssd");
+	}
+
+	if (infilename) {
+		if (verbose) {
+			return read_eeprom(infilename) ? 1 : 0;
+		}
+		return read_eeprom_summary(infilename, !skip_desc_crc, read_stats) ? 1 : 0;
+	}
+
+	if (trace_dir) {
+		/* Simulate the image given, or the built-in template */
+		if (optind < argc) {
+			long n = load_image(argv[optind], image, sizeof(image));
+			const char *err = n < 0 ? "unreadable" : check_image(image, n);
+			if (!err && is_compact(image)) {
+				uint8_t expanded[IMAGE_MAX_LEN];
+				n = compact_decode(image, n, expanded, sizeof(expanded));
+				memcpy(image, expanded, n);
+				err = n ? NULL : "cannot decode";
+			}
+			if (err) {
+				fprintf(stderr, "%s: %s\n", argv[optind], err);
+				return 1;
+			}
+			len = n;
+		} else if (ssdflag) {
+			memcpy(image, &ssd_cfg, sizeof(ssd_cfg));
+			len = sizeof(ssd_cfg);
+		} else {
+			memcpy(image, &gpu_cfg, sizeof(gpu_cfg));
+			len = sizeof(gpu_cfg);
+		}
+		if (!jobs_set) {
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		}
+		ret = simulate_fans(trace_dir, image, len, sweeps, nsweeps, trace_period, jobs);
+		return ret ? 1 : 0;
+	}
+
+	if (watch_dir) {
+		if (!jobs_set) {
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		}
+		return watch_dumps(watch_dir, index_path, jobs) ? 1 : 0;
+	}
+
+	if (fuzz_rounds) {
+		if (!jobs_set) {
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		}
+		return fuzz_round_trips(fuzz_rounds, fuzz_seed, jobs) ? 1 : 0;
+	}
+
+	if (nedits || query || simulate_gpio || verify_fan_curve || golden || audit || verify_key || export_path ||
+			migrate_to >= 0) {
+		if (optind >= argc) {
+			fprintf(stderr, "Image files are required\n");
+			return 1;
+		}
+		if (collect_files(&files, &argv[optind], argc - optind)) {
+			return 1;
+		}
+		if (query) {
+			ret = query_images(query, files.paths, files.count);
+		} else if (export_path) {
+			ret = export_columns(export_path, files.paths, files.count);
+		} else if (migrate_to >= 0) {
+			ret = migrate_images(files.paths, files.count, migrate_to, forced, jobs);
+		} else if (audit) {
+			ret = check_images(files.paths, files.count, audit_image, "consistency");
+		} else if (golden) {
+			ret = diff_golden(golden, files.paths, files.count);
+		} else if (simulate_gpio) {
+			ret = check_images(files.paths, files.count, simulate_gpio_actions, "GPIO actions");
+		} else if (verify_fan_curve) {
+			ret = check_images(files.paths, files.count, verify_fan_curves, "fan curves");
+		} else if (!nedits) {
+			ret = verify_images(files.paths, files.count, jobs);
+		} else {
+			ret = edit_images(files.paths, files.count, edits, nedits, jobs);
+		}
+		file_list_free(&files);
+		return ret ? 1 : 0;
+	}
+
+	err = output_format_check(&output);
+	if (err) {
+		fprintf(stderr, "Invalid -S/-P: %s\n", err);
+		return 1;
+	}
+	if (!boot.bus_khz || !boot.max_xfer || !boot.page_size) {
+		fprintf(stderr, "I2C speed, transfer size and page size must be non-zero\n");
+		return 1;
+	}
+
+	if (boot_cost) {
+		if (gpuflag || !ssdflag) {
+			report_boot_cost("gpu", &gpu_cfg, sizeof(gpu_cfg));
+		}
+		if (ssdflag || !gpuflag) {
+			report_boot_cost("ssd", &ssd_cfg, sizeof(ssd_cfg));
+		}
+		return 0;
+	}
+
+	if (gpuflag && ssdflag) {
+		fprintf(stderr, "-g and -d cannot be combined\n");
+		return 1;
+	}
+	if (hash_path && (!manifestname || nsite_specs)) {
+		fprintf(stderr, "--hash-manifest needs -b and image files, not --site\n");
+		return 1;
+	}
+
+	printf("Descriptor Version: %d %d\n", 0, compact ? GPU_CFG_VERSION_MINOR_COMPACT : GPU_CFG_VERSION_MINOR);
+
+	if (manifestname) {
+		printf ("gpu = %d, ssd = %d, manifest = %s output dir = %s jobs = %d\n",
+			gpuflag, ssdflag, manifestname, outdir, jobs);
+		/* Without -g or -d every row goes by the SKU in its serial */
+		if (prepare_profiles(&batch, forced)) {
+			ret = -1;
+		} else if (nsite_specs) {
+			ret = program_stations(manifestname, &batch, site_specs, nsite_specs,
+				site_timeout, site_retries);
+		} else {
+			ret = program_batch(manifestname, &batch, outdir, jobs, sites, hash_path);
+		}
+		return ret ? 1 : 0;
+	}
+
+	printf ("gpu = %d, ssd = %d, module SN = %s pcb SN = %s output file = %s\n",
+		gpuflag, ssdflag, serialvalue, pcbvalue, outfilename);
+
+	if (!serialvalue && !forced) {
+		return 0;
+	}
+	if (validate_serial(serialvalue)) {
+		fprintf(stderr, "Invalid module serial '%s': %s\n",
+			serialvalue ? serialvalue : "", validate_serial(serialvalue));
+		return 1;
+	}
+	err = select_profile(serialvalue, forced, &profile);
+	if (err) {
+		fprintf(stderr, "Module serial '%s' %s\n", serialvalue, err);
+		return 1;
+	}
+	if (profile->pcb && pcbvalue && (err = validate_pcb_serial(profile, pcbvalue))) {
+		fprintf(stderr, "Invalid PCB serial '%s': %s\n", pcbvalue, err);
+		return 1;
+	}
+
+	if (prepare_profiles(&batch, profile)) {
+		return 1;
+	}
+	tpl = &batch.templates[profile - skus.profiles];
+	memcpy(image, tpl->image, tpl->len);
+	if (profile->pcb && pcbvalue) {
+		memset(image + tpl->pcb_serial, 0x00, GPU_SERIAL_LEN);
+		strncpy((char *)image + tpl->pcb_serial, pcbvalue, GPU_SERIAL_LEN);
+	}
+	ret = program_eeprom(serialvalue, image, tpl->len, outfilename);
+
+	return ret ? 1 : 0;
 }
@@ -0,0 +1,184 @@
+/*
+ * Traceability manifest for a batch of generated images.
+ *
+ * Every image is hashed on the writer thread from the buffer that is about
+ * to be written, so the manifest costs no extra pass over the files. One
+ * line per written image, in manifest row order:
+ *
+ *   serial,path,crc32,descriptor_crc32,sha256
+ *
+ * The last line is "# batch sha256 <hash>, <n> images", where the hash is
+ * the SHA-256 of every byte of the file before that line, so
+ * "head -n -1 FILE | sha256sum" reproduces it. Rows whose image could not
+ * be written are left out.
+ *
+ * Writer threads finish out of order, so entries wait in a ring until all
+ * earlier rows are in. The generator must reserve a row before building it,
+ * which blocks while the ring is full; memory stays fixed like the writer's.
+ */
+
+enum hash_entry_state {
+	HASH_ENTRY_FREE,
+	HASH_ENTRY_PENDING,
+	HASH_ENTRY_WRITTEN,
+	HASH_ENTRY_FAILED,
+};
+
+struct hash_entry {
+	enum hash_entry_state state;
+	char serial[GPU_SERIAL_LEN + 1];
+	char path[IMAGE_PATH_LEN];
+	uint32_t crc32;
+	uint32_t descriptor_crc32;
+	uint8_t sha256[SHA256_DIGEST_LEN];
+};
+
+struct hash_manifest {
+	FILE *fptr;
+	pthread_mutex_t lock;
+	pthread_cond_t drained;
+	struct hash_entry *ring;
+	unsigned long nring;
+	/* First row that has not been emitted yet */
+	unsigned long next;
+	unsigned long entries;
+	struct sha256_ctx total;
+	bool error;
+};
+
+static void hash_manifest_puts(struct hash_manifest *m, const char *line)
+{
+	sha256_update(&m->total, line, strlen(line));
+	if (fputs(line, m->fptr) == EOF)
+		m->error = true;
+}
+
+/**
+ * Create the manifest with room for nring rows in flight, which must be at
+ * least the writer window. Like the window, nring is at least 1.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int hash_manifest_start(struct hash_manifest *m, const char *path, unsigned long nring)
+{
+	memset(m, 0, sizeof(*m));
+	if (nring < 1)
+		nring = 1;
+	m->ring = calloc(nring, sizeof(*m->ring));
+	if (!m->ring) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	m->fptr = fopen(path, "w");
+	if (!m->fptr) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		free(m->ring);
+		return -1;
+	}
+	m->nring = nring;
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->drained, NULL);
+	sha256_init(&m->total);
+	hash_manifest_puts(m, "# serial,path,crc32,descriptor_crc32,sha256\n");
+	return 0;
+}
+
+/**
+ * Claim the ring entry of row, waiting for older rows to be emitted first.
+ * Rows must be reserved in order, starting at 0.
+ */
+static void hash_manifest_reserve(struct hash_manifest *m, unsigned long row)
+{
+	struct hash_entry *e = &m->ring[row % m->nring];
+
+	pthread_mutex_lock(&m->lock);
+	while (e->state != HASH_ENTRY_FREE)
+		pthread_cond_wait(&m->drained, &m->lock);
+	e->state = HASH_ENTRY_PENDING;
+	pthread_mutex_unlock(&m->lock);
+}
+
+/**
+ * Fill in the entry of row from the sealed descriptor and the encoded
+ * bytes that will be written. Called on the writer thread.
+ */
+static void hash_manifest_hash(struct hash_manifest *m, unsigned long row,
+			       const uint8_t *desc, const uint8_t *data, size_t len)
+{
+	struct hash_entry *e = &m->ring[row % m->nring];
+	struct sha256_ctx ctx;
+
+	memcpy(e->serial, view_desc_serial(desc), GPU_SERIAL_LEN);
+	e->serial[GPU_SERIAL_LEN] = '\0';
+	e->crc32 = view_desc_crc32(desc);
+	e->descriptor_crc32 = view_desc_descriptor_crc32(desc);
+	sha256_init(&ctx);
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, e->sha256);
+}
+
+/**
+ * Record whether the image of row reached path, then emit every entry that
+ * is now complete in row order.
+ */
+static void hash_manifest_done(struct hash_manifest *m, unsigned long row, const char *path, int ret)
+{
+	char line[IMAGE_PATH_LEN + 2 * GPU_SERIAL_LEN + 2 * SHA256_DIGEST_LEN + 64];
+	struct hash_entry *done = &m->ring[row % m->nring];
+	bool freed = false;
+
+	snprintf(done->path, sizeof(done->path), "%s", path);
+	pthread_mutex_lock(&m->lock);
+	done->state = ret ? HASH_ENTRY_FAILED : HASH_ENTRY_WRITTEN;
+	for (;;) {
+		struct hash_entry *e = &m->ring[m->next % m->nring];
+		int n;
+
+		if (e->state != HASH_ENTRY_WRITTEN && e->state != HASH_ENTRY_FAILED)
+			break;
+		if (e->state == HASH_ENTRY_WRITTEN) {
+			n = snprintf(line, sizeof(line), "%s,%s,0x%08x,0x%08x,", e->serial, e->path,
+				     e->crc32, e->descriptor_crc32);
+			for (int i = 0; i < SHA256_DIGEST_LEN; i++)
+				n += sprintf(line + n, "%02x", e->sha256[i]);
+			strcpy(line + n, "\n");
+			hash_manifest_puts(m, line);
+			m->entries++;
+		}
+		e->state = HASH_ENTRY_FREE;
+		m->next++;
+		freed = true;
+	}
+	if (freed)
+		pthread_cond_broadcast(&m->drained);
+	pthread_mutex_unlock(&m->lock);
+}
+
+/**
+ * Write the batch hash and close the manifest. Every reserved row must be
+ * done by now.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int hash_manifest_finish(struct hash_manifest *m, const char *path)
+{
+	uint8_t digest[SHA256_DIGEST_LEN];
+	char hex[2 * SHA256_DIGEST_LEN + 1];
+
+	sha256_final(&m->total, digest);
+	for (int i = 0; i < SHA256_DIGEST_LEN; i++)
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	if (fprintf(m->fptr, "# batch sha256 %s, %lu images\n", hex, m->entries) < 0)
+		m->error = true;
+	if (fclose(m->fptr) == EOF)
+		m->error = true;
+	pthread_cond_destroy(&m->drained);
+	pthread_mutex_destroy(&m->lock);
+	free(m->ring);
+	m->ring = NULL;
+	if (m->error) {
+		fprintf(stderr, "failed to write %s\n", path);
+		return -1;
+	}
+	return 0;
+}
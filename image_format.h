@@ -0,0 +1,180 @@
+/*
+ * Output encodings for device programmers.
+ *
+ * Images are padded with 0xFF (erased EEPROM) up to the device size and to a
+ * whole number of pages, then emitted as raw binary, Intel HEX or Motorola
+ * S-record. Records never cross a page boundary so programmers can issue one
+ * page write per record group.
+ */
+
+/* 16 bit addressing only: I16HEX without extended records, S1/S9 */
+#define DEVICE_MAX_LEN 65536
+#define RECORD_MAX_LEN 16
+
+enum image_format {
+	FORMAT_BIN,
+	FORMAT_IHEX,
+	FORMAT_SREC,
+};
+
+struct output_format {
+	enum image_format format;
+	/* Pad up to this many bytes, 0 to keep the image length */
+	uint32_t device_size;
+	/* EEPROM page size, images are padded to a multiple of it */
+	uint32_t page_size;
+};
+
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+static inline uint8_t *put_hex8(uint8_t *p, uint8_t v)
+{
+	p[0] = hex_digits[v >> 4];
+	p[1] = hex_digits[v & 0xF];
+	return p + 2;
+}
+
+static const char *format_extension(enum image_format format)
+{
+	switch (format) {
+		case FORMAT_IHEX:
+			return "hex";
+		case FORMAT_SREC:
+			return "srec";
+		default:
+			return "bin";
+	}
+}
+
+static inline size_t record_len(const struct output_format *fmt)
+{
+	if (fmt->page_size && fmt->page_size < RECORD_MAX_LEN)
+		return fmt->page_size;
+	return RECORD_MAX_LEN;
+}
+
+/**
+ * Check that images can be laid out on the device: the page size is a
+ * power of two, so records of RECORD_MAX_LEN bytes never straddle a page,
+ * and divides the device size, so padding stays within DEVICE_MAX_LEN.
+ *
+ * \return NULL if valid, otherwise a description of the problem
+ */
+static const char *output_format_check(const struct output_format *fmt)
+{
+	if (fmt->device_size > DEVICE_MAX_LEN || fmt->page_size > DEVICE_MAX_LEN)
+		return "device and page size are limited to 65536 bytes";
+	if (fmt->page_size & (fmt->page_size - 1))
+		return "page size must be a power of two";
+	if (fmt->page_size && fmt->device_size % fmt->page_size)
+		return "device size must be a whole number of pages";
+	return NULL;
+}
+
+/**
+ * Length of the image once padded for the device.
+ */
+static size_t padded_len(const struct output_format *fmt, size_t len)
+{
+	if (fmt->device_size > len)
+		len = fmt->device_size;
+	if (fmt->page_size > 1)
+		len = (len + fmt->page_size - 1) / fmt->page_size * fmt->page_size;
+	return len;
+}
+
+/**
+ * Upper bound of the encoded size of a len byte image.
+ */
+static size_t encoded_max_len(const struct output_format *fmt, size_t len)
+{
+	size_t padded = padded_len(fmt, len);
+	size_t rec = record_len(fmt);
+	size_t records = (padded + rec - 1) / rec;
+
+	switch (fmt->format) {
+		case FORMAT_IHEX:
+		case FORMAT_SREC:
+			/* Worst case line overhead is 12 chars, plus header and trailer */
+			return records * (12 + 2 * rec) + 32;
+		default:
+			return padded;
+	}
+}
+
+static size_t ihex_encode(uint8_t *out, const uint8_t *data, size_t len, size_t rec)
+{
+	uint8_t *p = out;
+
+	for (size_t addr = 0; addr < len; addr += rec) {
+		size_t n = len - addr < rec ? len - addr : rec;
+		uint8_t sum = n + (addr >> 8) + (addr & 0xFF);
+
+		*p++ = ':';
+		p = put_hex8(p, n);
+		p = put_hex8(p, addr >> 8);
+		p = put_hex8(p, addr & 0xFF);
+		p = put_hex8(p, 0x00);
+		for (size_t i = 0; i < n; i++) {
+			sum += data[addr + i];
+			p = put_hex8(p, data[addr + i]);
+		}
+		p = put_hex8(p, -sum);
+		*p++ = '\n';
+	}
+	memcpy(p, ":00000001FF\n", 12);
+	return p + 12 - out;
+}
+
+static size_t srec_encode(uint8_t *out, const uint8_t *data, size_t len, size_t rec)
+{
+	uint8_t *p = out;
+
+	memcpy(p, "S0030000FC\n", 11);
+	p += 11;
+	for (size_t addr = 0; addr < len; addr += rec) {
+		size_t n = len - addr < rec ? len - addr : rec;
+		uint8_t sum = (n + 3) + (addr >> 8) + (addr & 0xFF);
+
+		*p++ = 'S';
+		*p++ = '1';
+		p = put_hex8(p, n + 3);
+		p = put_hex8(p, addr >> 8);
+		p = put_hex8(p, addr & 0xFF);
+		for (size_t i = 0; i < n; i++) {
+			sum += data[addr + i];
+			p = put_hex8(p, data[addr + i]);
+		}
+		p = put_hex8(p, ~sum);
+		*p++ = '\n';
+	}
+	memcpy(p, "S9030000FC\n", 11);
+	return p + 11 - out;
+}
+
+/**
+ * Pad and encode an image into out, which must hold encoded_max_len() bytes.
+ *
+ * \return number of bytes written to out, 0 if the padded image is larger
+ *         than DEVICE_MAX_LEN
+ */
+static size_t encode_image(const struct output_format *fmt, uint8_t *out, const uint8_t *image, size_t len)
+{
+	static __thread uint8_t padded[DEVICE_MAX_LEN];
+	size_t total = padded_len(fmt, len);
+
+	if (total > DEVICE_MAX_LEN)
+		return 0;
+
+	if (fmt->format == FORMAT_BIN) {
+		memmove(out, image, len);
+		memset(out + len, 0xFF, total - len);
+		return total;
+	}
+
+	memcpy(padded, image, len);
+	memset(padded + len, 0xFF, total - len);
+	if (fmt->format == FORMAT_IHEX)
+		return ihex_encode(out, padded, total, record_len(fmt));
+	return srec_encode(out, padded, total, record_len(fmt));
+}
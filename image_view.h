@@ -0,0 +1,214 @@
+/*
+ * Typed views over raw image bytes.
+ *
+ * Images come from files, EEPROMs and fixtures as plain byte buffers at any
+ * alignment, so code that decodes, checks or edits one reads its fields
+ * through these accessors rather than by casting the buffer to the structs
+ * in config_definition.h. Each field of each struct gets
+ *
+ *   view_<view>_<field>(p)          load, p points at the struct
+ *   view_<view>_set_<field>(p, v)   store
+ *
+ * and each byte array view_<view>_<field>(p), or view_<view>_<field>_mut(p)
+ * to write it, returning its address. Loads and stores are assembled from
+ * bytes in little endian order; compilers turn them into a single move on
+ * targets with unaligned access (x86, ARMv8). make bench compares them with
+ * casts (tests/bench_view.c).
+ *
+ * The accessors are generated from the field lists below, which are checked
+ * against the structs at compile time: every field must be listed, at its
+ * width, so a struct change that is not mirrored here does not build.
+ */
+
+static inline uint8_t ld_le8(const uint8_t *p)
+{
+	return p[0];
+}
+
+static inline uint16_t ld_le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t ld_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void st_le8(uint8_t *p, uint8_t v)
+{
+	p[0] = v;
+}
+
+static inline void st_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void st_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/*
+ * One list per struct: U(view, struct, field, bits) for integers and
+ * B(view, struct, field) for byte arrays.
+ */
+#define VIEW_DESC(U, B) \
+	B(desc, gpu_cfg_descriptor, magic) \
+	U(desc, gpu_cfg_descriptor, length, 32) \
+	U(desc, gpu_cfg_descriptor, descriptor_version_major, 16) \
+	U(desc, gpu_cfg_descriptor, descriptor_version_minor, 16) \
+	U(desc, gpu_cfg_descriptor, hardware_version, 16) \
+	U(desc, gpu_cfg_descriptor, hardware_revision, 16) \
+	B(desc, gpu_cfg_descriptor, serial) \
+	U(desc, gpu_cfg_descriptor, descriptor_length, 32) \
+	U(desc, gpu_cfg_descriptor, descriptor_crc32, 32) \
+	U(desc, gpu_cfg_descriptor, crc32, 32)
+
+#define VIEW_BLOCK(U, B) \
+	U(block, gpu_block_header, block_type, 8) \
+	U(block, gpu_block_header, block_length, 8)
+
+#define VIEW_GPIO(U, B) \
+	U(gpio, gpu_cfg_gpio, gpio, 8) \
+	U(gpio, gpu_cfg_gpio, function, 8) \
+	U(gpio, gpu_cfg_gpio, flags, 32) \
+	U(gpio, gpu_cfg_gpio, power_domain, 8)
+
+#define VIEW_GPIO_ACTIONS(U, B) \
+	U(gpio_actions, gpu_cfg_gpio_actions, assert_mask, 32) \
+	U(gpio_actions, gpu_cfg_gpio_actions, deassert_mask, 32)
+
+#define VIEW_GPIO_COMPACT(U, B) \
+	U(gpio_compact, gpu_cfg_gpio_compact, gpio, 8) \
+	U(gpio_compact, gpu_cfg_gpio_compact, function, 8) \
+	U(gpio_compact, gpu_cfg_gpio_compact, flags, 8) \
+	U(gpio_compact, gpu_cfg_gpio_compact, power_domain, 8)
+
+#define VIEW_THERMAL(U, B) \
+	U(thermal, gpu_cfg_thermal, thermal_type, 8) \
+	U(thermal, gpu_cfg_thermal, address, 8) \
+	U(thermal, gpu_cfg_thermal, reserved, 32) \
+	U(thermal, gpu_cfg_thermal, reserved2, 32)
+
+#define VIEW_THERMAL_COMPACT(U, B) \
+	U(thermal_compact, gpu_cfg_thermal_compact, thermal_type, 8) \
+	U(thermal_compact, gpu_cfg_thermal_compact, address, 8)
+
+#define VIEW_CUSTOM_TEMP(U, B) \
+	U(custom_temp, gpu_cfg_custom_temp, idx, 8) \
+	U(custom_temp, gpu_cfg_custom_temp, temp_fan_off, 16) \
+	U(custom_temp, gpu_cfg_custom_temp, temp_fan_max, 16)
+
+#define VIEW_FAN(U, B) \
+	U(fan, gpu_cfg_fan, idx, 8) \
+	U(fan, gpu_cfg_fan, flags, 8) \
+	U(fan, gpu_cfg_fan, min_rpm, 16) \
+	U(fan, gpu_cfg_fan, min_temp, 16) \
+	U(fan, gpu_cfg_fan, start_rpm, 16) \
+	U(fan, gpu_cfg_fan, max_rpm, 16) \
+	U(fan, gpu_cfg_fan, max_temp, 16)
+
+/* rpm[] follows, see view_fan_curve_rpm() */
+#define VIEW_FAN_CURVE(U, B) \
+	U(fan_curve, gpu_cfg_fan_curve, idx, 8) \
+	U(fan_curve, gpu_cfg_fan_curve, temp_start, 16) \
+	U(fan_curve, gpu_cfg_fan_curve, temp_step, 8) \
+	U(fan_curve, gpu_cfg_fan_curve, count, 8)
+
+#define VIEW_SIGNATURE(U, B) \
+	B(signature, gpu_cfg_signature, key_id) \
+	B(signature, gpu_cfg_signature, signature)
+
+#define VIEW_POWER(U, B) \
+	U(power, gpu_cfg_power, device_idx, 8) \
+	U(power, gpu_cfg_power, battery_power, 8) \
+	U(power, gpu_cfg_power, average_power, 8) \
+	U(power, gpu_cfg_power, long_term_power, 8) \
+	U(power, gpu_cfg_power, short_term_power, 8) \
+	U(power, gpu_cfg_power, peak_power, 8)
+
+#define VIEW_BATTERY(U, B) \
+	U(battery, gpu_cfg_battery, max_current, 16) \
+	U(battery, gpu_cfg_battery, max_mv, 16) \
+	U(battery, gpu_cfg_battery, min_mv, 16) \
+	U(battery, gpu_cfg_battery, max_charge_current, 16)
+
+#define VIEW_SUBSYS(U, B) \
+	U(subsys, gpu_subsys_serial, gpu_subsys, 8) \
+	B(subsys, gpu_subsys_serial, serial)
+
+#define VIEW_PD(U, B) \
+	U(pd, gpu_subsys_pd, gpu_pd_type, 8) \
+	U(pd, gpu_subsys_pd, address, 8) \
+	U(pd, gpu_subsys_pd, flags, 32) \
+	U(pd, gpu_subsys_pd, pdo, 32) \
+	U(pd, gpu_subsys_pd, rdo, 32) \
+	U(pd, gpu_subsys_pd, power_domain, 8) \
+	U(pd, gpu_subsys_pd, gpio_hpd, 8) \
+	U(pd, gpu_subsys_pd, gpio_interrupt, 8)
+
+#define VIEW_STRUCTS(X) \
+	X(VIEW_DESC, gpu_cfg_descriptor) \
+	X(VIEW_BLOCK, gpu_block_header) \
+	X(VIEW_GPIO, gpu_cfg_gpio) \
+	X(VIEW_GPIO_ACTIONS, gpu_cfg_gpio_actions) \
+	X(VIEW_GPIO_COMPACT, gpu_cfg_gpio_compact) \
+	X(VIEW_THERMAL, gpu_cfg_thermal) \
+	X(VIEW_THERMAL_COMPACT, gpu_cfg_thermal_compact) \
+	X(VIEW_CUSTOM_TEMP, gpu_cfg_custom_temp) \
+	X(VIEW_FAN, gpu_cfg_fan) \
+	X(VIEW_FAN_CURVE, gpu_cfg_fan_curve) \
+	X(VIEW_SIGNATURE, gpu_cfg_signature) \
+	X(VIEW_POWER, gpu_cfg_power) \
+	X(VIEW_BATTERY, gpu_cfg_battery) \
+	X(VIEW_SUBSYS, gpu_subsys_serial) \
+	X(VIEW_PD, gpu_subsys_pd)
+
+#define VIEW_FIELD_SIZE(s, f) sizeof(((struct s *)0)->f)
+
+#define VIEW_UINT(v, s, f, bits) \
+	static inline uint##bits##_t view_##v##_##f(const uint8_t *p) \
+	{ \
+		return ld_le##bits(p + offsetof(struct s, f)); \
+	} \
+	static inline void view_##v##_set_##f(uint8_t *p, uint##bits##_t val) \
+	{ \
+		st_le##bits(p + offsetof(struct s, f), val); \
+	} \
+	_Static_assert(VIEW_FIELD_SIZE(s, f) * 8 == bits, #s "." #f " is not " #bits " bits");
+
+#define VIEW_BYTES(v, s, f) \
+	static inline const uint8_t *view_##v##_##f(const uint8_t *p) \
+	{ \
+		return p + offsetof(struct s, f); \
+	} \
+	static inline uint8_t *view_##v##_##f##_mut(uint8_t *p) \
+	{ \
+		return p + offsetof(struct s, f); \
+	}
+
+#define VIEW_UINT_SIZE(v, s, f, bits) + bits / 8
+#define VIEW_BYTES_SIZE(v, s, f) + VIEW_FIELD_SIZE(s, f)
+
+#define VIEW_GENERATE(list, s) \
+	list(VIEW_UINT, VIEW_BYTES) \
+	_Static_assert(0 list(VIEW_UINT_SIZE, VIEW_BYTES_SIZE) == sizeof(struct s), \
+		       "view of struct " #s " does not cover every field");
+
+VIEW_STRUCTS(VIEW_GENERATE)
+
+static inline uint16_t view_fan_curve_rpm(const uint8_t *p, int i)
+{
+	return ld_le16(p + offsetof(struct gpu_cfg_fan_curve, rpm) + i * sizeof(uint16_t));
+}
+
+static inline void view_fan_curve_set_rpm(uint8_t *p, int i, uint16_t rpm)
+{
+	st_le16(p + offsetof(struct gpu_cfg_fan_curve, rpm) + i * sizeof(uint16_t), rpm);
+}
@@ -0,0 +1,248 @@
+/*
+ * Output backend for generated EEPROM images.
+ *
+ * Batch generation produces one small image per unit, so the cost is
+ * dominated by open/write/close latency rather than bandwidth (especially
+ * on network shares). Images are handed to a pool of writer threads
+ * through a bounded set of slots; the generator blocks once all slots are
+ * in flight, so memory use is fixed regardless of batch size.
+ *
+ * With zero threads the writer degrades to the synchronous path, which
+ * writes each image as soon as it is submitted.
+ *
+ * An optional prepare step runs on the writer thread right before an image
+ * is written, so per image work such as signing and encoding is spread over
+ * the pool as well. An optional complete step learns the outcome of each
+ * write, in completion order.
+ */
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define IMAGE_MAX_LEN 4096
+#define IMAGE_PATH_LEN 512
+#define WRITER_MAX_THREADS 64
+
+struct image_job {
+	char path[IMAGE_PATH_LEN];
+	size_t len;
+	/* Capacity of data, fixed when the writer is started */
+	size_t size;
+	uint8_t *data;
+	/* Set by the generator, e.g. to the manifest row, for the hooks */
+	unsigned long id;
+	struct image_job *next;
+};
+
+struct image_writer {
+	pthread_mutex_t lock;
+	pthread_cond_t job_ready;
+	pthread_cond_t slot_free;
+	struct image_job *slots;
+	uint8_t *arena;
+	/* Slots available to the generator */
+	struct image_job *free_list;
+	/* Slots waiting for a writer thread */
+	struct image_job *head;
+	struct image_job *tail;
+	pthread_t threads[WRITER_MAX_THREADS];
+	int nthreads;
+	bool closing;
+	/* Optional, turns a submitted slot into the bytes to write */
+	int (*prepare)(struct image_job *job, void *ctx);
+	/* Optional, called with the result of each job before its slot is reused */
+	void (*complete)(struct image_job *job, int ret, void *ctx);
+	void *prepare_ctx;
+	int errors;
+	unsigned long written;
+};
+
+/**
+ * Write a complete image to disk, replacing any existing file.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int write_image(const char *path, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "failed to write %s: %s\n", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	if (close(fd) < 0) {
+		fprintf(stderr, "failed to close %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int writer_process(struct image_writer *w, struct image_job *job)
+{
+	if (w->prepare && w->prepare(job, w->prepare_ctx))
+		return -1;
+	return write_image(job->path, job->data, job->len);
+}
+
+static void writer_complete(struct image_writer *w, struct image_job *job, int ret)
+{
+	if (w->complete)
+		w->complete(job, ret, w->prepare_ctx);
+	pthread_mutex_lock(&w->lock);
+	if (ret)
+		w->errors++;
+	else
+		w->written++;
+	job->next = w->free_list;
+	w->free_list = job;
+	pthread_cond_signal(&w->slot_free);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *writer_thread(void *arg)
+{
+	struct image_writer *w = arg;
+	struct image_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		while (!w->head && !w->closing)
+			pthread_cond_wait(&w->job_ready, &w->lock);
+		job = w->head;
+		if (!job) {
+			pthread_mutex_unlock(&w->lock);
+			return NULL;
+		}
+		w->head = job->next;
+		if (!w->head)
+			w->tail = NULL;
+		pthread_mutex_unlock(&w->lock);
+
+		writer_complete(w, job, writer_process(w, job));
+	}
+}
+
+/**
+ * Start a writer with nthreads threads and at most window images of up to
+ * slot_size bytes each in flight. prepare and complete may be NULL, both
+ * get prepare_ctx.
+ *
+ * \return 0 on success, -1 on error
+ */
+static int writer_start(struct image_writer *w, int nthreads, int window, size_t slot_size,
+	int (*prepare)(struct image_job *job, void *ctx),
+	void (*complete)(struct image_job *job, int ret, void *ctx), void *prepare_ctx)
+{
+	memset(w, 0, sizeof(*w));
+	w->prepare = prepare;
+	w->complete = complete;
+	w->prepare_ctx = prepare_ctx;
+	if (nthreads < 0)
+		nthreads = 0;
+	if (nthreads > WRITER_MAX_THREADS)
+		nthreads = WRITER_MAX_THREADS;
+	if (window < 1)
+		window = 1;
+
+	w->slots = calloc(window, sizeof(struct image_job));
+	w->arena = malloc(window * slot_size);
+	if (!w->slots || !w->arena) {
+		free(w->slots);
+		free(w->arena);
+		return -1;
+	}
+	for (int i = 0; i < window; i++) {
+		w->slots[i].data = w->arena + i * slot_size;
+		w->slots[i].size = slot_size;
+		w->slots[i].next = w->free_list;
+		w->free_list = &w->slots[i];
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->job_ready, NULL);
+	pthread_cond_init(&w->slot_free, NULL);
+
+	for (int i = 0; i < nthreads; i++) {
+		if (pthread_create(&w->threads[i], NULL, writer_thread, w))
+			break;
+		w->nthreads++;
+	}
+	return 0;
+}
+
+/**
+ * Get an empty slot to build the next image in. Blocks while the
+ * in-flight window is full.
+ */
+static struct image_job *writer_acquire(struct image_writer *w)
+{
+	struct image_job *job;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->free_list)
+		pthread_cond_wait(&w->slot_free, &w->lock);
+	job = w->free_list;
+	w->free_list = job->next;
+	pthread_mutex_unlock(&w->lock);
+
+	job->next = NULL;
+	return job;
+}
+
+/**
+ * Queue a filled slot for writing. The slot must not be touched afterwards.
+ */
+static void writer_submit(struct image_writer *w, struct image_job *job)
+{
+	if (w->nthreads == 0) {
+		writer_complete(w, job, writer_process(w, job));
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	job->next = NULL;
+	if (w->tail)
+		w->tail->next = job;
+	else
+		w->head = job;
+	w->tail = job;
+	pthread_cond_signal(&w->job_ready);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Drain all queued images and stop the writer threads.
+ *
+ * \return number of images that failed to write
+ */
+static int writer_finish(struct image_writer *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->closing = true;
+	pthread_cond_broadcast(&w->job_ready);
+	pthread_mutex_unlock(&w->lock);
+
+	for (int i = 0; i < w->nthreads; i++)
+		pthread_join(w->threads[i], NULL);
+
+	pthread_cond_destroy(&w->slot_free);
+	pthread_cond_destroy(&w->job_ready);
+	pthread_mutex_destroy(&w->lock);
+	free(w->arena);
+	free(w->slots);
+	w->arena = NULL;
+	w->slots = NULL;
+	return w->errors;
+}
@@ -0,0 +1,71 @@
+/*
+ * Reader that only fetches the byte ranges asked for.
+ *
+ * Meant for at24 EEPROM nodes in sysfs (/sys/bus/i2c/devices/.../eeprom),
+ * where every read turns into I2C transactions. Callers that check the
+ * descriptor CRC read the header and then the whole descriptor; callers that
+ * skip it read the header and block headers, then only the block bodies they
+ * need. Everything read is cached, so walking the blocks after the CRC costs
+ * no further reads, and the number of bytes actually read is kept so the
+ * cost can be checked against a plain file standing in for the device.
+ */
+
+struct lazy_reader {
+	int fd;
+	uint8_t data[IMAGE_MAX_LEN];
+	/* One bit per byte of data that has been read */
+	uint8_t valid[IMAGE_MAX_LEN / 8];
+	size_t bytes_read;
+	size_t reads;
+};
+
+static int lazy_open(struct lazy_reader *r, const char *path)
+{
+	memset(r->valid, 0, sizeof(r->valid));
+	r->bytes_read = 0;
+	r->reads = 0;
+	r->fd = open(path, O_RDONLY);
+	return r->fd < 0 ? -1 : 0;
+}
+
+static void lazy_close(struct lazy_reader *r)
+{
+	close(r->fd);
+}
+
+static inline bool lazy_valid(const struct lazy_reader *r, size_t i)
+{
+	return r->valid[i / 8] & (1 << (i % 8));
+}
+
+/**
+ * Get len bytes at offset, reading whatever part is not cached yet with
+ * a single read.
+ *
+ * \return pointer into the cache, NULL on a read error or short read
+ */
+static const uint8_t *lazy_get(struct lazy_reader *r, size_t offset, size_t len)
+{
+	size_t first = offset, last = offset + len;
+
+	if (last > sizeof(r->data))
+		return NULL;
+	while (first < last && lazy_valid(r, first))
+		first++;
+	while (last > first && lazy_valid(r, last - 1))
+		last--;
+
+	while (first < last) {
+		ssize_t n = pread(r->fd, r->data + first, last - first, first);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return NULL;
+		r->reads++;
+		r->bytes_read += n;
+		for (size_t i = first; i < first + n; i++)
+			r->valid[i / 8] |= 1 << (i % 8);
+		first += n;
+	}
+	return r->data + offset;
+}
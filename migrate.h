@@ -0,0 +1,342 @@
+/*
+ * Descriptor version migration.
+ *
+ * Each step rewrites the block chain from one minor version to the next
+ * through a table of per-block converters; blocks without a converter are
+ * copied as they are. Steps are chained until the target version is
+ * reached, then any block the target version requires but the image lacks
+ * is taken from a profile template. A trailing signature block is kept last.
+ *
+ * The header is copied apart from descriptor_version_minor and
+ * descriptor_length; the CRCs and the signature are left to the caller.
+ */
+
+struct block_converter {
+	uint8_t block_type;
+	const char *name;
+	/* \return length of the converted body, 0 if it cannot be represented */
+	size_t (*convert)(const uint8_t *body, size_t len, uint8_t *out);
+};
+
+struct migration_step {
+	uint8_t from_minor;
+	uint8_t to_minor;
+	const struct block_converter *converters;
+	int nconverters;
+};
+
+struct required_block {
+	uint8_t block_type;
+	const char *name;
+};
+
+struct descriptor_version {
+	uint8_t minor;
+	const struct required_block *required;
+	int nrequired;
+};
+
+static const struct block_converter to_compact_converters[] = {
+	{GPUCFG_TYPE_GPIO, "gpio", compact_gpio},
+	{GPUCFG_TYPE_THERMAL_SENSOR, "thermal", compact_thermal},
+};
+
+static const struct block_converter from_compact_converters[] = {
+	{GPUCFG_TYPE_GPIO, "gpio", expand_gpio},
+	{GPUCFG_TYPE_THERMAL_SENSOR, "thermal", expand_thermal},
+};
+
+static const struct migration_step migration_steps[] = {
+	{GPU_CFG_VERSION_MINOR, GPU_CFG_VERSION_MINOR_COMPACT, to_compact_converters,
+		sizeof(to_compact_converters) / sizeof(to_compact_converters[0])},
+	{GPU_CFG_VERSION_MINOR_COMPACT, GPU_CFG_VERSION_MINOR, from_compact_converters,
+		sizeof(from_compact_converters) / sizeof(from_compact_converters[0])},
+};
+
+/* The EC cannot bring up the bay without the lane configuration and vendor */
+static const struct required_block base_required[] = {
+	{GPUCFG_TYPE_PCIE, "pcie"},
+	{GPUCFG_TYPE_VENDOR, "vendor"},
+};
+
+static const struct descriptor_version descriptor_versions[] = {
+	{GPU_CFG_VERSION_MINOR, base_required, sizeof(base_required) / sizeof(base_required[0])},
+	{GPU_CFG_VERSION_MINOR_COMPACT, base_required, sizeof(base_required) / sizeof(base_required[0])},
+};
+
+#define MIGRATE_MAX_CHANGES 16
+
+enum migration_action {
+	MIGRATE_CONVERTED,
+	MIGRATE_ADDED,
+};
+
+struct migration_change {
+	const char *name;
+	enum migration_action action;
+	/* Blocks affected and how many bytes their bodies grew in total */
+	int count;
+	int delta;
+};
+
+struct migration_report {
+	uint8_t from_minor;
+	uint8_t to_minor;
+	size_t old_len;
+	size_t new_len;
+	int nchanges;
+	struct migration_change changes[MIGRATE_MAX_CHANGES];
+	/* Set when the image cannot be migrated */
+	const char *error;
+};
+
+static const struct descriptor_version *descriptor_version_find(uint8_t minor)
+{
+	for (size_t i = 0; i < sizeof(descriptor_versions) / sizeof(descriptor_versions[0]); i++)
+		if (descriptor_versions[i].minor == minor)
+			return &descriptor_versions[i];
+	return NULL;
+}
+
+/**
+ * Pick the next step from minor towards target: the direct step if there
+ * is one, otherwise the one that gets closest without overshooting.
+ */
+static const struct migration_step *migration_step_find(uint8_t minor, uint8_t target)
+{
+	const struct migration_step *best = NULL;
+
+	for (size_t i = 0; i < sizeof(migration_steps) / sizeof(migration_steps[0]); i++) {
+		const struct migration_step *s = &migration_steps[i];
+
+		if (s->from_minor != minor)
+			continue;
+		if (minor < target ? s->to_minor <= minor || s->to_minor > target
+				   : s->to_minor >= minor || s->to_minor < target)
+			continue;
+		if (!best || abs(s->to_minor - target) < abs(best->to_minor - target))
+			best = s;
+	}
+	return best;
+}
+
+static void migrate_note(struct migration_report *report, const char *name, enum migration_action action, int delta)
+{
+	struct migration_change *c;
+
+	for (int i = 0; i < report->nchanges; i++) {
+		c = &report->changes[i];
+		if (c->name == name && c->action == action) {
+			c->count++;
+			c->delta += delta;
+			return;
+		}
+	}
+	if (report->nchanges == MIGRATE_MAX_CHANGES)
+		return;
+	c = &report->changes[report->nchanges++];
+	c->name = name;
+	c->action = action;
+	c->count = 1;
+	c->delta = delta;
+}
+
+static inline size_t migrate_put_block(uint8_t *out, size_t pos, size_t cap, uint8_t type,
+				       const uint8_t *body, size_t len)
+{
+	if (len > GPU_MAX_BLOCK_LEN - 1 || pos + sizeof(struct gpu_block_header) + len > cap)
+		return 0;
+	view_block_set_block_type(out + pos, type);
+	view_block_set_block_length(out + pos, len);
+	memcpy(out + pos + sizeof(struct gpu_block_header), body, len);
+	return pos + sizeof(struct gpu_block_header) + len;
+}
+
+/**
+ * Apply one step to the block chain of image. Signature blocks are dropped,
+ * the caller puts the signature back once the chain is final.
+ *
+ * \return length of the new image, 0 on error (set in report)
+ */
+static size_t migrate_step(const struct migration_step *step, const uint8_t *image, uint8_t *out, size_t cap,
+			   struct migration_report *report)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+	size_t pos = offset;
+	/* Expanding a full block of compact GPIO entries takes less than twice the room */
+	uint8_t converted[2 * GPU_MAX_BLOCK_LEN];
+
+	memcpy(out, image, offset);
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		const uint8_t *body = image + offset + sizeof(struct gpu_block_header);
+		const struct block_converter *conv = NULL;
+		uint8_t type = view_block_block_type(image + offset);
+		uint8_t blen = view_block_block_length(image + offset);
+		size_t olen = blen;
+
+		offset += sizeof(struct gpu_block_header) + blen;
+		if (offset > end) {
+			report->error = "block chain runs past the descriptor";
+			return 0;
+		}
+		if (type == GPUCFG_TYPE_SIGNATURE)
+			continue;
+		for (int i = 0; i < step->nconverters; i++)
+			if (step->converters[i].block_type == type)
+				conv = &step->converters[i];
+		if (conv) {
+			olen = conv->convert(body, blen, converted);
+			if (blen && !olen) {
+				report->error = "a block cannot be represented in the target version";
+				return 0;
+			}
+			body = converted;
+			migrate_note(report, conv->name, MIGRATE_CONVERTED, (int)olen - blen);
+		}
+		pos = migrate_put_block(out, pos, cap, type, body, olen);
+		if (!pos) {
+			report->error = "converted image is too large";
+			return 0;
+		}
+	}
+	view_desc_set_descriptor_version_minor(out, step->to_minor);
+	view_desc_set_descriptor_length(out, pos - sizeof(struct gpu_cfg_descriptor));
+	return pos;
+}
+
+/**
+ * Run the steps from the version of image to target.
+ *
+ * \return length of the image in out, 0 on error (set in report)
+ */
+static size_t migrate_chain(const uint8_t *image, uint8_t target, uint8_t *out, size_t cap,
+			    struct migration_report *report)
+{
+	uint8_t work[IMAGE_MAX_LEN];
+	uint8_t minor = view_desc_descriptor_version_minor(image);
+	size_t len = sizeof(struct gpu_cfg_descriptor) + view_desc_descriptor_length(image);
+
+	if (len > cap) {
+		report->error = "image is too large";
+		return 0;
+	}
+	memcpy(out, image, len);
+	while (minor != target) {
+		const struct migration_step *step = migration_step_find(minor, target);
+
+		if (!step) {
+			report->error = "no migration path to the target version";
+			return 0;
+		}
+		memcpy(work, out, len);
+		len = migrate_step(step, work, out, cap, report);
+		if (!len)
+			return 0;
+		minor = step->to_minor;
+	}
+	return len;
+}
+
+static bool migrate_has_block(const uint8_t *image, size_t len, uint8_t type)
+{
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+
+	while (offset + sizeof(struct gpu_block_header) <= len) {
+		if (view_block_block_type(image + offset) == type)
+			return true;
+		offset += sizeof(struct gpu_block_header) + view_block_block_length(image + offset);
+	}
+	return false;
+}
+
+/**
+ * Migrate an intact image to descriptor version 0.target. Blocks required
+ * by the target version are copied from the defaults template of
+ * defaults_len bytes, converted to the target version first; without one
+ * such images cannot be migrated.
+ *
+ * \return length of the image in out, 0 on error (set in report)
+ */
+static size_t migrate_image(const uint8_t *image, size_t len, uint8_t target,
+			    const uint8_t *defaults, size_t defaults_len,
+			    uint8_t *out, size_t cap, struct migration_report *report)
+{
+	const struct descriptor_version *version = descriptor_version_find(target);
+	const uint8_t *sig = NULL;
+	struct migration_report scratch = {0};
+	uint8_t profile[IMAGE_MAX_LEN];
+	size_t profile_len = 0;
+	size_t offset = sizeof(struct gpu_cfg_descriptor);
+	size_t end = offset + view_desc_descriptor_length(image);
+
+	memset(report, 0, sizeof(*report));
+	report->from_minor = view_desc_descriptor_version_minor(image);
+	report->to_minor = target;
+	report->old_len = end;
+	if (end > len) {
+		report->error = "block chain runs past the image";
+		return 0;
+	}
+	if (!version || !descriptor_version_find(report->from_minor)) {
+		report->error = "unknown descriptor version";
+		return 0;
+	}
+	while (offset + sizeof(struct gpu_block_header) <= end) {
+		if (view_block_block_type(image + offset) == GPUCFG_TYPE_SIGNATURE)
+			sig = image + offset;
+		offset += sizeof(struct gpu_block_header) + view_block_block_length(image + offset);
+	}
+
+	len = migrate_chain(image, target, out, cap, report);
+	if (!len)
+		return 0;
+	for (int i = 0; i < version->nrequired; i++) {
+		const struct required_block *req = &version->required[i];
+		size_t pos;
+
+		if (migrate_has_block(out, len, req->block_type))
+			continue;
+		if (!defaults) {
+			report->error = "no profile to take the missing blocks from";
+			return 0;
+		}
+		if (defaults_len < sizeof(struct gpu_cfg_descriptor) ||
+				view_desc_descriptor_length(defaults) > defaults_len - sizeof(struct gpu_cfg_descriptor)) {
+			report->error = "profile defaults are truncated";
+			return 0;
+		}
+		if (!profile_len) {
+			profile_len = migrate_chain(defaults, target, profile, sizeof(profile), &scratch);
+			if (!profile_len) {
+				report->error = "profile defaults cannot be converted";
+				return 0;
+			}
+		}
+		for (pos = sizeof(struct gpu_cfg_descriptor); pos + sizeof(struct gpu_block_header) <= profile_len;
+				pos += sizeof(struct gpu_block_header) + view_block_block_length(profile + pos)) {
+			uint8_t blen = view_block_block_length(profile + pos);
+
+			if (view_block_block_type(profile + pos) != req->block_type)
+				continue;
+			len = migrate_put_block(out, len, cap, req->block_type,
+						profile + pos + sizeof(struct gpu_block_header), blen);
+			if (!len) {
+				report->error = "converted image is too large";
+				return 0;
+			}
+			migrate_note(report, req->name, MIGRATE_ADDED, blen);
+		}
+	}
+	if (sig) {
+		len = migrate_put_block(out, len, cap, view_block_block_type(sig),
+					sig + sizeof(struct gpu_block_header), view_block_block_length(sig));
+		if (!len) {
+			report->error = "converted image is too large";
+			return 0;
+		}
+	}
+	view_desc_set_descriptor_length(out, len - sizeof(struct gpu_cfg_descriptor));
+	report->new_len = len;
+	return len;
+}
@@ -0,0 +1,110 @@
+/*
+ * Registry of SKU profiles, selected by the longest prefix of the module
+ * serial that a profile claims, e.g. "FRAKMBCP" for the GPU module.
+ *
+ * The prefixes are kept in a trie with one node per character. Few prefixes
+ * share a node, so children are a sibling list; a lookup walks one short
+ * list per serial character and stops at the first character without a
+ * matching child.
+ */
+
+#define SKU_MAX_PROFILES 8
+#define SKU_TRIE_MAX_NODES 256
+
+struct sku_profile {
+	const char *name;
+	const char *prefix;
+	/* Template image the profile generates from */
+	const void *cfg;
+	size_t len;
+	/* Prefix of the PCB serial the template carries, NULL if it has none */
+	const char *pcb;
+};
+
+struct sku_trie_node {
+	char c;
+	/* Index + 1 of the profile whose prefix ends here, 0 if none */
+	uint8_t profile;
+	/* Node indices, 0 if none; node 0 is the root and never a child */
+	uint16_t child;
+	uint16_t sibling;
+};
+
+struct sku_registry {
+	const struct sku_profile *profiles;
+	int nprofiles;
+	struct sku_trie_node nodes[SKU_TRIE_MAX_NODES];
+	int nnodes;
+};
+
+/**
+ * Build the trie over the prefixes of profiles.
+ *
+ * \return 0 on success, -1 if there are too many profiles or nodes, or two
+ *         profiles claim the same prefix
+ */
+static int sku_registry_init(struct sku_registry *reg, const struct sku_profile *profiles, int n)
+{
+	if (n > SKU_MAX_PROFILES)
+		return -1;
+	reg->profiles = profiles;
+	reg->nprofiles = n;
+	memset(&reg->nodes[0], 0, sizeof(reg->nodes[0]));
+	reg->nnodes = 1;
+
+	for (int i = 0; i < n; i++) {
+		uint16_t node = 0;
+
+		for (const char *p = profiles[i].prefix; *p; p++) {
+			uint16_t next = reg->nodes[node].child;
+
+			while (next && reg->nodes[next].c != *p)
+				next = reg->nodes[next].sibling;
+			if (!next) {
+				if (reg->nnodes == SKU_TRIE_MAX_NODES)
+					return -1;
+				next = reg->nnodes++;
+				reg->nodes[next] = (struct sku_trie_node){
+					.c = *p, .sibling = reg->nodes[node].child,
+				};
+				reg->nodes[node].child = next;
+			}
+			node = next;
+		}
+		if (reg->nodes[node].profile)
+			return -1;
+		reg->nodes[node].profile = i + 1;
+	}
+	return 0;
+}
+
+/**
+ * Find the profile with the longest prefix of serial, which need not be
+ * NUL terminated within len bytes.
+ *
+ * \return the profile, NULL if no prefix matches
+ */
+static const struct sku_profile *sku_lookup(const struct sku_registry *reg, const char *serial, size_t len)
+{
+	uint16_t node = 0;
+	int best = 0;
+
+	for (size_t i = 0; i < len && serial[i]; i++) {
+		node = reg->nodes[node].child;
+		while (node && reg->nodes[node].c != serial[i])
+			node = reg->nodes[node].sibling;
+		if (!node)
+			break;
+		if (reg->nodes[node].profile)
+			best = reg->nodes[node].profile;
+	}
+	return best ? &reg->profiles[best - 1] : NULL;
+}
+
+static const struct sku_profile *sku_find(const struct sku_registry *reg, const char *name)
+{
+	for (int i = 0; i < reg->nprofiles; i++)
+		if (strcmp(reg->profiles[i].name, name) == 0)
+			return &reg->profiles[i];
+	return NULL;
+}
@@ -0,0 +1,507 @@
+/*
+ * Concurrent programming of several fixture sites, each on its own bus.
+ *
+ * Every site runs a small state machine: write one page, poll for the ACK
+ * that ends the EEPROM write cycle, move on to the next page, then read the
+ * image back and compare. Each step is a single short bus transaction, and
+ * one event loop steps whichever sites are ready in round robin order. A
+ * site that waits for a write cycle is simply not ready until its next poll
+ * time, so the buses make progress in parallel; the loop only sleeps when
+ * every site is waiting.
+ *
+ * Every phase has a deadline. A phase that runs out of time, a failed
+ * transfer or a read-back mismatch fails the attempt; the unit is retried
+ * from the first page up to max_retries times before it is given up. A site
+ * that gives up STATION_MAX_FAILED_UNITS units in a row is taken offline, so
+ * a broken fixture does not use up the rest of the units.
+ *
+ * Buses are either files standing in for the EEPROM, with a simulated write
+ * cycle and optional NACK injection, or Linux i2c-dev nodes. Adapters that
+ * only do SMBus, such as i2c-stub for testing without hardware, are driven
+ * with I2C block data transfers.
+ */
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#endif
+
+#define STATION_MAX_SITES 16
+#define STATION_POLL_US 500
+#define STATION_LABEL_LEN 32
+/* Units given up in a row before a site is taken offline */
+#define STATION_MAX_FAILED_UNITS 3
+
+enum bus_type {
+	BUS_FILE,
+	BUS_I2C,
+};
+
+enum bus_status {
+	BUS_ACK = 0,
+	/* Device did not answer, e.g. busy with a write cycle */
+	BUS_NACK = -1,
+	BUS_ERROR = -2,
+};
+
+struct station_bus {
+	enum bus_type type;
+	char path[IMAGE_PATH_LEN];
+	int fd;
+	uint8_t addr;
+	/* Adapter only does SMBus, like i2c-stub: block transfers of up to 32 bytes */
+	bool smbus;
+	/* File buses: simulated write cycle and percentage of NACKed transfers */
+	uint64_t write_cycle_us;
+	uint64_t busy_until;
+	int nack_pct;
+	uint32_t rng;
+};
+
+enum site_state {
+	SITE_IDLE,
+	SITE_WRITE,
+	SITE_ACK_POLL,
+	SITE_READBACK,
+	SITE_VERIFY,
+	SITE_DONE,
+};
+
+struct station_site {
+	struct station_bus bus;
+	enum site_state state;
+	char label[STATION_LABEL_LEN];
+	uint8_t image[DEVICE_MAX_LEN];
+	uint8_t readback[DEVICE_MAX_LEN];
+	size_t len;
+	size_t offset;
+	size_t chunk;
+	int attempt;
+	int failed_in_row;
+	/* When the site may be stepped again and when the phase times out */
+	uint64_t next_us;
+	uint64_t deadline_us;
+	uint64_t start_us;
+	/* Statistics */
+	unsigned long units;
+	unsigned long failed;
+	unsigned long retries;
+	unsigned long transfers;
+	unsigned long nacks;
+	uint64_t bytes;
+	uint64_t busy_us;
+};
+
+struct station_params {
+	size_t page_size;
+	size_t max_xfer;
+	size_t addr_len;
+	uint64_t timeout_us;
+	int max_retries;
+	/* Fill image with the next unit; 0 on success, -1 when there are no more */
+	int (*next_unit)(void *ctx, uint8_t *image, size_t *len, char *label);
+	void *ctx;
+};
+
+static inline uint64_t station_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Parse a site "file:PATH[,cycle=MS][,nack=PCT]" or "i2c:DEVICE[@ADDR]".
+ *
+ * \return 0 on success, -1 if malformed
+ */
+static int bus_parse(struct station_bus *bus, const char *spec)
+{
+	const char *p;
+	char *end;
+	size_t n;
+
+	memset(bus, 0, sizeof(*bus));
+	bus->fd = -1;
+	bus->addr = 0x50;
+	bus->write_cycle_us = 5000;
+	if (strncmp(spec, "file:", 5) == 0) {
+		bus->type = BUS_FILE;
+		spec += 5;
+		n = strcspn(spec, ",");
+		if (n == 0 || n >= sizeof(bus->path))
+			return -1;
+		memcpy(bus->path, spec, n);
+		for (p = spec + n; *p == ','; p = end) {
+			if (strncmp(p, ",cycle=", 7) == 0)
+				bus->write_cycle_us = strtoul(p + 7, &end, 0) * 1000;
+			else if (strncmp(p, ",nack=", 6) == 0)
+				bus->nack_pct = strtoul(p + 6, &end, 0);
+			else
+				return -1;
+		}
+		return *p ? -1 : 0;
+	}
+	if (strncmp(spec, "i2c:", 4) == 0) {
+		bus->type = BUS_I2C;
+		spec += 4;
+		n = strcspn(spec, "@");
+		if (n == 0 || n >= sizeof(bus->path))
+			return -1;
+		memcpy(bus->path, spec, n);
+		if (spec[n] == '@') {
+			unsigned long addr = strtoul(spec + n + 1, &end, 0);
+			if (*end || addr > 0x7F)
+				return -1;
+			bus->addr = addr;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+static int bus_open(struct station_bus *bus)
+{
+	if (bus->type == BUS_FILE) {
+		bus->fd = open(bus->path, O_RDWR | O_CREAT, 0644);
+		bus->rng = crc_finalize(crc_update(crc_init(), bus->path, strlen(bus->path))) | 1;
+	} else {
+#ifdef __linux__
+		unsigned long funcs = 0;
+
+		bus->fd = open(bus->path, O_RDWR);
+		if (bus->fd >= 0 && ioctl(bus->fd, I2C_FUNCS, &funcs) == 0 && !(funcs & I2C_FUNC_I2C)) {
+			bus->smbus = true;
+			if (!(funcs & I2C_FUNC_SMBUS_I2C_BLOCK) || ioctl(bus->fd, I2C_SLAVE, bus->addr) < 0) {
+				close(bus->fd);
+				bus->fd = -1;
+				errno = EOPNOTSUPP;
+			}
+		}
+#else
+		errno = ENOSYS;
+#endif
+	}
+	if (bus->fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", bus->path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void bus_close(struct station_bus *bus)
+{
+	if (bus->fd >= 0)
+		close(bus->fd);
+	bus->fd = -1;
+}
+
+/* A file bus is busy during a write cycle and NACKs nack_pct of transfers */
+static bool bus_file_nack(struct station_bus *bus, uint64_t now)
+{
+	if (now < bus->busy_until)
+		return true;
+	bus->rng ^= bus->rng << 13;
+	bus->rng ^= bus->rng >> 17;
+	bus->rng ^= bus->rng << 5;
+	return bus->nack_pct && (int)(bus->rng % 100) < bus->nack_pct;
+}
+
+#ifdef __linux__
+static enum bus_status bus_i2c_transfer(struct station_bus *bus, struct i2c_msg *msgs, int n)
+{
+	struct i2c_rdwr_ioctl_data xfer = {.msgs = msgs, .nmsgs = n};
+
+	if (ioctl(bus->fd, I2C_RDWR, &xfer) == n)
+		return BUS_ACK;
+	/* Adapters report an unanswered address as ENXIO or EREMOTEIO */
+	return errno == ENXIO || errno == EREMOTEIO || errno == EAGAIN ? BUS_NACK : BUS_ERROR;
+}
+#endif
+
+static inline size_t bus_max_xfer(const struct station_bus *bus, size_t max_xfer)
+{
+#ifdef __linux__
+	if (bus->smbus && max_xfer > I2C_SMBUS_BLOCK_MAX)
+		return I2C_SMBUS_BLOCK_MAX;
+#endif
+	return max_xfer;
+}
+
+#ifdef __linux__
+static enum bus_status bus_smbus(struct station_bus *bus, char read_write, uint8_t command, int size,
+	union i2c_smbus_data *data)
+{
+	struct i2c_smbus_ioctl_data args = {
+		.read_write = read_write, .command = command, .size = size, .data = data,
+	};
+
+	if (ioctl(bus->fd, I2C_SMBUS, &args) == 0)
+		return BUS_ACK;
+	return errno == ENXIO || errno == EREMOTEIO || errno == EAGAIN ? BUS_NACK : BUS_ERROR;
+}
+#endif
+
+/* alen is the number of memory address bytes, 2 for devices above 256 bytes */
+static enum bus_status bus_write(struct station_bus *bus, size_t offset, const uint8_t *data, size_t len,
+	size_t alen)
+{
+	uint64_t now = station_now_us();
+
+	if (bus->type == BUS_FILE) {
+		if (bus_file_nack(bus, now))
+			return BUS_NACK;
+		if (pwrite(bus->fd, data, len, offset) != (ssize_t)len)
+			return BUS_ERROR;
+		bus->busy_until = now + bus->write_cycle_us;
+		return BUS_ACK;
+	}
+#ifdef __linux__
+	if (bus->smbus) {
+		union i2c_smbus_data smbus = {.block = {len}};
+
+		if (alen != 1)
+			return BUS_ERROR;
+		memcpy(smbus.block + 1, data, len);
+		return bus_smbus(bus, I2C_SMBUS_WRITE, offset, I2C_SMBUS_I2C_BLOCK_DATA, &smbus);
+	} else {
+		uint8_t buf[2 + DEVICE_MAX_LEN];
+		struct i2c_msg msg = {.addr = bus->addr, .flags = 0, .len = alen + len, .buf = buf};
+
+		if (alen == 2)
+			buf[0] = offset >> 8;
+		buf[alen - 1] = offset & 0xFF;
+		memcpy(buf + alen, data, len);
+		return bus_i2c_transfer(bus, &msg, 1);
+	}
+#else
+	return BUS_ERROR;
+#endif
+}
+
+static enum bus_status bus_read(struct station_bus *bus, size_t offset, uint8_t *data, size_t len,
+	size_t alen)
+{
+	uint64_t now = station_now_us();
+
+	if (bus->type == BUS_FILE) {
+		ssize_t n;
+
+		if (bus_file_nack(bus, now))
+			return BUS_NACK;
+		n = pread(bus->fd, data, len, offset);
+		if (n < 0)
+			return BUS_ERROR;
+		/* Never written bytes of a fresh EEPROM read as 0xFF */
+		memset(data + n, 0xFF, len - n);
+		return BUS_ACK;
+	}
+#ifdef __linux__
+	if (bus->smbus) {
+		union i2c_smbus_data smbus = {.block = {len}};
+		enum bus_status st;
+
+		if (alen != 1)
+			return BUS_ERROR;
+		st = bus_smbus(bus, I2C_SMBUS_READ, offset, I2C_SMBUS_I2C_BLOCK_DATA, &smbus);
+		if (st == BUS_ACK)
+			memcpy(data, smbus.block + 1, len);
+		return st;
+	} else {
+		uint8_t addr[2];
+		struct i2c_msg msgs[2] = {
+			{.addr = bus->addr, .flags = 0, .len = alen, .buf = addr},
+			{.addr = bus->addr, .flags = I2C_M_RD, .len = len, .buf = data},
+		};
+
+		if (alen == 2)
+			addr[0] = offset >> 8;
+		addr[alen - 1] = offset & 0xFF;
+		return bus_i2c_transfer(bus, msgs, 2);
+	}
+#else
+	return BUS_ERROR;
+#endif
+}
+
+/* Address only transfer, ACKed once the write cycle is over */
+static enum bus_status bus_probe(struct station_bus *bus)
+{
+	if (bus->type == BUS_FILE)
+		return bus_file_nack(bus, station_now_us()) ? BUS_NACK : BUS_ACK;
+#ifdef __linux__
+	if (bus->smbus) {
+		return bus_smbus(bus, I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK, NULL);
+	} else {
+		struct i2c_msg msg = {.addr = bus->addr, .flags = 0, .len = 0, .buf = NULL};
+		return bus_i2c_transfer(bus, &msg, 1);
+	}
+#else
+	return BUS_ERROR;
+#endif
+}
+
+static void site_phase(struct station_site *site, const struct station_params *p, enum site_state state,
+	uint64_t now)
+{
+	site->state = state;
+	site->next_us = now;
+	site->deadline_us = now + p->timeout_us;
+}
+
+static void site_fail(struct station_site *site, const struct station_params *p, const char *why, uint64_t now)
+{
+	if (site->attempt < p->max_retries) {
+		site->attempt++;
+		site->retries++;
+		fprintf(stderr, "%s: %s: %s, retry %d\n", site->bus.path, site->label, why, site->attempt);
+		site->offset = 0;
+		site_phase(site, p, SITE_WRITE, now);
+		return;
+	}
+	fprintf(stderr, "%s: %s: %s, giving up\n", site->bus.path, site->label, why);
+	site->failed++;
+	site->busy_us += now - site->start_us;
+	site->state = SITE_IDLE;
+	site->next_us = now;
+	if (++site->failed_in_row == STATION_MAX_FAILED_UNITS) {
+		fprintf(stderr, "%s: %d units failed in a row, taking the site offline\n", site->bus.path,
+			site->failed_in_row);
+		site->state = SITE_DONE;
+	}
+}
+
+/* Bytes for the next write: up to max_xfer, without crossing a page */
+static size_t site_write_chunk(const struct station_site *site, const struct station_params *p)
+{
+	size_t n = site->len - site->offset;
+	size_t page_left = p->page_size - site->offset % p->page_size;
+	size_t max = bus_max_xfer(&site->bus, p->max_xfer);
+
+	if (n > max)
+		n = max;
+	return n < page_left ? n : page_left;
+}
+
+/**
+ * Advance a site by at most one bus transaction.
+ */
+static void site_step(struct station_site *site, const struct station_params *p)
+{
+	uint64_t now = station_now_us();
+	enum bus_status st = BUS_ACK;
+
+	if (site->state != SITE_IDLE && site->state != SITE_DONE && now > site->deadline_us) {
+		site_fail(site, p, "timeout", now);
+		return;
+	}
+
+	switch (site->state) {
+	case SITE_IDLE:
+		if (p->next_unit(p->ctx, site->image, &site->len, site->label)) {
+			site->state = SITE_DONE;
+			return;
+		}
+		site->offset = 0;
+		site->attempt = 0;
+		site->start_us = now;
+		site_phase(site, p, SITE_WRITE, now);
+		return;
+	case SITE_WRITE:
+		site->chunk = site_write_chunk(site, p);
+		st = bus_write(&site->bus, site->offset, site->image + site->offset, site->chunk, p->addr_len);
+		if (st == BUS_ACK) {
+			site->bytes += site->chunk;
+			site_phase(site, p, SITE_ACK_POLL, now);
+			site->next_us = now + STATION_POLL_US;
+		}
+		break;
+	case SITE_ACK_POLL:
+		st = bus_probe(&site->bus);
+		if (st == BUS_ACK) {
+			site->offset += site->chunk;
+			site_phase(site, p, site->offset < site->len ? SITE_WRITE : SITE_READBACK, now);
+			if (site->state == SITE_READBACK)
+				site->offset = 0;
+		}
+		break;
+	case SITE_READBACK:
+		site->chunk = site->len - site->offset;
+		if (site->chunk > bus_max_xfer(&site->bus, p->max_xfer))
+			site->chunk = bus_max_xfer(&site->bus, p->max_xfer);
+		st = bus_read(&site->bus, site->offset, site->readback + site->offset, site->chunk, p->addr_len);
+		if (st == BUS_ACK) {
+			site->bytes += site->chunk;
+			site->offset += site->chunk;
+			if (site->offset == site->len)
+				site_phase(site, p, SITE_VERIFY, now);
+		}
+		break;
+	case SITE_VERIFY:
+		if (memcmp(site->image, site->readback, site->len) != 0) {
+			site_fail(site, p, "read-back mismatch", now);
+			return;
+		}
+		site->units++;
+		site->failed_in_row = 0;
+		site->busy_us += now - site->start_us;
+		site->state = SITE_IDLE;
+		site->next_us = now;
+		return;
+	case SITE_DONE:
+		return;
+	}
+
+	site->transfers++;
+	if (st == BUS_NACK) {
+		/* Expected while polling for the end of a write cycle */
+		if (site->state != SITE_ACK_POLL)
+			site->nacks++;
+		site->next_us = now + STATION_POLL_US;
+	} else if (st == BUS_ERROR) {
+		site_fail(site, p, strerror(errno), now);
+	}
+}
+
+/**
+ * Program units on all sites until next_unit runs dry.
+ *
+ * \return number of units that failed on every attempt
+ */
+static unsigned long station_run(struct station_site *sites, int nsites, const struct station_params *p)
+{
+	unsigned long failed = 0;
+	int active = nsites;
+
+	while (active) {
+		uint64_t now = station_now_us();
+		uint64_t wake = UINT64_MAX;
+
+		active = 0;
+		for (int i = 0; i < nsites; i++) {
+			struct station_site *site = &sites[i];
+
+			if (site->state == SITE_DONE)
+				continue;
+			if (site->next_us <= now)
+				site_step(site, p);
+			if (site->state == SITE_DONE)
+				continue;
+			active++;
+			if (site->next_us < wake)
+				wake = site->next_us;
+		}
+		now = station_now_us();
+		if (active && wake > now) {
+			struct timespec ts = {
+				.tv_sec = (wake - now) / 1000000,
+				.tv_nsec = (wake - now) % 1000000 * 1000,
+			};
+			nanosleep(&ts, NULL);
+		}
+	}
+	for (int i = 0; i < nsites; i++)
+		failed += sites[i].failed;
+	return failed;
+}
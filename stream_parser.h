@@ -0,0 +1,202 @@
+/*
+ * Push parser for descriptors arriving in pieces, e.g. from a slow I2C read
+ * or a test fixture.
+ *
+ * Bytes are fed in chunks of any size. The header is reported as soon as
+ * it is complete and its CRC checked, each block as soon as its body is
+ * complete. The descriptor CRC is computed along the way and checked when
+ * the last block arrives, so a bad card is rejected at the first bad header
+ * or block rather than after a full read. Block events arrive before the
+ * descriptor CRC is known; users that act on content should wait for done.
+ */
+
+/* Integrity checks, also used on complete images by check_image() */
+static const char descriptor_magic[4] = {0x32, 0xac, 0x00, 0x00};
+
+/**
+ * CRC of the blocks following the header, as stored in descriptor_crc32.
+ */
+static uint32_t descriptor_body_crc(const uint8_t *image)
+{
+	crc_t crc = crc_init();
+	crc = crc_update(crc, image + sizeof(struct gpu_cfg_descriptor), view_desc_descriptor_length(image));
+	return crc_finalize(crc);
+}
+
+/**
+ * CRC of the header up to the crc32 field.
+ */
+static uint32_t descriptor_header_crc(const uint8_t *image)
+{
+	crc_t crc = crc_init();
+	crc = crc_update(crc, image, offsetof(struct gpu_cfg_descriptor, crc32));
+	return crc_finalize(crc);
+}
+
+enum parser_state {
+	PARSER_HEADER,
+	PARSER_BLOCK_HEADER,
+	PARSER_BLOCK_BODY,
+	/* Bytes covered by descriptor_length after the last whole block */
+	PARSER_TRAILER,
+	PARSER_DONE,
+	PARSER_ERROR,
+};
+
+/* desc and hdr are the raw header and block header, see image_view.h */
+struct parser_callbacks {
+	void (*header)(void *ctx, const uint8_t *desc);
+	/* offset is the position of the block header in the image */
+	void (*block)(void *ctx, const uint8_t *desc, const uint8_t *hdr, const uint8_t *body, uint32_t offset);
+	void (*done)(void *ctx, const uint8_t *desc);
+};
+
+struct stream_parser {
+	enum parser_state state;
+	const struct parser_callbacks *cb;
+	void *ctx;
+	uint8_t desc[sizeof(struct gpu_cfg_descriptor)];
+	uint8_t hdr[sizeof(struct gpu_block_header)];
+	/* The header, block header or block body being collected */
+	uint8_t unit[GPU_MAX_BLOCK_LEN > sizeof(struct gpu_cfg_descriptor) ?
+		GPU_MAX_BLOCK_LEN : sizeof(struct gpu_cfg_descriptor)];
+	uint32_t have;
+	uint32_t need;
+	/* Image offset of the unit being collected */
+	uint32_t offset;
+	/* Bytes of the descriptor body not yet collected */
+	uint32_t remaining;
+	crc_t crc;
+	const char *error;
+};
+
+static void parser_init(struct stream_parser *p, const struct parser_callbacks *cb, void *ctx)
+{
+	memset(p, 0, sizeof(*p));
+	p->state = PARSER_HEADER;
+	p->need = sizeof(struct gpu_cfg_descriptor);
+	p->cb = cb;
+	p->ctx = ctx;
+	p->crc = crc_init();
+}
+
+static void parser_fail(struct stream_parser *p, const char *error)
+{
+	p->state = PARSER_ERROR;
+	p->error = error;
+}
+
+/* Collect the next unit of the body, or finish if there is none */
+static void parser_next(struct stream_parser *p)
+{
+	p->offset += p->need;
+	p->have = 0;
+	if (p->remaining >= sizeof(struct gpu_block_header)) {
+		p->state = PARSER_BLOCK_HEADER;
+		p->need = sizeof(struct gpu_block_header);
+	} else if (p->remaining) {
+		p->state = PARSER_TRAILER;
+		p->need = p->remaining;
+	} else if (crc_finalize(p->crc) != view_desc_descriptor_crc32(p->desc)) {
+		parser_fail(p, "descriptor CRC mismatch");
+	} else {
+		p->state = PARSER_DONE;
+		if (p->cb->done)
+			p->cb->done(p->ctx, p->desc);
+	}
+}
+
+static void parser_unit(struct stream_parser *p)
+{
+	switch (p->state) {
+	case PARSER_HEADER:
+		memcpy(p->desc, p->unit, sizeof(p->desc));
+		if (memcmp(view_desc_magic(p->desc), descriptor_magic, sizeof(descriptor_magic)) != 0) {
+			parser_fail(p, "bad magic");
+			return;
+		}
+		if (view_desc_crc32(p->desc) != descriptor_header_crc(p->desc)) {
+			parser_fail(p, "header CRC mismatch");
+			return;
+		}
+		if (view_desc_descriptor_version_major(p->desc) > GPU_CFG_VERSION_MAJOR) {
+			parser_fail(p, "unsupported descriptor version");
+			return;
+		}
+		if (p->cb->header)
+			p->cb->header(p->ctx, p->desc);
+		p->remaining = view_desc_descriptor_length(p->desc);
+		parser_next(p);
+		break;
+	case PARSER_BLOCK_HEADER:
+		memcpy(p->hdr, p->unit, sizeof(p->hdr));
+		p->remaining -= sizeof(p->hdr);
+		if (view_block_block_length(p->hdr) > p->remaining) {
+			parser_fail(p, "block runs past the descriptor");
+			return;
+		}
+		if (view_block_block_length(p->hdr)) {
+			p->offset += sizeof(p->hdr);
+			p->state = PARSER_BLOCK_BODY;
+			p->have = 0;
+			p->need = view_block_block_length(p->hdr);
+			break;
+		}
+		if (p->cb->block)
+			p->cb->block(p->ctx, p->desc, p->hdr, p->unit, p->offset);
+		parser_next(p);
+		break;
+	case PARSER_BLOCK_BODY:
+		p->remaining -= p->need;
+		if (p->cb->block)
+			p->cb->block(p->ctx, p->desc, p->hdr, p->unit, p->offset - sizeof(p->hdr));
+		parser_next(p);
+		break;
+	case PARSER_TRAILER:
+		p->remaining = 0;
+		parser_next(p);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Feed the next len bytes of the image. Bytes after the end of the
+ * descriptor are ignored.
+ *
+ * \return the parser state after consuming the bytes
+ */
+static enum parser_state parser_feed(struct stream_parser *p, const void *data, size_t len)
+{
+	const uint8_t *in = data;
+
+	while (len && p->state != PARSER_DONE && p->state != PARSER_ERROR) {
+		uint32_t n = p->need - p->have;
+
+		if (n > len)
+			n = len;
+		memcpy(p->unit + p->have, in, n);
+		if (p->state != PARSER_HEADER)
+			p->crc = crc_update(p->crc, in, n);
+		p->have += n;
+		in += n;
+		len -= n;
+		if (p->have == p->need)
+			parser_unit(p);
+	}
+	return p->state;
+}
+
+/**
+ * Signal the end of input.
+ *
+ * \return NULL if a complete and intact descriptor was parsed, otherwise a
+ *         description of the problem
+ */
+static const char *parser_finish(struct stream_parser *p)
+{
+	if (p->state != PARSER_DONE && p->state != PARSER_ERROR)
+		parser_fail(p, "truncated");
+	return p->error;
+}
@@ -0,0 +1,78 @@
+/*
+ * Image views against casts to the packed structs: read 7 header fields
+ * from each of 4096 images, with the images 8 byte aligned and at an odd
+ * offset. Run with make bench, which builds with -O2.
+ */
+#include "test.h"
+
+#define BENCH_IMAGES 4096
+#define BENCH_ROUNDS 2000
+
+/* Room for every image plus an offset of up to 7 bytes */
+static uint8_t bench_images[BENCH_IMAGES][256] __attribute__((aligned(8)));
+
+static __attribute__((noinline)) uint32_t read_cast(const uint8_t *base, size_t stride)
+{
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i < BENCH_IMAGES; i++) {
+		const struct gpu_cfg_descriptor *d = (const struct gpu_cfg_descriptor *)(base + i * stride);
+
+		sum += d->length + d->descriptor_version_major + d->descriptor_version_minor + d->hardware_version +
+			d->descriptor_length + d->descriptor_crc32 + d->crc32;
+	}
+	return sum;
+}
+
+static __attribute__((noinline)) uint32_t read_view(const uint8_t *base, size_t stride)
+{
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i < BENCH_IMAGES; i++) {
+		const uint8_t *d = base + i * stride;
+
+		sum += view_desc_length(d) + view_desc_descriptor_version_major(d) +
+			view_desc_descriptor_version_minor(d) + view_desc_hardware_version(d) +
+			view_desc_descriptor_length(d) + view_desc_descriptor_crc32(d) + view_desc_crc32(d);
+	}
+	return sum;
+}
+
+static double bench_ns(uint32_t (*read)(const uint8_t *, size_t), const uint8_t *base, uint32_t *sum)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		*sum += read(base, sizeof(bench_images[0]));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) /
+		((double)BENCH_ROUNDS * BENCH_IMAGES);
+}
+
+int main(void)
+{
+	static const size_t offsets[] = {0, 1};
+	static const char *names[] = {"aligned", "unaligned"};
+
+	test_init();
+	for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+		const uint8_t *base = bench_images[0] + offsets[o];
+		uint32_t cast_sum = 0, view_sum = 0;
+		double cast_ns, view_ns;
+
+		for (size_t i = 0; i < BENCH_IMAGES; i++) {
+			memcpy(bench_images[i] + offsets[o], &gpu_cfg, sizeof(struct gpu_cfg_descriptor));
+			view_desc_set_crc32(bench_images[i] + offsets[o], i);
+		}
+		/* Warm up, then alternate so neither side gets a cold cache */
+		read_cast(base, sizeof(bench_images[0]));
+		read_view(base, sizeof(bench_images[0]));
+		cast_ns = bench_ns(read_cast, base, &cast_sum);
+		view_ns = bench_ns(read_view, base, &view_sum);
+		printf("%-10s cast %.2f ns/image, view %.2f ns/image\n", names[o], cast_ns, view_ns);
+		CHECK(cast_sum == view_sum);
+	}
+	return test_report("bench_view");
+}
@@ -0,0 +1,41 @@
+/*
+ * Support for the unit tests. Each test program is built with the whole
+ * generator as one translation unit, so the static helpers of the headers
+ * and of gpu_cfg_generator.c can be called directly; the generator's main()
+ * is renamed out of the way.
+ */
+#define main gpu_cfg_main
+#include "../gpu_cfg_generator.c"
+#undef main
+
+static int test_checks;
+static int test_failures;
+
+#define CHECK(cond) \
+	do { \
+		test_checks++; \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while (0)
+
+/* Set up what main() would before the tests touch profiles */
+static void test_init(void)
+{
+	if (sku_registry_init(&skus, sku_profiles, sizeof(sku_profiles) / sizeof(sku_profiles[0]))) {
+		fprintf(stderr, "cannot build the SKU registry\n");
+		exit(1);
+	}
+}
+
+/**
+ * Print the summary line of a test program.
+ *
+ * \return exit status for main()
+ */
+static int test_report(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+	return test_failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Round trips between descriptor versions 0.1 and 0.2.
+ */
+#include "test.h"
+
+/* Encoding to 0.2 and back must give the 0.1 image byte for byte */
+static void test_profile_round_trip(const struct sku_profile *profile, bool extra_blocks)
+{
+	uint8_t image[IMAGE_MAX_LEN], encoded[IMAGE_MAX_LEN], decoded[IMAGE_MAX_LEN];
+	size_t len = profile->len;
+	size_t elen, dlen;
+
+	memcpy(image, profile->cfg, len);
+	if (extra_blocks) {
+		len = add_gpio_actions(image, len, sizeof(image));
+		CHECK(len > profile->len);
+	}
+	stamp_eeprom("FRAKMBCP81331ASSY0", image, len);
+
+	elen = compact_encode(image, len, encoded, sizeof(encoded));
+	CHECK(elen > sizeof(struct gpu_cfg_descriptor) && elen < len);
+	CHECK(is_compact(encoded));
+	CHECK(view_desc_descriptor_length(encoded) == elen - sizeof(struct gpu_cfg_descriptor));
+
+	dlen = compact_decode(encoded, elen, decoded, sizeof(decoded));
+	CHECK(dlen == len);
+	CHECK(!is_compact(decoded));
+	CHECK(memcmp(decoded, image, len) == 0);
+}
+
+/* Random GPIO entries with representable flags survive both directions */
+static void test_gpio_entries(void)
+{
+	uint8_t body[GPU_MAX_BLOCK_LEN], compact[GPU_MAX_BLOCK_LEN], expanded[2 * GPU_MAX_BLOCK_LEN];
+	uint32_t rng = 1;
+
+	for (int round = 0; round < 1000; round++) {
+		size_t n = fuzz_rand(&rng) % (GPU_MAX_BLOCK_LEN / sizeof(struct gpu_cfg_gpio));
+		size_t len = n * sizeof(struct gpu_cfg_gpio);
+
+		for (size_t i = 0; i < n; i++) {
+			uint8_t *e = body + i * sizeof(struct gpu_cfg_gpio);
+
+			view_gpio_set_gpio(e, fuzz_rand(&rng));
+			view_gpio_set_function(e, fuzz_rand(&rng));
+			view_gpio_set_flags(e, (fuzz_rand(&rng) & 0xFF) << GPU_GPIO_COMPACT_SHIFT);
+			view_gpio_set_power_domain(e, fuzz_rand(&rng));
+		}
+		CHECK(compact_gpio(body, len, compact) == n * sizeof(struct gpu_cfg_gpio_compact));
+		CHECK(expand_gpio(compact, n * sizeof(struct gpu_cfg_gpio_compact), expanded) == len);
+		CHECK(memcmp(expanded, body, len) == 0);
+	}
+}
+
+/* Flags outside bits 16-23 have no 0.2 encoding and must be refused */
+static void test_unrepresentable_flags(void)
+{
+	uint8_t image[IMAGE_MAX_LEN], encoded[IMAGE_MAX_LEN];
+	size_t len = sizeof(gpu_cfg);
+	struct block_index idx;
+	long offset;
+
+	memcpy(image, &gpu_cfg, len);
+	block_index_build(&idx, image, len);
+	offset = block_index_find(&idx, &cfg_blocks[BLK_GPIO], 0);
+	CHECK(offset > 0);
+	view_gpio_set_flags(image + offset, view_gpio_flags(image + offset) | 1);
+	CHECK(compact_encode(image, len, encoded, sizeof(encoded)) == 0);
+}
+
+/* The thermal sensor keeps type and address, 0.2 drops the reserved words */
+static void test_thermal(void)
+{
+	uint8_t body[sizeof(struct gpu_cfg_thermal)], compact[sizeof(struct gpu_cfg_thermal)];
+	uint8_t expanded[sizeof(struct gpu_cfg_thermal)];
+
+	memset(body, 0, sizeof(body));
+	view_thermal_set_thermal_type(body, GPU_THERM_F75303);
+	view_thermal_set_address(body, 0x4d);
+	CHECK(compact_thermal(body, sizeof(body), compact) == sizeof(struct gpu_cfg_thermal_compact));
+	CHECK(expand_thermal(compact, sizeof(struct gpu_cfg_thermal_compact), expanded) == sizeof(body));
+	CHECK(memcmp(expanded, body, sizeof(body)) == 0);
+	CHECK(expand_thermal(compact, 1, expanded) == 0);
+}
+
+int main(void)
+{
+	test_init();
+	for (int i = 0; i < skus.nprofiles; i++) {
+		test_profile_round_trip(&skus.profiles[i], false);
+		test_profile_round_trip(&skus.profiles[i], true);
+	}
+	test_gpio_entries();
+	test_unrepresentable_flags();
+	test_thermal();
+	return test_report("test_compact");
+}
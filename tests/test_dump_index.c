@@ -0,0 +1,87 @@
+/*
+ * The watch index: one line per unit whatever the number of dumps, keys
+ * for dumps without a serial, and compacting an append-only index.
+ */
+#include "test.h"
+
+static int count_lines(const char *path)
+{
+	char line[DUMP_INDEX_LINE_LEN];
+	FILE *fptr = fopen(path, "r");
+	int n = 0;
+
+	while (fptr && fgets(line, sizeof(line), fptr))
+		n += line[0] != '#';
+	if (fptr)
+		fclose(fptr);
+	return n;
+}
+
+static void test_keys(void)
+{
+	char key[DUMP_INDEX_LINE_LEN];
+
+	dump_index_line_key("FRAKMBCP81331ASSY0,ok,abcd,d/a.bin,1.000\n", key);
+	CHECK(strcmp(key, "FRAKMBCP81331ASSY0") == 0);
+	dump_index_line_key(",unreadable,,d/empty.bin,1.000\n", key);
+	CHECK(strcmp(key, "d/empty.bin") == 0);
+}
+
+static void test_rewrite(const char *dir)
+{
+	char path[IMAGE_PATH_LEN], line[DUMP_INDEX_LINE_LEN], key[32];
+	struct dump_index x;
+	FILE *fptr;
+
+	snprintf(path, sizeof(path), "%s/index.csv", dir);
+
+	/* An append-only index with every unit listed three times */
+	fptr = fopen(path, "w");
+	CHECK(fptr != NULL);
+	if (!fptr)
+		return;
+	fputs(WATCH_INDEX_HEADER, fptr);
+	for (int round = 0; round < 3; round++)
+		for (int unit = 0; unit < 2000; unit++)
+			fprintf(fptr, "FRAKMBCP8133%06d,%s,,d/%d.bin,%d\n", unit, round == 2 ? "ok" : "bad", unit, round);
+	fclose(fptr);
+
+	CHECK(dump_index_open(&x, path) == 0);
+	CHECK(x.count == 2000);
+	CHECK(!x.dirty);
+	snprintf(key, sizeof(key), "FRAKMBCP8133%06d", 7);
+	CHECK(strstr(dump_index_slot(&x, key)->line, ",ok,") != NULL);
+
+	/* A new dump replaces the unit's line, a dump without a serial adds one */
+	snprintf(line, sizeof(line), "%s,bad again,,d/7b.bin,4\n", key);
+	CHECK(dump_index_set(&x, key, line) == 0);
+	CHECK(dump_index_set(&x, "d/junk.bin", ",unreadable,,d/junk.bin,4\n") == 0);
+	CHECK(x.count == 2001);
+	CHECK(x.dirty);
+	CHECK(dump_index_write(&x, WATCH_INDEX_HEADER) == 0);
+	CHECK(!x.dirty);
+	CHECK(access(x.tmp_path, F_OK) != 0);
+	dump_index_close(&x);
+
+	CHECK(count_lines(path) == 2001);
+	CHECK(dump_index_open(&x, path) == 0);
+	CHECK(x.count == 2001);
+	CHECK(strstr(dump_index_slot(&x, key)->line, ",bad again,") != NULL);
+	dump_index_close(&x);
+	unlink(path);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/test_dump_index.XXXXXX";
+
+	test_init();
+	test_keys();
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	test_rewrite(dir);
+	rmdir(dir);
+	return test_report("test_dump_index");
+}
@@ -0,0 +1,109 @@
+/*
+ * Ed25519 against the test vectors of RFC 8032 section 7.1, and rejection
+ * of altered messages, signatures and keys.
+ */
+#include "test.h"
+
+struct ed25519_vector {
+	const char *seed;
+	const char *pk;
+	const char *msg;
+	const char *sig;
+};
+
+static const struct ed25519_vector vectors[] = {
+	/* TEST 1 */
+	{
+		"9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60",
+		"d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a",
+		"",
+		"e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e065224901555fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b",
+	},
+	/* TEST 2 */
+	{
+		"4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb",
+		"3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+		"72",
+		"92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00",
+	},
+	/* TEST 3 */
+	{
+		"c5aa8df43f9f837bedb7442f31dcb7b166d38535076f094b85ce3a2e0b4458f7",
+		"fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025",
+		"af82",
+		"6291d657deec24024827e69c3abe01a30ce548a284743a445e3680d7db5ac3ac18ff9b538d16f290ae67f760984dc6594a7c15e9716ed28dc027beceea1ec40a",
+	},
+};
+
+static size_t unhex(uint8_t *out, const char *hex)
+{
+	size_t n = 0;
+
+	for (; hex[0] && hex[1]; hex += 2) {
+		unsigned int byte;
+
+		sscanf(hex, "%2x", &byte);
+		out[n++] = byte;
+	}
+	return n;
+}
+
+static void test_vector(const struct ed25519_vector *v)
+{
+	uint8_t seed[ED25519_SEED_LEN], pk[ED25519_PUBKEY_LEN], sig[ED25519_SIG_LEN], msg[64];
+	uint8_t out[ED25519_SIG_LEN];
+	struct ed25519_key key;
+	struct ed25519_pubkey pub;
+	size_t n = unhex(msg, v->msg);
+
+	CHECK(unhex(seed, v->seed) == sizeof(seed));
+	CHECK(unhex(pk, v->pk) == sizeof(pk));
+	CHECK(unhex(sig, v->sig) == sizeof(sig));
+
+	ed25519_key_from_seed(&key, seed);
+	CHECK(memcmp(key.pk, pk, sizeof(pk)) == 0);
+	ed25519_sign(out, msg, n, &key);
+	CHECK(memcmp(out, sig, sizeof(sig)) == 0);
+
+	CHECK(ed25519_pubkey_load(&pub, pk) == 0);
+	CHECK(ed25519_verify(sig, msg, n, &pub) == 0);
+
+	/* Any flipped bit of R or S, or of the message, must be rejected */
+	for (size_t i = 0; i < sizeof(sig) * 8; i += 7) {
+		sig[i / 8] ^= 1 << (i % 8);
+		CHECK(ed25519_verify(sig, msg, n, &pub) != 0);
+		sig[i / 8] ^= 1 << (i % 8);
+	}
+	if (n) {
+		msg[0] ^= 1;
+		CHECK(ed25519_verify(sig, msg, n, &pub) != 0);
+		msg[0] ^= 1;
+	}
+	CHECK(ed25519_verify(sig, msg, n + 1, &pub) != 0);
+}
+
+/* Each vector's signature under another vector's key */
+static void test_wrong_key(void)
+{
+	for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		const struct ed25519_vector *v = &vectors[i], *other = &vectors[(i + 1) % 3];
+		uint8_t pk[ED25519_PUBKEY_LEN], sig[ED25519_SIG_LEN], msg[64];
+		struct ed25519_pubkey pub;
+		size_t n = unhex(msg, v->msg);
+
+		unhex(pk, other->pk);
+		unhex(sig, v->sig);
+		CHECK(ed25519_pubkey_load(&pub, pk) == 0);
+		CHECK(ed25519_verify(sig, msg, n, &pub) != 0);
+	}
+}
+
+int main(void)
+{
+	test_init();
+	for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		test_vector(&vectors[i]);
+	}
+	test_wrong_key();
+	return test_report("test_ed25519");
+}
@@ -0,0 +1,116 @@
+/*
+ * Fan curve blocks: point counts at the block size limit, thresholds that
+ * cannot be represented, the number of fans, and the verifier catching bad
+ * tables.
+ */
+#include "test.h"
+
+/* The GPU template with fan 0 given its own thresholds */
+static size_t fan_image(uint8_t *image, uint16_t min_temp, uint16_t max_temp)
+{
+	struct block_index idx;
+	long offset;
+
+	memcpy(image, &gpu_cfg, sizeof(gpu_cfg));
+	block_index_build(&idx, image, sizeof(gpu_cfg));
+	offset = block_index_find(&idx, &cfg_blocks[BLK_FAN], 0);
+	CHECK(offset > 0);
+	view_fan_set_min_temp(image + offset, min_temp);
+	view_fan_set_max_temp(image + offset, max_temp);
+	return sizeof(gpu_cfg);
+}
+
+static const uint8_t *first_curve(const uint8_t *image, size_t len)
+{
+	return raw_element(image, len, GPUCFG_TYPE_FAN_CURVE, sizeof(struct gpu_cfg_fan_curve), 0);
+}
+
+/* Every range up to the widest that fits must give a table the verifier accepts */
+static void test_ranges(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+
+	for (int range = 1; range < 1500; range++) {
+		size_t len = add_fan_curves(image, fan_image(image, 300, 300 + range), sizeof(image));
+		const uint8_t *curve;
+
+		CHECK(len);
+		if (!len) {
+			continue;
+		}
+		curve = first_curve(image, len);
+		CHECK(curve && view_fan_curve_count(curve) <= FAN_CURVE_MAX_POINTS);
+		CHECK(verify_fan_curves("range", image, len) == 0);
+	}
+}
+
+/* 245K at 2K steps needs 126 points, one more than a block holds */
+static void test_block_limit(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+	size_t len = add_fan_curves(image, fan_image(image, 300, 545), sizeof(image));
+	const uint8_t *curve = len ? first_curve(image, len) : NULL;
+
+	CHECK(curve != NULL);
+	if (curve) {
+		CHECK(view_fan_curve_temp_step(curve) == 3);
+		CHECK(view_fan_curve_count(curve) == 85);
+	}
+}
+
+/* The first point sits one step below the fan-off temperature, which must not wrap */
+static void test_underflow(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+
+	CHECK(add_fan_curves(image, fan_image(image, 1, 1000), sizeof(image)) == 0);
+}
+
+/* Fans past the limit are refused rather than left without a curve */
+static void test_fan_limit(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+	size_t len = fan_image(image, 300, 400);
+	const uint8_t *fan = raw_element(image, len, GPUCFG_TYPE_FAN, sizeof(struct gpu_cfg_fan), 0);
+	uint8_t body[sizeof(struct gpu_cfg_fan)];
+	int nfans = 0;
+
+	memcpy(body, fan, sizeof(body));
+	while (raw_element(image, len, GPUCFG_TYPE_FAN, sizeof(struct gpu_cfg_fan), nfans)) {
+		nfans++;
+	}
+	for (; nfans < FAN_CURVE_MAX_FANS; nfans++) {
+		len = append_block(image, len, sizeof(image), GPUCFG_TYPE_FAN, body, sizeof(body));
+	}
+	CHECK(add_fan_curves(image, len, sizeof(image)) > len);
+	len = append_block(image, len, sizeof(image), GPUCFG_TYPE_FAN, body, sizeof(body));
+	CHECK(add_fan_curves(image, len, sizeof(image)) == 0);
+}
+
+static void test_verifier(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+	size_t len = add_fan_curves(image, fan_image(image, 300, 400), sizeof(image));
+	uint8_t *curve = (uint8_t *)first_curve(image, len);
+
+	CHECK(verify_fan_curves("good", image, len) == 0);
+	view_fan_curve_set_rpm(curve, 10, view_fan_curve_rpm(curve, 10) + 1);
+	CHECK(verify_fan_curves("bad point", image, len) == 1);
+	view_fan_curve_set_rpm(curve, 10, view_fan_curve_rpm(curve, 10) - 1);
+	view_fan_curve_set_temp_start(curve, 300);
+	CHECK(verify_fan_curves("bad start", image, len) == 1);
+	view_fan_curve_set_temp_start(curve, 299);
+	view_fan_curve_set_count(curve, view_fan_curve_count(curve) - 1);
+	CHECK(verify_fan_curves("bad count", image, len) > 0);
+}
+
+int main(void)
+{
+	test_init();
+	test_ranges();
+	test_block_limit();
+	test_underflow();
+	test_fan_limit();
+	test_verifier();
+	return test_report("test_fan_curve");
+}
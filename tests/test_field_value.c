@@ -0,0 +1,70 @@
+/*
+ * Field values given on the command line and in manifests: signs, blanks,
+ * overflow, the width of each field and the fields that cannot be set.
+ */
+#include "test.h"
+
+static const struct cfg_field *field(const char *path)
+{
+	struct field_ref ref;
+
+	if (parse_field_ref(path, &ref)) {
+		fprintf(stderr, "unknown field %s\n", path);
+		exit(1);
+	}
+	return ref.field;
+}
+
+static bool accepts(const char *path, const char *text, uint32_t expect)
+{
+	uint32_t value = ~expect;
+
+	return parse_field_value(field(path), text, &value) == NULL && value == expect;
+}
+
+static bool rejects(const char *path, const char *text)
+{
+	uint32_t value;
+
+	return parse_field_value(field(path), text, &value) != NULL;
+}
+
+int main(void)
+{
+	struct field_edit edit;
+
+	test_init();
+
+	/* 1 byte */
+	CHECK(accepts("power.peak_power", "0", 0));
+	CHECK(accepts("power.peak_power", "255", 255));
+	CHECK(accepts("power.peak_power", "0xff", 255));
+	CHECK(rejects("power.peak_power", "256"));
+
+	/* 2 bytes */
+	CHECK(accepts("fan.max_rpm", "65535", 65535));
+	CHECK(rejects("fan.max_rpm", "65536"));
+
+	/* 4 bytes */
+	CHECK(accepts("gpio.flags", "4294967295", 0xFFFFFFFF));
+	CHECK(accepts("gpio.flags", "0x80000000", 0x80000000));
+	CHECK(rejects("gpio.flags", "4294967296"));
+	CHECK(rejects("gpio.flags", "0x1ffffffff"));
+	CHECK(rejects("gpio.flags", "99999999999999999999999"));
+
+	/* strtoul would take these and wrap or skip over them */
+	CHECK(rejects("gpio.flags", "-1"));
+	CHECK(rejects("fan.max_rpm", "-1"));
+	CHECK(rejects("fan.max_rpm", "+1"));
+	CHECK(rejects("fan.max_rpm", " 1"));
+	CHECK(rejects("fan.max_rpm", ""));
+	CHECK(rejects("fan.max_rpm", "1 "));
+	CHECK(rejects("fan.max_rpm", "12k"));
+
+	/* The version decides the block layout, only --migrate changes it */
+	CHECK(parse_field_edit("header.descriptor_version_minor=2", &edit) != 0);
+	CHECK(parse_field_edit("header.descriptor_version_major=5", &edit) != 0);
+	CHECK(parse_field_edit("header.hardware_revision=5", &edit) == 0);
+
+	return test_report("test_field_value");
+}
@@ -0,0 +1,74 @@
+/*
+ * GPIO action tables: the power state order around S0ix and the simulator
+ * catching tables that do not match the GPIO entries.
+ */
+#include "test.h"
+
+static size_t actions_image(uint8_t *image)
+{
+	memcpy(image, &gpu_cfg, sizeof(gpu_cfg));
+	return add_gpio_actions(image, sizeof(gpu_cfg), IMAGE_MAX_LEN);
+}
+
+static uint8_t *actions_entry(uint8_t *image, size_t len, int state)
+{
+	return (uint8_t *)raw_element(image, len, GPUCFG_TYPE_GPIO_ACTIONS, sizeof(struct gpu_cfg_gpio_actions), state);
+}
+
+/* S0ix sits below S0, so outputs in the S0 domain are low in S0ix */
+static void test_s0ix_order(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+	size_t len = actions_image(image);
+	const uint8_t *entry;
+	int s0_outputs = 0;
+
+	CHECK(len);
+	for (int i = 0; (entry = raw_element(image, len, GPUCFG_TYPE_GPIO, sizeof(struct gpu_cfg_gpio), i)); i++) {
+		uint32_t bit = 1U << view_gpio_gpio(entry);
+
+		if (view_gpio_power_domain(entry) != POWER_S0 || !sim_static_output(entry) ||
+				view_gpio_function(entry) == GPIO_FUNC_UNUSED) {
+			continue;
+		}
+		s0_outputs++;
+		CHECK(view_gpio_actions_assert_mask(actions_entry(image, len, POWER_S0)) & bit);
+		CHECK(view_gpio_actions_deassert_mask(actions_entry(image, len, POWER_S0ix)) & bit);
+	}
+	CHECK(s0_outputs > 0);
+}
+
+static void test_simulator(void)
+{
+	uint8_t image[IMAGE_MAX_LEN];
+	size_t len = actions_image(image);
+	uint8_t *s3 = actions_entry(image, len, POWER_S3);
+	uint32_t deasserted = view_gpio_actions_deassert_mask(s3);
+	/* An output that is high in S0 and low in S3 */
+	uint32_t high = view_gpio_actions_assert_mask(actions_entry(image, len, POWER_S0)) & deasserted;
+	uint32_t bit = high & -high;
+
+	CHECK(simulate_gpio_actions("good", image, len) == 0);
+
+	/* Leave one output alone on entering S3 */
+	CHECK(bit);
+	view_gpio_actions_set_deassert_mask(s3, deasserted & ~bit);
+	CHECK(simulate_gpio_actions("missing", image, len) > 0);
+
+	/* Drive it high instead */
+	view_gpio_actions_set_assert_mask(s3, view_gpio_actions_assert_mask(s3) | bit);
+	CHECK(simulate_gpio_actions("flipped", image, len) > 0);
+
+	/* Drive an input */
+	view_gpio_actions_set_assert_mask(s3, view_gpio_actions_assert_mask(s3) & ~bit);
+	view_gpio_actions_set_deassert_mask(s3, deasserted | 1U << 31);
+	CHECK(simulate_gpio_actions("input", image, len) > 0);
+}
+
+int main(void)
+{
+	test_init();
+	test_s0ix_order();
+	test_simulator();
+	return test_report("test_gpio_actions");
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# The hash manifest of a batch must not depend on the number of writer
+# threads, including -j 0 (synchronous writes). Usage: test_hash_manifest.sh
+# path/to/gpu_cfg_gen
+set -e
+
+gen=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# GPU and SSD units interleaved, enough rows to wrap the hash ring
+i=0
+while [ $i -lt 300 ]; do
+	n=$(printf '%06d' $i)
+	echo "FRAKMBCP81${n}AS,FRAGMASP81${n}PB"
+	echo "FRAGMBSP81${n}AS"
+	i=$((i + 1))
+done > "$work/units.csv"
+
+for j in 0 1 4; do
+	mkdir "$work/j$j" "$work/j$j/out"
+	(cd "$work/j$j" && "$gen" -b ../units.csv -o out -j $j --hash-manifest out.sha > log.txt)
+done
+
+checks=0
+failed=0
+for j in 1 4; do
+	for f in out.sha out; do
+		checks=$((checks + 1))
+		if ! diff -r "$work/j0/$f" "$work/j$j/$f" > /dev/null; then
+			echo "-j 0 and -j $j differ in $f" >&2
+			failed=$((failed + 1))
+		fi
+	done
+done
+checks=$((checks + 1))
+if [ "$(grep -vc '^#' "$work/j0/out.sha")" -ne 600 ]; then
+	echo "expected 600 rows in the -j 0 manifest" >&2
+	failed=$((failed + 1))
+fi
+
+echo "test_hash_manifest: $checks checks, $failed failed"
+[ $failed -eq 0 ]
@@ -0,0 +1,104 @@
+/*
+ * Descriptor version migration: round trips between 0.1 and 0.2, required
+ * blocks taken from the profile defaults, and defaults that are cut short.
+ */
+#include "test.h"
+
+/* Both images carry the same configuration, ignoring the CRCs */
+static bool same_config(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen)
+{
+	return alen == blen && view_desc_descriptor_version_minor(a) == view_desc_descriptor_version_minor(b) &&
+		view_desc_descriptor_length(a) == view_desc_descriptor_length(b) &&
+		memcmp(a + sizeof(struct gpu_cfg_descriptor), b + sizeof(struct gpu_cfg_descriptor),
+			alen - sizeof(struct gpu_cfg_descriptor)) == 0;
+}
+
+/* A copy of a template without the blocks of one type */
+static size_t without_block(uint8_t *out, const uint8_t *image, size_t len, uint8_t type)
+{
+	size_t pos = sizeof(struct gpu_cfg_descriptor);
+
+	memcpy(out, image, pos);
+	for (size_t offset = pos; offset + sizeof(struct gpu_block_header) <= len;
+			offset += sizeof(struct gpu_block_header) + view_block_block_length(image + offset)) {
+		size_t n = sizeof(struct gpu_block_header) + view_block_block_length(image + offset);
+
+		if (view_block_block_type(image + offset) != type) {
+			memcpy(out + pos, image + offset, n);
+			pos += n;
+		}
+	}
+	view_desc_set_descriptor_length(out, pos - sizeof(struct gpu_cfg_descriptor));
+	return pos;
+}
+
+static void test_round_trip(const struct sku_profile *profile)
+{
+	uint8_t compact[IMAGE_MAX_LEN], back[IMAGE_MAX_LEN];
+	struct migration_report report;
+	size_t clen, blen;
+
+	clen = migrate_image(profile->cfg, profile->len, GPU_CFG_VERSION_MINOR_COMPACT, profile->cfg, profile->len,
+		compact, sizeof(compact), &report);
+	CHECK(clen && !report.error);
+	CHECK(clen < profile->len);
+	CHECK(view_desc_descriptor_version_minor(compact) == GPU_CFG_VERSION_MINOR_COMPACT);
+
+	blen = migrate_image(compact, clen, GPU_CFG_VERSION_MINOR, profile->cfg, profile->len,
+		back, sizeof(back), &report);
+	CHECK(blen && !report.error);
+	CHECK(same_config(back, blen, profile->cfg, profile->len));
+
+	/* Migrating to the current version changes nothing */
+	blen = migrate_image(compact, clen, GPU_CFG_VERSION_MINOR_COMPACT, NULL, 0, back, sizeof(back), &report);
+	CHECK(same_config(back, blen, compact, clen));
+}
+
+/* A missing vendor block comes from the defaults, converted to the target */
+static void test_required(void)
+{
+	uint8_t image[IMAGE_MAX_LEN], out[IMAGE_MAX_LEN];
+	struct migration_report report;
+	size_t len = without_block(image, (const uint8_t *)&gpu_cfg, sizeof(gpu_cfg), GPUCFG_TYPE_VENDOR);
+	size_t n;
+
+	CHECK(len < sizeof(gpu_cfg));
+	n = migrate_image(image, len, GPU_CFG_VERSION_MINOR_COMPACT, (const uint8_t *)&gpu_cfg, sizeof(gpu_cfg),
+		out, sizeof(out), &report);
+	CHECK(n && migrate_has_block(out, n, GPUCFG_TYPE_VENDOR));
+	CHECK(report.nchanges > 0 && report.changes[report.nchanges - 1].action == MIGRATE_ADDED);
+
+	n = migrate_image(image, len, GPU_CFG_VERSION_MINOR_COMPACT, NULL, 0, out, sizeof(out), &report);
+	CHECK(n == 0 && report.error);
+
+	/* Defaults cut short of their descriptor_length are refused, not read past */
+	for (size_t cut = 0; cut < sizeof(gpu_cfg); cut += 13) {
+		n = migrate_image(image, len, GPU_CFG_VERSION_MINOR_COMPACT, (const uint8_t *)&gpu_cfg, cut,
+			out, sizeof(out), &report);
+		CHECK(n == 0 && report.error);
+	}
+}
+
+/* A block whose length runs past the descriptor is an error */
+static void test_truncated_chain(void)
+{
+	uint8_t image[IMAGE_MAX_LEN], out[IMAGE_MAX_LEN];
+	struct migration_report report;
+
+	memcpy(image, &gpu_cfg, sizeof(gpu_cfg));
+	view_desc_set_descriptor_length(image, view_desc_descriptor_length(image) - 1);
+	CHECK(migrate_image(image, sizeof(gpu_cfg), GPU_CFG_VERSION_MINOR_COMPACT, NULL, 0,
+		out, sizeof(out), &report) == 0);
+	CHECK(report.error != NULL);
+}
+
+int main(void)
+{
+	test_init();
+	for (int i = 0; i < skus.nprofiles; i++) {
+		test_round_trip(&skus.profiles[i]);
+	}
+	test_required();
+	test_truncated_chain();
+	return test_report("test_migrate");
+}
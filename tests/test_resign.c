@@ -0,0 +1,89 @@
+/*
+ * Re-signing on --set and --migrate: a signed image is only re-signed when
+ * its signature still verifies, so a body changed behind fresh CRCs is
+ * refused rather than given a valid signature.
+ */
+#include "test.h"
+
+/* A signed gpu image with intact CRCs, written to path */
+static size_t write_signed(const char *path, uint8_t *image)
+{
+	struct gpu_cfg_signature sig = {0};
+	size_t len;
+
+	memcpy(image, &gpu_cfg, sizeof(gpu_cfg));
+	len = append_block(image, sizeof(gpu_cfg), IMAGE_MAX_LEN, GPUCFG_TYPE_SIGNATURE, &sig, sizeof(sig));
+	CHECK(len > 0);
+	seal_image(image, len);
+	CHECK(verify_signature(image, len, resign_key) == NULL);
+	CHECK(write_image(path, image, len) == 0);
+	return len;
+}
+
+/* Flip a body byte and fix both CRCs, as a careless or hostile edit would */
+static void write_tampered(const char *path, uint8_t *image, size_t len)
+{
+	image[sizeof(struct gpu_cfg_descriptor) + sizeof(struct gpu_block_header)] ^= 1;
+	view_desc_set_descriptor_crc32(image, descriptor_body_crc(image));
+	view_desc_set_crc32(image, descriptor_header_crc(image));
+	CHECK(check_image(image, len) == NULL);
+	CHECK(verify_signature(image, len, resign_key) != NULL);
+	CHECK(write_image(path, image, len) == 0);
+}
+
+static void test_edit(const char *path)
+{
+	uint8_t image[IMAGE_MAX_LEN], after[IMAGE_MAX_LEN];
+	struct field_edit edit;
+	size_t len;
+
+	CHECK(parse_field_edit("fan[0].max_rpm=4000", &edit) == 0);
+	len = write_signed(path, image);
+	CHECK(edit_image(path, &edit, 1) == 0);
+	CHECK(load_image(path, after, sizeof(after)) == (long)len);
+	CHECK(verify_signature(after, len, resign_key) == NULL);
+
+	write_tampered(path, image, len);
+	CHECK(edit_image(path, &edit, 1) != 0);
+	/* Refused edits leave the file as it was */
+	CHECK(load_image(path, after, sizeof(after)) == (long)len);
+	CHECK(memcmp(image, after, len) == 0);
+}
+
+static void test_migrate(const char *path)
+{
+	struct migrate_batch batch = {.target = GPU_CFG_VERSION_MINOR_COMPACT};
+	uint8_t image[IMAGE_MAX_LEN], after[IMAGE_MAX_LEN];
+	size_t len;
+
+	len = write_signed(path, image);
+	write_tampered(path, image, len);
+	CHECK(migrate_file(path, &batch) != 0);
+	CHECK(load_image(path, after, sizeof(after)) == (long)len);
+	CHECK(memcmp(image, after, len) == 0);
+}
+
+int main(void)
+{
+	static struct ed25519_key key;
+	static struct ed25519_pubkey pub;
+	uint8_t seed[ED25519_SEED_LEN] = {1, 2, 3};
+	char dir[] = "/tmp/test_resign.XXXXXX";
+	char path[IMAGE_PATH_LEN];
+
+	test_init();
+	ed25519_key_from_seed(&key, seed);
+	ed25519_pubkey_load(&pub, key.pk);
+	sign_key = &key;
+	resign_key = &pub;
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/eeprom.bin", dir);
+	test_edit(path);
+	test_migrate(path);
+	unlink(path);
+	rmdir(dir);
+	return test_report("test_resign");
+}
@@ -0,0 +1,481 @@
+/*
+ * Watching a directory for new station dumps.
+ *
+ * On Linux the directory is watched with inotify: a file is picked up when
+ * the station closes it after writing, or when it is renamed into place.
+ * Elsewhere, or if inotify is not available, the directory is polled every
+ * WATCH_POLL_MS and files whose modification time is not older than the
+ * previous scan are picked up; a file that changes again is picked up again,
+ * unless it keeps its size and the second it was last modified in.
+ *
+ * New files go to the workers through a queue of fixed size. When it is full
+ * the watcher blocks and the kernel holds on to further events; if its event
+ * queue overflows, the directory is rescanned from the time of the last
+ * complete read, so nothing is lost but a file may be handed out twice. The
+ * same goes for a file that arrives during the catch-up scan at the start.
+ * Names starting with a dot are ignored, so stations can write to a hidden
+ * name and rename.
+ */
+#include <signal.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define WATCH_QUEUE_LEN 256
+#define WATCH_POLL_MS 50
+/* Files picked up in the second of the last scan, to not hand them out again */
+#define WATCH_MAX_RECENT 1024
+
+struct watch_item {
+	char path[IMAGE_PATH_LEN];
+	/* When the file was picked up, for the latency statistics */
+	uint64_t queued_us;
+};
+
+struct watch_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct watch_item items[WATCH_QUEUE_LEN];
+	unsigned long head;
+	unsigned long count;
+	bool closing;
+};
+
+struct watch_recent {
+	uint32_t name_crc;
+	time_t mtime;
+	off_t size;
+};
+
+struct dir_watch {
+	const char *dir;
+	int fd;
+	/* Files modified at or after this time are new to a scan */
+	time_t since;
+	struct watch_recent recent[WATCH_MAX_RECENT];
+	int nrecent;
+	/* Called for every file found, blocks while the consumer is busy */
+	void (*found)(void *ctx, const char *path);
+	void *ctx;
+};
+
+static void watch_queue_init(struct watch_queue *q)
+{
+	memset(q, 0, sizeof(*q));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+}
+
+static void watch_queue_destroy(struct watch_queue *q)
+{
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+}
+
+/**
+ * Queue a file, waiting while the queue is full.
+ */
+static void watch_queue_push(struct watch_queue *q, const char *path)
+{
+	struct watch_item *item;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == WATCH_QUEUE_LEN)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	item = &q->items[(q->head + q->count) % WATCH_QUEUE_LEN];
+	snprintf(item->path, sizeof(item->path), "%s", path);
+	item->queued_us = station_now_us();
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Take the oldest file off the queue, waiting for one.
+ *
+ * \return 0 on success, -1 once the queue is closed and empty
+ */
+static int watch_queue_pop(struct watch_queue *q, struct watch_item *item)
+{
+	pthread_mutex_lock(&q->lock);
+	while (!q->count && !q->closing)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	if (!q->count) {
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+	*item = q->items[q->head];
+	q->head = (q->head + 1) % WATCH_QUEUE_LEN;
+	q->count--;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+static void watch_queue_close(struct watch_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closing = true;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static bool watch_ignored(const char *name)
+{
+	return name[0] == '.';
+}
+
+static bool watch_seen(struct dir_watch *w, uint32_t name_crc, const struct stat *st)
+{
+	for (int i = 0; i < w->nrecent; i++)
+		if (w->recent[i].name_crc == name_crc && w->recent[i].mtime == st->st_mtime &&
+		    w->recent[i].size == st->st_size)
+			return true;
+	return false;
+}
+
+/**
+ * Hand out every file modified since w->since that was not handed out
+ * already, then move w->since up to the start of this scan.
+ *
+ * \return 0 on success, -1 if the directory cannot be read
+ */
+static int dir_watch_scan(struct dir_watch *w)
+{
+	char path[IMAGE_PATH_LEN];
+	time_t start = time(NULL);
+	struct dirent *ent;
+	DIR *dir = opendir(w->dir);
+	int kept = 0;
+
+	if (!dir) {
+		fprintf(stderr, "%s: %s\n", w->dir, strerror(errno));
+		return -1;
+	}
+	/* Files from before since are not looked at again, no need to remember them */
+	for (int i = 0; i < w->nrecent; i++)
+		if (w->recent[i].mtime >= w->since)
+			w->recent[kept++] = w->recent[i];
+	w->nrecent = kept;
+	while ((ent = readdir(dir))) {
+		struct stat st;
+		uint32_t name_crc;
+
+		if (watch_ignored(ent->d_name))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", w->dir, ent->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_mtime < w->since)
+			continue;
+		name_crc = crc_finalize(crc_update(crc_init(), ent->d_name, strlen(ent->d_name)));
+		if (watch_seen(w, name_crc, &st))
+			continue;
+		if (st.st_mtime >= start && w->nrecent < WATCH_MAX_RECENT)
+			w->recent[w->nrecent++] = (struct watch_recent){name_crc, st.st_mtime, st.st_size};
+		w->found(w->ctx, path);
+	}
+	closedir(dir);
+	w->since = start;
+	return 0;
+}
+
+/**
+ * Start watching dir. Files modified at or after since are handed out by
+ * the first call to dir_watch_next, so a restarted watcher catches up.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int dir_watch_open(struct dir_watch *w, const char *dir, time_t since,
+			  void (*found)(void *ctx, const char *path), void *ctx)
+{
+	struct stat st;
+
+	memset(w, 0, sizeof(*w));
+	w->dir = dir;
+	w->since = since;
+	w->found = found;
+	w->ctx = ctx;
+	w->fd = -1;
+	if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "%s: not a directory\n", dir);
+		return -1;
+	}
+#ifdef __linux__
+	w->fd = inotify_init1(IN_CLOEXEC);
+	if (w->fd >= 0 && inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		/* Out of watches, or a file system without inotify support */
+		fprintf(stderr, "%s: %s, polling instead\n", dir, strerror(errno));
+		close(w->fd);
+		w->fd = -1;
+	}
+#endif
+	/* The catch-up scan, done before any event is read */
+	return dir_watch_scan(w);
+}
+
+static void dir_watch_close(struct dir_watch *w)
+{
+	if (w->fd >= 0)
+		close(w->fd);
+	w->fd = -1;
+}
+
+/**
+ * Wait up to WATCH_POLL_MS for new files and hand them out.
+ *
+ * \return 0 on success or timeout, -1 on error or when interrupted by a signal
+ */
+static int dir_watch_next(struct dir_watch *w)
+{
+#ifdef __linux__
+	if (w->fd >= 0) {
+		char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		char path[IMAGE_PATH_LEN];
+		struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+		time_t start = time(NULL);
+		ssize_t n;
+
+		/* Wake up now and then, a stop request may come between checks */
+		n = poll(&pfd, 1, WATCH_POLL_MS);
+		if (n > 0)
+			n = read(w->fd, buf, sizeof(buf));
+		if (n == 0) {
+			w->since = start;
+			return 0;
+		}
+		if (n < 0) {
+			if (errno != EINTR)
+				fprintf(stderr, "%s: %s\n", w->dir, strerror(errno));
+			return -1;
+		}
+		for (char *p = buf; p < buf + n;) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+
+			p += sizeof(*ev) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				fprintf(stderr, "%s: event queue overflow, rescanning\n", w->dir);
+				if (dir_watch_scan(w))
+					return -1;
+				continue;
+			}
+			if ((ev->mask & IN_ISDIR) || !ev->len || watch_ignored(ev->name))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", w->dir, ev->name);
+			w->found(w->ctx, path);
+		}
+		/* Everything before this read has been seen */
+		w->since = start;
+		w->nrecent = 0;
+		return 0;
+	}
+#endif
+	{
+		struct timespec ts = {.tv_sec = 0, .tv_nsec = WATCH_POLL_MS * 1000000L};
+
+		if (nanosleep(&ts, NULL) < 0)
+			return -1;
+		return dir_watch_scan(w);
+	}
+}
+
+/*
+ * Index of the latest dump per unit. Lines are kept in memory, keyed by
+ * serial, or by path for dumps without a readable one, and the file is
+ * rewritten whole, sorted by key, through a hidden temporary and a rename:
+ * readers never see a partial index, and a watcher of the directory the
+ * index lives in skips the temporary.
+ */
+#define DUMP_INDEX_LINE_LEN (IMAGE_PATH_LEN + 256)
+
+struct dump_index_entry {
+	char *key;
+	char *line;
+};
+
+struct dump_index {
+	const char *path;
+	char tmp_path[IMAGE_PATH_LEN];
+	/* Open addressing, cap is a power of two and at most half full */
+	struct dump_index_entry *slots;
+	size_t cap;
+	size_t count;
+	/* Set when the file is behind the table */
+	bool dirty;
+};
+
+static struct dump_index_entry *dump_index_slot(struct dump_index *x, const char *key)
+{
+	size_t i = crc_finalize(crc_update(crc_init(), key, strlen(key))) & (x->cap - 1);
+
+	while (x->slots[i].key && strcmp(x->slots[i].key, key))
+		i = (i + 1) & (x->cap - 1);
+	return &x->slots[i];
+}
+
+/**
+ * Make line the current line of key.
+ *
+ * \return 0 on success, -1 out of memory
+ */
+static int dump_index_set(struct dump_index *x, const char *key, const char *line)
+{
+	struct dump_index_entry *e;
+	char *copy;
+
+	if ((x->count + 1) * 2 > x->cap) {
+		struct dump_index_entry *old = x->slots;
+		size_t old_cap = x->cap;
+		size_t cap = old_cap ? old_cap * 2 : 1024;
+
+		x->slots = calloc(cap, sizeof(*x->slots));
+		if (!x->slots) {
+			x->slots = old;
+			return -1;
+		}
+		x->cap = cap;
+		for (size_t i = 0; i < old_cap; i++)
+			if (old[i].key)
+				*dump_index_slot(x, old[i].key) = old[i];
+		free(old);
+	}
+	copy = strdup(line);
+	if (!copy)
+		return -1;
+	e = dump_index_slot(x, key);
+	if (e->key) {
+		free(e->line);
+	} else {
+		e->key = strdup(key);
+		if (!e->key) {
+			free(copy);
+			return -1;
+		}
+		x->count++;
+	}
+	e->line = copy;
+	x->dirty = true;
+	return 0;
+}
+
+/**
+ * Key of an index line: its serial column, or its path column if the
+ * serial is empty. key holds DUMP_INDEX_LINE_LEN bytes.
+ */
+static void dump_index_line_key(const char *line, char *key)
+{
+	const char *p = line;
+	size_t n;
+
+	if (*p == ',') {
+		/* serial,status,config_sha256,path,indexed_at: skip to the third comma */
+		for (int col = 0; col < 2 && p; col++)
+			p = strchr(p + 1, ',');
+		p = p ? p + 1 : line;
+	}
+	n = strcspn(p, ",\n");
+	memcpy(key, p, n);
+	key[n] = '\0';
+}
+
+/**
+ * Set up the index kept in path and read the lines already in it; where an
+ * older append-only index has several lines for a unit, the last one wins.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int dump_index_open(struct dump_index *x, const char *path)
+{
+	char line[DUMP_INDEX_LINE_LEN], key[DUMP_INDEX_LINE_LEN];
+	const char *base = strrchr(path, '/');
+	FILE *fptr;
+
+	memset(x, 0, sizeof(*x));
+	x->path = path;
+	base = base ? base + 1 : path;
+	snprintf(x->tmp_path, sizeof(x->tmp_path), "%.*s.%s.tmp", (int)(base - path), path, base);
+	fptr = fopen(path, "r");
+	if (!fptr) {
+		if (errno == ENOENT)
+			return 0;
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fptr)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		dump_index_line_key(line, key);
+		if (dump_index_set(x, key, line)) {
+			fprintf(stderr, "out of memory\n");
+			fclose(fptr);
+			return -1;
+		}
+	}
+	fclose(fptr);
+	x->dirty = false;
+	return 0;
+}
+
+static int dump_index_compare(const void *a, const void *b)
+{
+	return strcmp((*(const struct dump_index_entry *const *)a)->key,
+		      (*(const struct dump_index_entry *const *)b)->key);
+}
+
+/**
+ * Rewrite the index file with one line per unit, header first.
+ *
+ * \return 0 on success, -1 on error (reported on stderr)
+ */
+static int dump_index_write(struct dump_index *x, const char *header)
+{
+	struct dump_index_entry **sorted = malloc((x->count ? x->count : 1) * sizeof(*sorted));
+	size_t n = 0;
+	FILE *fptr;
+	int ret = 0;
+
+	if (!sorted) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	for (size_t i = 0; i < x->cap; i++)
+		if (x->slots[i].key)
+			sorted[n++] = &x->slots[i];
+	qsort(sorted, n, sizeof(*sorted), dump_index_compare);
+
+	fptr = fopen(x->tmp_path, "w");
+	if (!fptr) {
+		fprintf(stderr, "failed to open %s: %s\n", x->tmp_path, strerror(errno));
+		free(sorted);
+		return -1;
+	}
+	fputs(header, fptr);
+	for (size_t i = 0; i < n; i++)
+		fputs(sorted[i]->line, fptr);
+	free(sorted);
+	if (ferror(fptr))
+		ret = -1;
+	if (fclose(fptr) == EOF)
+		ret = -1;
+	if (!ret && rename(x->tmp_path, x->path) < 0)
+		ret = -1;
+	if (ret) {
+		fprintf(stderr, "failed to write %s: %s\n", x->path, strerror(errno));
+		unlink(x->tmp_path);
+		return -1;
+	}
+	x->dirty = false;
+	return 0;
+}
+
+static void dump_index_close(struct dump_index *x)
+{
+	for (size_t i = 0; i < x->cap; i++) {
+		free(x->slots[i].key);
+		free(x->slots[i].line);
+	}
+	free(x->slots);
+	memset(x, 0, sizeof(*x));
+}